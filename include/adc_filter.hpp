@@ -0,0 +1,114 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Sliding window of the samples of an ADC pin and the EMA of its medians, see
+// adcMeasurement(). Hardware independent, the parameters are taken from
+// config.hpp.
+template <uint8_t WindowSize, uint8_t EmaShift, uint8_t MinStep,
+          uint8_t NoiseFactor>
+struct AdcFilterWindow {
+  static_assert((1023UL << EmaShift) <= UINT16_MAX,
+                "EmaShift is too large for the EMA!");
+
+  uint16_t samples[WindowSize];
+  uint8_t count;
+  uint8_t next;
+  // in 1/2^EmaShift
+  uint16_t ema;
+  // largest deviation of a window of back to back samples from its median,
+  // smoothed over the windows, in 1/4
+  uint16_t noise;
+  // the next median starts the EMA over, see changed()
+  bool emaStale;
+
+  // The next sample starts the window and the EMA over
+  void reset() {
+    count = 0;
+    next = 0;
+  }
+
+  // The quantity may have changed since the last measurement, e.g. by
+  // pumping. The window is kept as long as the fresh samples fit it, a change
+  // beyond the noise starts it over anyway. Only the EMA starts over to follow
+  // a change within the noise without lag.
+  void changed() { emaStale = true; }
+
+  bool full() const { return count == WindowSize; }
+
+  void push(uint16_t sample) {
+    samples[next] = sample;
+    next = (next + 1) % WindowSize;
+    if (count < WindowSize) {
+      ++count;
+    }
+  }
+
+  // Pushes a fresh sample, the quantity measured changed if it does not fit
+  // the samples taken before. Returns true if the window started over.
+  bool pushFresh(uint16_t sample) {
+    bool restarted = !full();
+    if (count != 0 && distance(sample, median()) > maxStep()) {
+      reset();
+      restarted = true;
+    }
+    push(sample);
+    return restarted;
+  }
+
+  // Largest distance of a fresh sample to the median that is still noise
+  uint16_t maxStep() const {
+    const uint16_t step = static_cast<uint32_t>(NoiseFactor) * noise / 4;
+    return step > MinStep ? step : MinStep;
+  }
+
+  uint16_t median() const {
+    uint16_t sorted[WindowSize];
+    memcpy(sorted, samples, sizeof(sorted[0]) * count);
+
+    // use the quicksort algorithm provided by the avr library
+    qsort(sorted, count, sizeof(sorted[0]), compare);
+
+    if ((count % 2) == 0) {
+      return (sorted[count / 2 - 1] + sorted[count / 2]) / 2;
+    }
+    return sorted[count / 2];
+  }
+
+  // The smoothed median of the full window, restarted as returned by
+  // pushFresh()
+  uint16_t value(bool restarted) {
+    const uint16_t value = median();
+    if (restarted) {
+      // the window was filled back to back, its spread is the noise of the
+      // sensor
+      uint16_t deviation = 0;
+      for (uint8_t i = 0; i < count; ++i) {
+        const uint16_t d = distance(samples[i], value);
+        deviation = d > deviation ? d : deviation;
+      }
+      noise = noise - noise / 4 + deviation;
+    }
+    if (restarted || emaStale) {
+      // older medians do not apply anymore
+      ema = value << EmaShift;
+    } else {
+      ema = ema - (ema >> EmaShift) + value;
+    }
+    emaStale = false;
+    return (ema + (1 << EmaShift) / 2) >> EmaShift;
+  }
+
+private:
+  static uint16_t distance(uint16_t a, uint16_t b) {
+    return a > b ? a - b : b - a;
+  }
+
+  static int compare(const void *i1, const void *i2) {
+    uint16_t val1 = *reinterpret_cast<const uint16_t *>(i1);
+    uint16_t val2 = *reinterpret_cast<const uint16_t *>(i2);
+    return static_cast<int>(val1) - val2;
+  }
+};
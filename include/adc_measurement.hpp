@@ -2,6 +2,32 @@
 
 #include <Arduino.h>
 
-uint16_t adcMeasurement(uint8_t pin);
+// Work done after every delay between the samples of a measurement, e.g. to
+// keep watching the running pumps. It may read other pins, the conversion after
+// it is discarded.
+struct AdcIdle {
+  void (*run)(void *ctx);
+  void *ctx;
+};
+
+uint16_t adcMeasurement(uint8_t pin, const AdcIdle *idle = nullptr);
+// The quantity of the pin may have changed since its last measurement, e.g. by
+// pumping, the next measurement does not smooth it with the older ones
+void adcQuantityChanged(uint8_t pin);
 uint8_t clampedMeasurement(uint8_t pin, uint16_t min, uint16_t max,
-                           uint16_t &rawMeasurement);
+                           uint16_t &rawMeasurement,
+                           const AdcIdle *idle = nullptr);
+
+// A powered sensor, id indexes Settings::sensConfs: the plants followed by the
+// water tanks
+struct SettlingSensor {
+  uint8_t pin;
+  uint8_t id;
+};
+
+// Waits until the freshly powered sensors settled, returns the time waited in
+// ms
+uint16_t waitUntilSettled(const SettlingSensor *sensors, uint8_t count);
+
+// Supply voltage in mV, measured as the internal bandgap against AVcc
+uint16_t measureSupplyMilliVolt();
@@ -0,0 +1,177 @@
+#pragma once
+
+#include <Arduino.h>
+
+#include "macros.hpp"
+
+// Compile-time description of the controller hardware.
+//
+// A board description is a plain struct listing its pins and shift register
+// outputs, see BoardV01 below. Board<Desc> derives everything else from it at
+// compile time: the shift register word type, the power masks per sensor &
+// pump as well as the dimensions of the Settings and Status layouts. Adding a
+// board with more plants, tanks or chained shift registers only requires a
+// new description.
+
+// Shift register output, counted from the LSb of the last register in the
+// chain, i.e. the first bit shifted out ends up at the highest output
+typedef uint8_t ShiftRegOut;
+
+#define NO_SHIFT_REG_OUT 0xFF
+
+struct PlantDesc {
+  uint8_t moistSensPin;
+  ShiftRegOut moistSensPwr;
+  ShiftRegOut pumpPwr;
+};
+
+struct TankDesc {
+  uint8_t waterSensPin;
+  ShiftRegOut waterSensPwr;
+};
+
+template <uint8_t Bytes>
+struct ShiftRegWordFor;
+template <>
+struct ShiftRegWordFor<1> {
+  typedef uint8_t type;
+};
+template <>
+struct ShiftRegWordFor<2> {
+  typedef uint16_t type;
+};
+template <>
+struct ShiftRegWordFor<3> {
+  typedef uint32_t type;
+};
+template <>
+struct ShiftRegWordFor<4> {
+  typedef uint32_t type;
+};
+
+template <class T, uint8_t N>
+struct ConstTable {
+  T data[N];
+
+  constexpr const T &operator[](uint8_t i) const { return data[i]; }
+  constexpr const T *begin() const { return data; }
+  constexpr const T *end() const { return data + N; }
+  static constexpr uint8_t size() { return N; }
+};
+
+namespace board_detail {
+  template <class Desc>
+  constexpr uint8_t shiftRegBits() {
+    return Desc::shiftRegCount * 8;
+  }
+
+  template <class Word>
+  constexpr Word mask(ShiftRegOut out) {
+    return out == NO_SHIFT_REG_OUT ? 0 : static_cast<Word>(1) << out;
+  }
+
+  template <class T, uint8_t N, class Getter>
+  constexpr ConstTable<T, N> makeTable(const Getter &get) {
+    ConstTable<T, N> t{};
+    for (uint8_t i = 0; i < N; ++i) {
+      t.data[i] = get(i);
+    }
+    return t;
+  }
+
+  // Sanity check: every output must exist and may only be used once
+  template <class Desc, class Word>
+  constexpr bool validOutputs() {
+    constexpr uint8_t bits = shiftRegBits<Desc>();
+    Word used = 0;
+    auto claim = [&](ShiftRegOut out) {
+      if (out == NO_SHIFT_REG_OUT) {
+        return true;
+      }
+      if (out >= bits || (used & mask<Word>(out)) != 0) {
+        return false;
+      }
+      used |= mask<Word>(out);
+      return true;
+    };
+
+    bool valid = claim(Desc::ethPwr);
+    for (const auto &p : Desc::plants) {
+      valid = valid && claim(p.moistSensPwr) && claim(p.pumpPwr);
+    }
+    for (const auto &t : Desc::tanks) {
+      valid = valid && claim(t.waterSensPwr);
+    }
+    return valid;
+  }
+} // namespace board_detail
+
+template <class Desc>
+struct Board {
+  static constexpr uint8_t plantCount = CONST_ARRAY_SIZE(Desc::plants);
+  static constexpr uint8_t tankCount = CONST_ARRAY_SIZE(Desc::tanks);
+  static constexpr uint8_t shiftRegBits = board_detail::shiftRegBits<Desc>();
+
+  static constexpr uint8_t shiftRegDataClkPin = Desc::shiftRegDataClkPin;
+  static constexpr uint8_t shiftRegOutputUpdatePin =
+      Desc::shiftRegOutputUpdatePin;
+  static constexpr uint8_t shiftRegOutputEnPin = Desc::shiftRegOutputEnPin;
+  static constexpr uint8_t shiftRegDataPin = Desc::shiftRegDataPin;
+
+  typedef typename ShiftRegWordFor<Desc::shiftRegCount>::type Word;
+
+  static_assert(plantCount > 0 && tankCount > 0, "Board without sensors!");
+  static_assert(tankCount <= 8, "At most 8 water tanks are supported!");
+  static_assert(board_detail::validOutputs<Desc, Word>(),
+                "Board description uses a shift register output twice or "
+                "an output that does not exist!");
+
+  static constexpr ConstTable<uint8_t, plantCount> moistSensPins =
+      board_detail::makeTable<uint8_t, plantCount>(
+          [](uint8_t i) { return Desc::plants[i].moistSensPin; });
+  static constexpr ConstTable<Word, plantCount> moistSensPwrMap =
+      board_detail::makeTable<Word, plantCount>([](uint8_t i) {
+        return board_detail::mask<Word>(Desc::plants[i].moistSensPwr);
+      });
+  static constexpr ConstTable<Word, plantCount> pumpPwrMap =
+      board_detail::makeTable<Word, plantCount>([](uint8_t i) {
+        return board_detail::mask<Word>(Desc::plants[i].pumpPwr);
+      });
+  static constexpr ConstTable<uint8_t, tankCount> waterSensPins =
+      board_detail::makeTable<uint8_t, tankCount>(
+          [](uint8_t i) { return Desc::tanks[i].waterSensPin; });
+  static constexpr ConstTable<Word, tankCount> waterSensPwrMap =
+      board_detail::makeTable<Word, tankCount>([](uint8_t i) {
+        return board_detail::mask<Word>(Desc::tanks[i].waterSensPwr);
+      });
+  static constexpr Word ethPwrMask =
+      board_detail::mask<Word>(Desc::ethPwr);
+};
+
+// uint16_t shiftReg: P = Pump, M = moisture sensor, W = water sensor
+// { UNUSED_1, P1, P6, P5, P4, P3, P2, UNUSED_2, M6, W1, M3, M2, M1, M5, M4, W2
+// }
+//   ^--- MSb                                                         LSb ---^
+struct BoardV01 {
+  static constexpr uint8_t shiftRegCount = 2;
+  static constexpr uint8_t shiftRegDataClkPin = 6;
+  static constexpr uint8_t shiftRegOutputUpdatePin = 7;
+  static constexpr uint8_t shiftRegOutputEnPin = 8;
+  static constexpr uint8_t shiftRegDataPin = 9;
+
+  static constexpr PlantDesc plants[] = {
+      {A2, /*M1*/ 3, /*P1*/ 14}, {A3, /*M2*/ 4, /*P2*/ 9},
+      {A7, /*M3*/ 5, /*P3*/ 10}, {A4, /*M4*/ 1, /*P4*/ 11},
+      {A5, /*M5*/ 2, /*P5*/ 12}, {A6, /*M6*/ 7, /*P6*/ 13}};
+  static constexpr TankDesc tanks[] = {{A0, /*W1*/ 6}, {A1, /*W2*/ 0}};
+
+  static constexpr ShiftRegOut ethPwr = NO_SHIFT_REG_OUT;
+};
+
+// v0.2 only fixed the power input polarity
+typedef BoardV01 BoardV02;
+
+// v0.3 switches the W5500 Ethernet module with the former UNUSED_2 output
+struct BoardV03 : BoardV01 {
+  static constexpr ShiftRegOut ethPwr = 8;
+};
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <Arduino.h>
+
+#include "config.hpp"
+
+// Clock governor: the CPU idles at CLOCK_PRESCALE_SLOW and only runs at full
+// speed for bursts of work like SPI transfers or bit banging the shift
+// register, which then keep the peripherals powered for a shorter time.
+//
+// F_CPU, and hence _delay_ms() and the baud rate of Serial.begin(), refers to
+// the slow clock. Waits have to use delayMs() which scales with the current
+// speed. Libraries with their own busy waits, i.e. the DHCP & connection
+// handling of the Ethernet library, must run at the slow clock. The watchdog
+// has its own oscillator and is not affected at all.
+
+// CLKPS values, the clock is divided by 2^prescale
+#define CLOCK_PRESCALE_FULL 0
+#ifdef DEBUG_NORMAL_CPU_SPEED
+#define CLOCK_PRESCALE_SLOW CLOCK_PRESCALE_FULL
+#else
+// 16 MHz / 256 = 62.5 kHz
+#define CLOCK_PRESCALE_SLOW 8
+#endif
+
+// The prescale F_CPU refers to
+constexpr uint8_t fCpuClockPrescale() {
+  uint8_t prescale = 0;
+  while (((CLOCK_SOURCE_HZ) >> prescale) > (F_CPU)) {
+    ++prescale;
+  }
+  return prescale;
+}
+static_assert(((CLOCK_SOURCE_HZ) >> fCpuClockPrescale()) == (F_CPU),
+              "F_CPU has to be CLOCK_SOURCE_HZ divided by a power of two");
+static_assert(CLOCK_PRESCALE_SLOW <= fCpuClockPrescale(),
+              "The slow clock may not be slower than F_CPU");
+
+extern uint8_t currentClockPrescale;
+
+// Switches the system clock, a running serial transmission is finished first
+// and the baud rate is kept
+void setClockPrescale(uint8_t prescale);
+
+// Busy waits the given compile-time constant amount of milliseconds at the
+// current clock speed
+__attribute__((always_inline)) inline void delayMs(double ms) {
+  const uint16_t repetitions =
+      static_cast<uint16_t>(1) << (fCpuClockPrescale() - currentClockPrescale);
+  for (uint16_t i = 0; i < repetitions; ++i) {
+    _delay_ms(ms);
+  }
+}
+
+// Runs at full speed until the end of the scope, the previous speed is
+// restored afterwards
+class ClockBoost {
+public:
+  ClockBoost() : prevPrescale(currentClockPrescale) {
+    setClockPrescale(CLOCK_PRESCALE_FULL);
+  }
+  ~ClockBoost() { setClockPrescale(prevPrescale); }
+
+  ClockBoost(const ClockBoost &) = delete;
+  ClockBoost &operator=(const ClockBoost &) = delete;
+
+private:
+  const uint8_t prevPrescale;
+};
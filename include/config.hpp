@@ -1,9 +1,27 @@
 #pragma once
 
+#include "board.hpp"
+
 // #define BOARD_VERSION 0x0010 /*v0.1*/
 // #define BOARD_VERSION 0x0020 /*v0.2*/
 #define BOARD_VERSION 0x0030 /*v0.3*/
 
+// The hardware description, see board.hpp for the available boards
+#if BOARD_VERSION >= 0x0030
+typedef Board<BoardV03> HW;
+#elif BOARD_VERSION >= 0x0020
+typedef Board<BoardV02> HW;
+#else
+typedef Board<BoardV01> HW;
+#endif
+
+// The Settings & Status layouts are generated for the selected board
+#ifdef MAX_MOISTURE_SENSOR_COUNT
+#error "config.hpp has to be included before settings_defs.hpp!"
+#endif
+#define MAX_MOISTURE_SENSOR_COUNT (HW::plantCount)
+#define MAX_WATER_SENSOR_COUNT (HW::tankCount)
+
 // Configure modes
 // #define DUMP_SOIL_MOISTURES_MEASUREMENTS
 #ifndef DUMP_SOIL_MOISTURES_MEASUREMENTS
@@ -35,6 +53,14 @@
 #define FALLBACK_DNS LOCAL_NETWORK_SUBNET, 1
 #define LOCAL_SERVER_IP LOCAL_NETWORK_SUBNET, 42
 #define LOCAL_SERVER_PORT 42424
+
+// Exchange the reports and settings as single UDP datagrams on
+// LOCAL_SERVER_PORT instead of a TCP connection, this saves the handshake and
+// teardown of the connection
+// #define USE_UDP_TRANSPORT
+// Retransmissions of an unacknowledged datagram
+#define UDP_RETRANSMITS 3
+#define UDP_ACK_TIMEOUT_MS 500
 #else
 // SPI will be required for the Ethernet connection
 #define DISABLE_SPI
@@ -42,6 +68,9 @@
 
 // Config
 
+// Frequency of the crystal, F_CPU is derived from it by the clock prescaler
+#define CLOCK_SOURCE_HZ 16000000UL
+
 // We can't increase the serial speed much with our low CPU frequency!
 #ifdef DEBUG_NORMAL_CPU_SPEED
 #define SERIAL_BAUD_RATE 9600
@@ -50,22 +79,65 @@
 #endif
 
 #define MEASURE_DELAY_MS 200
-#define POWER_ON_DELAY_MS 500
+// Powered sensors are sampled every SETTLE_SAMPLE_MS until two consecutive
+// readings differ by at most SETTLE_TOLERANCE, but not longer than
+// SETTLE_MAX_MS. The settle time of every sensor is learned in the EEPROM.
+#define SETTLE_SAMPLE_MS 20
+#define SETTLE_TOLERANCE 4
+#define SETTLE_MAX_MS 1000
 #define ADC_MEASUREMENTS 5
+// Every pin keeps its last ADC_MEASUREMENTS samples while its sensor is
+// powered, a measurement only takes one fresh sample. A sample that differs
+// from the median by more than ADC_FILTER_NOISE_FACTOR times the noise
+// measured on the pin, but at least ADC_FILTER_MIN_STEP, starts the window
+// over. The EMA of a sensor starts over after pumping.
+#define ADC_FILTER_MIN_STEP 2
+#define ADC_FILTER_NOISE_FACTOR 3
+// The medians are smoothed by an EMA with a weight of 2^-ADC_EMA_SHIFT
+#define ADC_EMA_SHIFT 1
+// Resolution of the pump bursts, the water level is sampled once per tick
+// while the pump is running: 16, 32, 64, 125, 250 or 500 ms
+#define PUMP_TICK_MS 125
+// Consecutive samples at or below the empty threshold that cut the pump, a
+// single noisy ADC reading must not stop the irrigation
+#define PUMP_EMPTY_SAMPLES 2
+// Pumps running at the same time, limited by the power supply. The soak
+// windows of all plants are interleaved regardless.
+#define MAX_CONCURRENT_PUMPS 2
+// Plants sharing a water tank reuse its level for up to
+// TANK_LEVEL_MAX_AGE_SEC, extrapolated by the time pumped since. The tank is
+// measured again as soon as the estimate comes within TANK_LEVEL_MARGIN % of
+// its warning or empty threshold.
+#define TANK_LEVEL_MAX_AGE_SEC 120
+#define TANK_LEVEL_MARGIN 10
+
+// The supply voltage is derived from the internal bandgap reference measured
+// against AVcc, this is the battery voltage only if it powers the MCU without
+// a regulator. The bandgap varies from 1.0 to 1.2 V between the chips,
+// calibrate BANDGAP_MILLIVOLT with a multimeter.
+#define BANDGAP_MILLIVOLT 1100
+#define BANDGAP_SETTLE_MS 2
+#define SUPPLY_MEASUREMENTS 4
+// Energy budget: below BATTERY_LOW_MV every other wake up of the schedule is
+// skipped, the moisture targets are lowered by BATTERY_MOISTURE_SLACK % so
+// that only the driest plants are irrigated and the settings are exchanged
+// within the report session. Below BATTERY_CRITICAL_MV only every fourth wake
+// up is taken, the slack doubled and a session without events is only opened
+// every BATTERY_CRITICAL_SESSION_CYCLES cycles. A level is left once the
+// voltage recovered by BATTERY_HYSTERESIS_MV.
+#define BATTERY_LOW_MV 3500
+#define BATTERY_CRITICAL_MV 3300
+#define BATTERY_HYSTERESIS_MV 50
+#define BATTERY_MOISTURE_SLACK 10
+#define BATTERY_CRITICAL_SESSION_CYCLES 4
 
 // time between moisture checks: default every 6 hours
+// NOTE: the server may request a different wake time with each settings
+// response, this value is only used if no server schedule is available
 #define SLEEP_PERIOD_MIN static_cast<uint16_t>(6) * 60
-
-#define SHIFT_REG_DATA_CLK_PIN 6
-#define SHIFT_REG_OUTPUT_UPDATE_PIN 7
-#define SHIFT_REG_OUTPUT_EN_PIN 8
-#define SHIFT_REG_DATA_PIN 9
-
-#define MOISTURE_SENSOR_PINS                                                   \
-  { A2, A3, A7, A4, A5, A6 }
-
-#define WATER_SENSOR_PINS                                                      \
-  { A0, A1 }
+// lower bound for the sleep duration, in case a cycle took longer than
+// requested
+#define MIN_SLEEP_PERIOD_SEC 60
 
 #ifdef DEBUG_SERIAL_PRINTS
 // Reactivate the serial port if we desire serial prints!
@@ -82,76 +154,26 @@
   { /*D*/ 2, /*D*/ 3, /*D*/ 4, /*D*/ 5 }
 #endif
 
-// uint16_t shiftReg: P = Pump, M = moisture sensor, W = water sensor
-// { UNUSED_1, P1, P6, P5, P4, P3, P2, UNUSED_2, M6, W1, M3, M2, M1, M5, M4, W2
-// }
-//   ^--- MSb                                                         LSb ---^
-#define PUMP_PWR_MAPPING                                                       \
-  {                                                                            \
-    (static_cast<uint16_t>(1) << 14),     /* Pump 1 */                         \
-        (static_cast<uint16_t>(1) << 9),  /* Pump 2 */                         \
-        (static_cast<uint16_t>(1) << 10), /* Pump 3 */                         \
-        (static_cast<uint16_t>(1) << 11), /* Pump 4 */                         \
-        (static_cast<uint16_t>(1) << 12), /* Pump 5 */                         \
-        (static_cast<uint16_t>(1) << 13)  /* Pump 6 */                         \
-  }
-
-#define MOIST_SENS_PWR_MAPPING                                                 \
-  {                                                                            \
-    (static_cast<uint16_t>(1) << 3),     /* Sens 1 */                          \
-        (static_cast<uint16_t>(1) << 4), /* Sens 2 */                          \
-        (static_cast<uint16_t>(1) << 5), /* Sens 3 */                          \
-        (static_cast<uint16_t>(1) << 1), /* Sens 4 */                          \
-        (static_cast<uint16_t>(1) << 2), /* Sens 5 */                          \
-        (static_cast<uint16_t>(1) << 7)  /* Sens 6 */                          \
-  }
-
-#define WATER_SENS_PWR_MAPPING                                                 \
-  {                                                                            \
-    (static_cast<uint16_t>(1) << 6),    /* Sens 1 */                           \
-        (static_cast<uint16_t>(1) << 0) /* Sens 2 */                           \
-  }
-
 #if BOARD_VERSION >= 0x0030
-#define ETH_PWR_MAPPING (static_cast<uint16_t>(1) << 8) /* Unused 2 */
-#define UNUSED_PWR_MAPPING                                                     \
-  { (static_cast<uint16_t>(1) << 15) /* Unused 1 */ }
-
-#else
-#define UNUSED_PWR_MAPPING                                                     \
-  {                                                                            \
-    (static_cast<uint16_t>(1) << 15),   /* Unused 1 */                         \
-        (static_cast<uint16_t>(1) << 8) /* Unused 2 */                         \
-  }
+#define ETH_PWR_MAPPING (HW::ethPwrMask)
 #endif
 
 #define DEFAULT_NUM_PLANTS 1
 
-#define DEFAULT_MOISTURE_MIN_VALUES                                            \
-  { 200, 200, 200, 200, 200, 200 }
-#define DEFAULT_MOISTURE_MAX_VALUES                                            \
-  { 500, 500, 500, 500, 500, 500 }
-#define DEFAULT_MOISTURE_TARGET_THRESHOLDS                                     \
-  { 50, 50, 50, 50, 50, 50 }
-#define DEFAULT_MOIST_TO_WATER_MAPPINGS                                        \
-  { 0, 0, 0, 0, 0, 0 }
-#define DEFAULT_PLANT_SKIP_VALUES                                              \
-  { 1, 1, 1, 1, 1, 1 }
-#define DEFAULT_BURST_DURATION_SEC                                             \
-  { 2, 2, 2, 2, 2, 2 }
-#define DEFAULT_BURST_DELAY_SEC                                                \
-  { 5, 5, 5, 5, 5, 5 }
-#define DEFAULT_MAX_BURSTS                                                     \
-  { 5, 5, 5, 5, 5, 5 }
-
-#define DEFAULT_WATER_MIN_VALUES                                               \
-  { 180, 180 }
-#define DEFAULT_WATER_MAX_VALUES                                               \
-  { 480, 480 }
-#define DEFAULT_WATER_WARNING_THRESHOLDS                                       \
-  { 50, 50 }
-#define DEFAULT_WATER_EMPTY_THRESHOLDS                                         \
-  { 20, 20 }
+// Default settings, applied to every plant & water tank of the board
+#define DEFAULT_MOISTURE_MIN_VALUE 200
+#define DEFAULT_MOISTURE_MAX_VALUE 500
+#define DEFAULT_MOISTURE_TARGET_THRESHOLD 50
+#define DEFAULT_MOIST_TO_WATER_MAPPING 0
+#define DEFAULT_PLANT_SKIP_VALUE 1
+#define DEFAULT_BURST_DURATION_SEC 2
+#define DEFAULT_BURST_DELAY_SEC 5
+#define DEFAULT_MAX_BURSTS 5
+
+#define DEFAULT_WATER_MIN_VALUE 180
+#define DEFAULT_WATER_MAX_VALUE 480
+#define DEFAULT_WATER_WARNING_THRESHOLD 50
+#define DEFAULT_WATER_EMPTY_THRESHOLD 20
 
 #ifndef DISABLE_SERIAL
 #warning                                                                       \
@@ -5,6 +5,17 @@
 #include "config.hpp"
 #include "lan_protocol.hpp"
 
+// Controller side state of a cycle, sent sparsely as REPORT_STATUS_V2
+struct CycleStatus {
+  StatusHeaderV2 header;
+  uint8_t ticksSinceIrrigation[MAX_MOISTURE_SENSOR_COUNT];
+  RawReading tanks[MAX_WATER_SENSOR_COUNT];
+  PlantReading plants[MAX_MOISTURE_SENSOR_COUNT];
+};
+
+// A cycle reports at most one event per water tank and per plant
+#define MAX_EVENTS ((MAX_WATER_SENSOR_COUNT) + (MAX_MOISTURE_SENSOR_COUNT))
+
 #ifdef USE_ETHERNET
 #include "power_ctrl.hpp"
 
@@ -12,22 +23,18 @@ void setupEthernet(const ShiftReg &shiftReg);
 bool powerUpEthernet(const ShiftReg &shiftReg);
 void powerDownEthernet(const ShiftReg &shiftReg);
 
-void sendStatus(const Status &status);
-void sendWarning(uint8_t waterSensIdx);
-
-// Forward declaration
-class Settings;
-void updateSettings(Settings &settings);
+// Reports are staged and transmitted at once by sendReports()
+void stageStatus(const CycleStatus &status);
+void stageEvents(const Event *events, uint8_t count);
+void sendReports();
 
-void sendErrorWaterEmpty(uint8_t waterSensIdx);
-void sendErrorHardware(uint8_t moistSensIdx);
+void updateSettings(Settings &settings, WakeSchedule &schedule);
 #else
 #define setupEthernet(...)
 #define powerUpEthernet(...) return false
 #define powerDownEthernet(...)
-#define sendStatus(...)
-#define sendWarning(...)
+#define stageStatus(...)
+#define stageEvents(...)
+#define sendReports(...)
 #define updateSettings(...)
-#define sendErrorWaterEmpty(...)
-#define sendErrorHardware(...)
 #endif
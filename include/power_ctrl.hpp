@@ -2,16 +2,23 @@
 
 #include <Arduino.h>
 
-struct ShiftReg {
-  ShiftReg() {
+#include "config.hpp"
+
+template <class Board>
+struct ShiftRegT {
+  typedef typename Board::Word Word;
+
+  ShiftRegT() {
     init();
     update(0);
   }
 
   void enableOutput() const;
   void disableOutput() const;
-  void update(uint16_t newVal) const;
+  void update(Word newVal) const;
 
 private:
   void init() const;
 };
+
+typedef ShiftRegT<HW> ShiftReg;
@@ -2,6 +2,7 @@
 
 #include <Arduino.h>
 
+#include "config.hpp"
 #include "settings_defs.hpp"
 
 void defaultInitSettings(Settings &settings);
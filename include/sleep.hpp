@@ -2,4 +2,7 @@
 
 #include <Arduino.h>
 
-void sleepSec(uint16_t duration_in_sec);
+void sleepSec(uint32_t duration_in_sec);
+// Sleeps until the next tick of the watchdog timer started with
+// WATCHDOG_TICK_PRESCALE_MASK, returns immediately if a tick is pending
+void sleepWatchdogTick();
@@ -59,5 +59,26 @@
 #error "The watchdog prescale is too small to use for an long sleep!"
 #endif
 
-void startWatchDogTimer();
+// Sub-second time-out interval to time the pump bursts, see PUMP_TICK_MS
+#if PUMP_TICK_MS == 16
+#define WATCHDOG_TICK_PRESCALE_MASK 0
+#elif PUMP_TICK_MS == 32
+#define WATCHDOG_TICK_PRESCALE_MASK _BV(WDP0)
+#elif PUMP_TICK_MS == 64
+#define WATCHDOG_TICK_PRESCALE_MASK _BV(WDP1)
+#elif PUMP_TICK_MS == 125
+#define WATCHDOG_TICK_PRESCALE_MASK _BV(WDP0) | _BV(WDP1)
+#elif PUMP_TICK_MS == 250
+#define WATCHDOG_TICK_PRESCALE_MASK _BV(WDP2)
+#elif PUMP_TICK_MS == 500
+#define WATCHDOG_TICK_PRESCALE_MASK _BV(WDP2) | _BV(WDP0)
+#else
+#error "Invalid pump tick, has to be a sub-second watchdog time-out interval!"
+#endif
+
+// Number of watchdog interrupts that were not consumed yet, reset by
+// startWatchDogTimer()
+extern volatile uint8_t pendingWatchdogTicks;
+
+void startWatchDogTimer(uint8_t prescaleMask = WATCHDOG_PRESCALE_MASK);
 void stopWatchDogTimer();
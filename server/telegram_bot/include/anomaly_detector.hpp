@@ -0,0 +1,76 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "lan_protocol.hpp"
+#include "online_stats.hpp"
+
+struct AnomalyConfig {
+  // weight of a new reading in the exponentially weighted mean & variance
+  double alpha = 0.2;
+  // readings needed before step changes are reported
+  uint32_t warmupReadings = 5;
+  // a reading further than this many standard deviations from the mean is a
+  // step change
+  double stepSigma = 4.0;
+  // lower bound of the standard deviation, ADC noise is about +-2
+  double minStdDev = 8.0;
+  // readings in a row within stuckTolerance of the first one before a sensor
+  // counts as stuck, a day has 4 readings with the default sleep period. The
+  // soil of a healthy sensor dries out in between.
+  uint8_t stuckReadings = 24;
+  uint16_t stuckTolerance = 1;
+  // raw readings at the ADC rails indicate a disconnected or shorted sensor
+  uint16_t rawLowerRail = 5;
+  uint16_t rawUpperRail = 1018;
+  // cycles in a row where a dry plant with water left did not get any wetter
+  uint8_t noGainCycles = 2;
+};
+
+struct Anomaly {
+  enum Kind { OUT_OF_RANGE, STUCK_VALUE, STEP_CHANGE, NO_MOISTURE_GAIN };
+
+  Kind kind;
+  // false for water level sensors
+  bool isPlant;
+  uint8_t idx;
+  uint16_t raw;
+  // plants with this anomaly should no longer be irrigated
+  bool isFailure;
+
+  std::string describe() const;
+};
+
+// Incrementally checks the readings of every status report for failing
+// sensors & pumps, separately for every controller
+class AnomalyDetector {
+public:
+  explicit AnomalyDetector(const AnomalyConfig &conf = AnomalyConfig())
+      : conf(conf) {}
+
+  std::vector<Anomaly> analyze(uint32_t deviceId, const Status &status,
+                               const Settings *settings);
+
+private:
+  struct SensorState {
+    OnlineStats stats;
+    // first reading of the current run of similar readings
+    uint16_t runRaw = UNDEFINED_LEVEL_16;
+    uint8_t sameReadings = 0;
+  };
+  struct Device {
+    std::array<SensorState, MAX_MOISTURE_SENSOR_COUNT> plants;
+    std::array<SensorState, MAX_WATER_SENSOR_COUNT> tanks;
+    std::array<uint8_t, MAX_MOISTURE_SENSOR_COUNT> noGainCycles{};
+  };
+
+  void checkSensor(SensorState &sensor, bool isPlant, uint8_t idx,
+                   uint16_t raw, std::vector<Anomaly> &anomalies);
+
+  AnomalyConfig conf;
+  std::map<uint32_t, Device> devices;
+};
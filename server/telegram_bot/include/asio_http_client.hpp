@@ -0,0 +1,46 @@
+#pragma once
+
+// Boost 1.74 uses std::exchange in its coroutine support without <utility>
+#include <utility>
+
+#include <boost/asio.hpp>
+#include <boost/asio/ssl.hpp>
+#include <memory>
+#include <string>
+#include <tgbot/tgbot.h> // https://github.com/reo7sp/tgbot-cpp
+#include <vector>
+
+// HTTP(S) client for tgbot-cpp that performs all network I/O as coroutines on
+// the shared io_context and keeps the connections alive between requests.
+//
+// The tgbot-cpp API is synchronous: makeRequest hands the request over to the
+// io_context and blocks the calling thread until the response arrived. It
+// must therefore never be called from a thread running the io_context.
+class AsioHttpClient : public TgBot::HttpClient {
+public:
+  explicit AsioHttpClient(boost::asio::io_context &io);
+  ~AsioHttpClient();
+
+  std::string
+  makeRequest(const TgBot::Url &url,
+              const std::vector<TgBot::HttpReqArg> &args) const override;
+
+private:
+  struct Connection;
+
+  boost::asio::awaitable<std::string> request(bool useTls, std::string host,
+                                              std::string port,
+                                              std::string payload) const;
+  boost::asio::awaitable<std::shared_ptr<Connection>>
+  connect(bool useTls, const std::string &host, const std::string &port) const;
+  // Returns false if the server closes the connection after this response
+  boost::asio::awaitable<bool> readResponse(Connection &conn,
+                                            std::string &body) const;
+
+  boost::asio::io_context &io;
+  mutable boost::asio::ssl::context sslContext;
+  TgBot::HttpParser httpParser;
+
+  // Only accessed from the io_context
+  mutable std::vector<std::shared_ptr<Connection>> idleConnections;
+};
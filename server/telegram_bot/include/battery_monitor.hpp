@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cstdint>
+#include <ctime>
+#include <deque>
+#include <map>
+#include <string>
+
+struct BatteryConfig {
+  // supply voltage at which the battery has to be replaced, the controller
+  // browns out not much below
+  uint16_t emptyMilliVolt = 3200;
+  // the trend is fitted to the readings of this window
+  uint32_t trendWindowSec = 14 * 24 * 60 * 60;
+  // readings and the time they have to span before the empty time is
+  // predicted, a few readings of a single day are dominated by the noise and
+  // the temperature
+  uint32_t minReadings = 4;
+  uint32_t minTrendSec = 2 * 24 * 60 * 60;
+  // warn once the battery is predicted to be empty within this time
+  uint32_t warnAheadSec = 7 * 24 * 60 * 60;
+  // a voltage rising by this much was a battery replacement, the trend starts
+  // over
+  uint16_t replacedRiseMilliVolt = 300;
+};
+
+struct BatteryForecast {
+  uint16_t milliVolt;
+  // slope of the trend, negative while discharging
+  double milliVoltPerDay;
+  // predicted time of reaching BatteryConfig::emptyMilliVolt, 0 if the
+  // battery is not discharging or there are not enough readings yet
+  std::time_t emptyAt;
+
+  std::string describe(std::time_t now) const;
+};
+
+// Trends the supply voltage of every controller by a least squares fit over
+// a sliding window and predicts when its battery needs replacing
+class BatteryMonitor {
+public:
+  explicit BatteryMonitor(const BatteryConfig &conf = BatteryConfig())
+      : conf(conf) {}
+
+  // Adds the supply voltage of a status report, 0 for controllers that do not
+  // measure it is ignored. Returns true once per battery when its empty time
+  // comes within BatteryConfig::warnAheadSec.
+  bool record(uint32_t deviceId, uint16_t milliVolt, std::time_t now,
+              BatteryForecast &forecast);
+
+  // Apply a changed config, the readings are kept
+  void reconfigure(const BatteryConfig &conf) { this->conf = conf; }
+
+private:
+  struct Reading {
+    std::time_t time;
+    uint16_t milliVolt;
+  };
+  struct Device {
+    std::deque<Reading> readings;
+    bool warned = false;
+  };
+
+  void predict(const Device &device, std::time_t now,
+               BatteryForecast &forecast) const;
+
+  BatteryConfig conf;
+  std::map<uint32_t, Device> devices;
+};
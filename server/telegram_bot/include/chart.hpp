@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstdint>
+#include <list>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+struct ChartPoint {
+  // unix time
+  uint32_t time;
+  // percentage
+  uint8_t value;
+};
+
+struct ChartSeries {
+  std::string label;
+  std::vector<ChartPoint> points;
+};
+
+// Line chart of percentages over [from, to] as PNG, at most 4 series.
+// targetLine draws a dashed horizontal line at this percentage, use a value
+// above 100 to omit it.
+std::string renderLineChart(const std::string &title, uint32_t from,
+                            uint32_t to, const std::vector<ChartSeries> &series,
+                            uint8_t targetLine = 0xFF);
+
+// One labeled sparkline per series as PNG, for an overview of all sensors
+std::string renderSparklines(uint32_t from, uint32_t to,
+                             const std::vector<ChartSeries> &series);
+
+// Rendered charts by key, the least recently used ones are evicted first.
+// Besides the PNG the file id telegram assigned to the uploaded image is kept
+// so that repeated requests do not even need an upload.
+class ChartCache {
+public:
+  struct Entry {
+    std::string png;
+    std::string fileId;
+  };
+
+  explicit ChartCache(size_t capacity = 32) : capacity(capacity) {}
+
+  // Returns nullptr if the key is not cached
+  Entry *find(const std::string &key);
+  Entry &insert(const std::string &key, std::string &&png);
+
+private:
+  typedef std::list<std::pair<std::string, Entry>> List;
+
+  size_t capacity;
+  List entries;
+  std::unordered_map<std::string, List::iterator> index;
+};
@@ -0,0 +1,41 @@
+#pragma once
+
+// Boost 1.74 uses std::exchange in its coroutine support without <utility>
+#include <utility>
+
+#include <boost/asio.hpp>
+#include <functional>
+#include <string>
+
+#include "message_queue.hpp"
+#include "types.hpp"
+
+// Reloads the YAML config whenever the file changes and publishes the
+// runtime part of it in state.config. Invalid configs are reported to the
+// chats and ignored, the previous config stays active.
+class ConfigWatcher {
+public:
+  // onReload is called on the io_context after a new config was published
+  ConfigWatcher(boost::asio::io_context &io, const std::string &path,
+                StateWrapper &state, MessageQueue &msgQueue,
+                std::function<void()> &&onReload);
+
+  ConfigWatcher(const ConfigWatcher &) = delete;
+  ConfigWatcher &operator=(const ConfigWatcher &) = delete;
+
+  void start();
+  void stop();
+
+private:
+  boost::asio::awaitable<void> watch();
+  bool reload();
+
+  const std::string path;
+  StateWrapper &state;
+  MessageQueue &msgQueue;
+  const std::function<void()> onReload;
+  // changes of these require a restart
+  std::string token;
+  std::string apiUrl;
+  boost::asio::posix::stream_descriptor inotify;
+};
@@ -1,10 +1,35 @@
 #pragma once
 
-#include <atomic>
+// Boost 1.74 uses std::exchange in its coroutine support without <utility>
+#include <utility>
 
-#include "ts_queue.hpp"
+#include <boost/asio.hpp>
+#include <cstdint>
+#include <memory>
+
+#include "message_queue.hpp"
 #include "types.hpp"
 
-void runDryNoMoreStatusServer(int fd, StateWrapper &state,
-                              ts_queue<Message> &msgQueue,
-                              const std::atomic<bool> &running);
+// Serves the controllers as coroutines on the given io_context, all members
+// have to be called from the thread running it.
+class DryNoMoreStatusServer {
+public:
+  DryNoMoreStatusServer(boost::asio::io_context &io, StateWrapper &state,
+                        MessageQueue &msgQueue);
+  ~DryNoMoreStatusServer();
+
+  DryNoMoreStatusServer(const DryNoMoreStatusServer &) = delete;
+  DryNoMoreStatusServer &operator=(const DryNoMoreStatusServer &) = delete;
+
+  // Listens on the tcp port of state.config, returns false on failure
+  bool start();
+  // Applies a changed state.config. A new tcp port is bound before the old
+  // listener is closed.
+  void reconfigure();
+  // Stops accepting controllers, open connections are finished
+  void stop();
+
+private:
+  struct Impl;
+  std::unique_ptr<Impl> impl;
+};
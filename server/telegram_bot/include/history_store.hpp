@@ -0,0 +1,99 @@
+#pragma once
+
+#include <cstdint>
+#include <fstream>
+#include <map>
+#include <shared_mutex>
+#include <string>
+#include <vector>
+
+#include "lan_protocol.hpp"
+
+// Measurements of a single plant or water tank, also the on disk format
+PACKED_STRUCT_DEF(HistoryRecord,
+                  // unix time of the server when the status was received
+                  uint32_t time;
+                  // see HistoryStore::plantChannel and tankChannel
+                  uint8_t channel; uint8_t before; uint8_t after;
+                  uint16_t beforeRaw; uint16_t afterRaw;
+                  // UNDEFINED_LEVEL_8 for tanks and legacy status reports
+                  uint8_t bursts;);
+
+// Time indexed measurement history of all plants and tanks. The records of
+// each channel are kept sorted by time so that range queries are two binary
+// searches. If a file is opened all records are appended to it and read back
+// on the next start. Records older than the max age are dropped, the file is
+// rewritten without them on load and once they make up half of it.
+//
+// Thread-safe: the status server records while the telegram bot queries.
+class HistoryStore {
+public:
+  static constexpr uint8_t TANK_CHANNEL = 0x80;
+
+  static uint8_t plantChannel(uint8_t idx) { return idx; }
+  static uint8_t tankChannel(uint8_t idx) { return TANK_CHANNEL | idx; }
+  static bool isTankChannel(uint8_t channel) {
+    return (channel & TANK_CHANNEL) != 0;
+  }
+  // "P1" for plant 0, "W1" for tank 0
+  static std::string channelName(uint8_t channel);
+  // Whether the plant was irrigated, legacy status reports lack the bursts so
+  // a rising moisture is taken as sign of an irrigation
+  static bool isWatering(const HistoryRecord &record);
+
+  static constexpr uint32_t DEFAULT_MAX_AGE_SEC = 2 * 365 * 24 * 60 * 60;
+
+  HistoryStore() = default;
+  HistoryStore(const HistoryStore &) = delete;
+  HistoryStore &operator=(const HistoryStore &) = delete;
+
+  // Records older than this are dropped, 0 keeps all of them. Applies to the
+  // records loaded by open() and recorded afterwards.
+  void setMaxAge(uint32_t maxAgeSec);
+
+  // Loads the records of the file and appends all new ones to it. Files of an
+  // incompatible format are moved aside to "<path>.old".
+  bool open(const std::string &path);
+
+  // Stores all plants and tanks measured in this status
+  void record(const Status &status, uint32_t time);
+
+  // All records of the channel with from <= time <= to, oldest first
+  std::vector<HistoryRecord> range(uint8_t channel, uint32_t from,
+                                   uint32_t to) const;
+  // Only the records of irrigations, from <= time <= to, oldest first
+  std::vector<HistoryRecord> waterings(uint8_t channel, uint32_t from,
+                                       uint32_t to) const;
+  // Latest record & irrigation of the channel, false if there is none
+  bool last(uint8_t channel, HistoryRecord &record) const;
+  bool lastWatering(uint8_t channel, HistoryRecord &record) const;
+  // Time of the latest record of the channel, 0 if there is none
+  uint32_t lastTime(uint8_t channel) const;
+  // Channels having at least one record, plants first
+  std::vector<uint8_t> channels() const;
+
+private:
+  struct Channel {
+    std::vector<HistoryRecord> records;
+    // Secondary index, the irrigations are rare compared to all records
+    std::vector<HistoryRecord> waterings;
+  };
+
+  void insert(const HistoryRecord &record);
+  // Drops the records older than the max age relative to now
+  void expire(uint32_t now);
+  // Rewrites the file with the records in memory
+  void compact();
+  static std::vector<HistoryRecord>
+  slice(const std::vector<HistoryRecord> &records, uint32_t from, uint32_t to);
+
+  mutable std::shared_mutex mutex;
+  std::map<uint8_t, Channel> channelRecords;
+  uint32_t maxAgeSec = DEFAULT_MAX_AGE_SEC;
+  size_t recordCount = 0;
+
+  std::string path;
+  std::ofstream file;
+  // records in the file, including the expired ones
+  size_t fileRecords = 0;
+};
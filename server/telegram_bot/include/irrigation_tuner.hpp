@@ -0,0 +1,80 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <ctime>
+
+#include "lan_protocol.hpp"
+#include "online_stats.hpp"
+
+struct IrrigationTuningConfig {
+  enum Mode { OFF, PROPOSE, AUTO };
+
+  // OFF: only learn, PROPOSE: send proposals to the chats, AUTO: publish the
+  // tuned settings right away
+  Mode mode = PROPOSE;
+  // moisture gain in % a single burst should add, smaller bursts overshoot
+  // the target less
+  double gainPerBurst = 5.0;
+  // upper bound of the proposed ticksBetweenIrrigation
+  uint8_t maxTicksBetweenIrrigation = 12;
+  // observations of a plant needed before it is tuned
+  uint32_t minSamples = 3;
+  // weight of a new observation
+  double alpha = 0.3;
+};
+
+// Learns the drying rate and the moisture gain per burst of every plant from
+// the status reports and derives the irrigation settings that keep the plant
+// on target with the least pumping & measuring.
+class IrrigationTuner {
+public:
+  IrrigationTuner(const IrrigationTuningConfig &conf, uint32_t wakePeriodSec)
+      : conf(conf), wakePeriodSec(wakePeriodSec) {}
+
+  // Learns from the report of a cycle. Returns true if the tuned settings
+  // differ from the current ones and were not returned before, proposal is
+  // a copy of settings with the tuned values applied.
+  bool learn(const Status &status, const Settings &settings, std::time_t now,
+             Settings &proposal);
+  // Applies the learned models to the given settings, i.e. to the latest
+  // ones when publishing a proposal derived from an older version. Returns
+  // true if any tuned value changed.
+  bool retune(Settings &settings) const;
+
+  const IrrigationTuningConfig &config() const { return conf; }
+  // Apply a changed config, the learned models are kept
+  void reconfigure(const IrrigationTuningConfig &conf, uint32_t wakePeriodSec) {
+    this->conf = conf;
+    this->wakePeriodSec = wakePeriodSec;
+  }
+
+private:
+  struct PlantModel {
+    // moisture loss in % per hour
+    OnlineStats drying;
+    // moisture gain in % per burst
+    OnlineStats gain;
+    // moisture in % right after the irrigation
+    OnlineStats afterIrrigation;
+    // moisture rise in % after the irrigation ended, the water still seeped
+    // into the soil when the plant was measured the last time
+    OnlineStats seepage;
+
+    uint8_t lastAfter = UNDEFINED_LEVEL_8;
+    uint8_t lastBursts = 0;
+    std::time_t lastTime = 0;
+  };
+
+  void observe(PlantModel &model, const Status &status, uint8_t idx,
+               std::time_t now);
+  bool tune(const PlantModel &model, const Settings &settings, uint8_t idx,
+            Settings &proposal) const;
+
+  IrrigationTuningConfig conf;
+  uint32_t wakePeriodSec;
+  std::array<PlantModel, MAX_MOISTURE_SENSOR_COUNT> plants;
+  // last proposal, to not repeat it every cycle
+  bool hasProposal = false;
+  Settings lastProposal;
+};
@@ -1,21 +1,39 @@
 #pragma once
 
+#include <string.h>
+
 #include "packed.hpp"
 #include "settings_defs.hpp"
 
 #define UNDEFINED_LEVEL_16 0xFFFF
 #define UNDEFINED_LEVEL_8 0xFF
 
-PACKED_STRUCT_DEF(Status,
-                  uint8_t ticksSinceIrrigation[MAX_MOISTURE_SENSOR_COUNT];
-                  uint8_t beforeMoistureLevels[MAX_MOISTURE_SENSOR_COUNT];
-                  uint8_t afterMoistureLevels[MAX_MOISTURE_SENSOR_COUNT];
-                  uint8_t beforeWaterLevels[2]; uint8_t afterWaterLevels[2];
-                  uint16_t beforeMoistureLevelsRaw[MAX_MOISTURE_SENSOR_COUNT];
-                  uint16_t afterMoistureLevelsRaw[MAX_MOISTURE_SENSOR_COUNT];
-                  uint16_t beforeWaterLevelsRaw[2];
-                  uint16_t afterWaterLevelsRaw[2]; uint8_t numPlants;
-                  uint8_t numWaterSensors;);
+template <uint8_t PlantCount, uint8_t TankCount>
+PACKED_STRUCT_DEF(StatusLayout, uint8_t ticksSinceIrrigation[PlantCount];
+                  uint8_t beforeMoistureLevels[PlantCount];
+                  uint8_t afterMoistureLevels[PlantCount];
+                  uint8_t beforeWaterLevels[TankCount];
+                  uint8_t afterWaterLevels[TankCount];
+                  uint16_t beforeMoistureLevelsRaw[PlantCount];
+                  uint16_t afterMoistureLevelsRaw[PlantCount];
+                  uint16_t beforeWaterLevelsRaw[TankCount];
+                  uint16_t afterWaterLevelsRaw[TankCount]; uint8_t numPlants;
+                  uint8_t numWaterSensors;
+                  // not part of legacy REPORT_STATUS packets
+                  // unix time of the server at the cycle start, 0 if unknown
+                  uint32_t cycleStartTime; uint8_t bursts[PlantCount];
+                  // 0 if the controller did not measure it
+                  uint16_t supplyMilliVolt;);
+
+typedef StatusLayout<MAX_MOISTURE_SENSOR_COUNT, MAX_WATER_SENSOR_COUNT> Status;
+
+// Appended by the server to every settings response.
+// serverTime: unix time of the server when answering the request
+// nextWakeSec: seconds until the controller should wake up again, 0 if the
+//              server has no wake schedule
+// periodSec: seconds between the following wake ups of the schedule
+PACKED_STRUCT_DEF(WakeSchedule, uint32_t serverTime; uint32_t nextWakeSec;
+                  uint32_t periodSec;);
 
 enum PacketType : uint8_t {
   INFO_MSG = 1,
@@ -23,5 +41,150 @@ enum PacketType : uint8_t {
   ERR_MSG = 4,
   FAILURE_MSG = 8,
   REPORT_STATUS = 16,
-  REQUEST_SETTINGS = 32
+  REQUEST_SETTINGS = 32,
+  // Compact protocol (v2), see below
+  REPORT_STATUS_V2 = 64,
+  EVENT_MSG = 128
+};
+
+// Packets may be sent back to back on one connection, the receiver splits them
+// by their sizes. *_MSG packets carry no size, they have to be the last packet
+// before closing the connection. REQUEST_SETTINGS is the last packet before
+// waiting for the reply.
+
+// Raw ADC readings of a sensor before and after the irrigation of a cycle
+PACKED_STRUCT_DEF(RawReading, uint16_t before; uint16_t after;);
+// bursts: number of pump bursts started for the plant
+PACKED_STRUCT_DEF(PlantReading, RawReading moisture; uint8_t bursts;);
+
+// REPORT_STATUS_V2 packet:
+//   StatusHeaderV2
+//   uint8_t ticksSinceIrrigation[numPlants]
+//   RawReading for every tank set in measuredTanks, ascending
+//   PlantReading for every plant set in measuredPlants, ascending
+// Percentages are derived by the server from the raw readings and sensConfs.
+template <uint8_t PlantCount, uint8_t TankCount>
+PACKED_STRUCT_DEF(StatusHeaderV2Layout, uint32_t cycleStartTime;
+                  uint8_t numPlants; uint8_t numWaterSensors;
+                  uint8_t measuredPlants[(PlantCount + 8 - 1) / 8];
+                  uint8_t measuredTanks[(TankCount + 8 - 1) / 8];
+                  // supply voltage of the controller at the cycle start
+                  uint16_t supplyMilliVolt;);
+
+typedef StatusHeaderV2Layout<MAX_MOISTURE_SENSOR_COUNT, MAX_WATER_SENSOR_COUNT>
+    StatusHeaderV2;
+
+// Upper bound of a REPORT_STATUS_V2 packet including the packet type
+#define MAX_STATUS_V2_SIZE                                                     \
+  (1 + sizeof(StatusHeaderV2) + (MAX_MOISTURE_SENSOR_COUNT) +                  \
+   (MAX_MOISTURE_SENSOR_COUNT) * sizeof(PlantReading) +                        \
+   (MAX_WATER_SENSOR_COUNT) * sizeof(RawReading))
+
+// EVENT_MSG packet: uint8_t count followed by count Events. Replaces the
+// English sentences of the *_MSG packets, the server renders the text.
+enum EventCode : uint8_t {
+  // arg: water sensor index
+  EVT_WATER_LOW = 1,
+  // arg: water sensor index
+  EVT_WATER_EMPTY = 2,
+  // arg: plant index, irrigation timed out while the soil stayed dry
+  EVT_IRRIGATION_TIMEOUT = 3
+};
+
+PACKED_STRUCT_DEF(Event, uint8_t code; uint8_t arg;);
+
+// UDP transport: every datagram starts with a UdpHeader followed by packets as
+// on the TCP stream. The controller retransmits a datagram with the same seq
+// until the server acknowledges it with a datagram of that seq. The ack of a
+// REQUEST_SETTINGS carries the SettingsReply, all others are empty. The
+// Settings requested by SETTINGS_UNKNOWN are sent with UDP_SETTINGS_UPLOAD.
+PACKED_STRUCT_DEF(UdpHeader, uint8_t seq; uint8_t flags;);
+#define UDP_SETTINGS_UPLOAD 0x01
+
+// CRC-16/CCITT as implemented by _crc_ccitt_update() of avr-libc
+inline uint16_t crcCcittUpdate(uint16_t crc, uint8_t data) {
+  data ^= static_cast<uint8_t>(crc & 0xFF);
+  data ^= static_cast<uint8_t>(data << 4);
+  return ((static_cast<uint16_t>(data) << 8) | (crc >> 8)) ^
+         static_cast<uint8_t>(data >> 4) ^ (static_cast<uint16_t>(data) << 3);
+}
+
+// Never produced by settingsHash(), requests the full settings from the server
+#define SETTINGS_HASH_UNKNOWN 0x0000
+
+// Identifies a settings version. Sent by the controller with every
+// REQUEST_SETTINGS so that the server only has to transmit what changed.
+inline uint16_t settingsHash(const Settings &settings) {
+  const uint8_t *data = reinterpret_cast<const uint8_t *>(&settings);
+  uint16_t crc = 0xFFFF;
+  for (uint16_t i = 0; i < sizeof(settings); ++i) {
+    crc = crcCcittUpdate(crc, data[i]);
+  }
+  return crc == SETTINGS_HASH_UNKNOWN ? 0x0001 : crc;
+}
+
+// Controller -> server: REQUEST_SETTINGS followed by SettingsRequest. A packet
+// type that nothing follows for a while is a request of an older controller,
+// it is answered with the plain Settings (or a single dummy byte if the server
+// has none) and its hardwareFailureBitmap is a single flag of the controller.
+PACKED_STRUCT_DEF(SettingsRequest, uint16_t settingsHash;);
+
+enum SettingsReplyType : uint8_t {
+  // the server has no settings, the controller has to send its own
+  SETTINGS_UNKNOWN = 0,
+  SETTINGS_UNCHANGED = 1,
+  // followed by the complete Settings
+  SETTINGS_FULL = 2,
+  // followed by SettingsDeltaRun entries, each followed by its bytes
+  SETTINGS_DELTA = 3
 };
+
+// Server -> controller: settingsHash is the hash of the settings the controller
+// has after applying the reply, payloadSize the number of bytes following the
+// reply. A TCP reply may arrive in several segments, the controller reads
+// until it got all of them.
+PACKED_STRUCT_DEF(SettingsReply, uint8_t type; uint16_t payloadSize;
+                  uint16_t settingsHash; WakeSchedule schedule;);
+
+template <bool Small>
+struct SettingsOffsetFor {
+  typedef uint8_t type;
+};
+template <>
+struct SettingsOffsetFor<false> {
+  typedef uint16_t type;
+};
+typedef SettingsOffsetFor<(sizeof(Settings) <= 0xFF)>::type SettingsOffset;
+
+// Replaces length bytes of the Settings starting at offset
+PACKED_STRUCT_DEF(SettingsDeltaRun, SettingsOffset offset; uint8_t length;);
+
+// Applies the delta runs onto a copy of the settings and only adopts the
+// result if it matches the hash announced by the server
+inline bool applySettingsDelta(Settings &settings, const uint8_t *delta,
+                               uint16_t deltaSize, uint16_t expectedHash) {
+  Settings updated;
+  memcpy(&updated, &settings, sizeof(updated));
+  uint8_t *dst = reinterpret_cast<uint8_t *>(&updated);
+
+  for (uint16_t pos = 0; pos < deltaSize;) {
+    SettingsDeltaRun run;
+    if (static_cast<uint16_t>(deltaSize - pos) < sizeof(run)) {
+      return false;
+    }
+    memcpy(&run, delta + pos, sizeof(run));
+    pos += sizeof(run);
+    if (run.length > deltaSize - pos ||
+        run.offset + run.length > sizeof(updated)) {
+      return false;
+    }
+    memcpy(dst + run.offset, delta + pos, run.length);
+    pos += run.length;
+  }
+
+  if (settingsHash(updated) != expectedHash) {
+    return false;
+  }
+  memcpy(&settings, &updated, sizeof(settings));
+  return true;
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <ctime>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <tuple>
+
+#include "types.hpp"
+
+// Queue between the message producers and the telegram bot.
+//
+// Identical messages of the same device are coalesced: within the coalesce
+// window only the first one is queued, the repeats are counted and attached to
+// the next delivered copy. The queue is bounded, when full the oldest message
+// of the lowest priority is dropped, FAILURE_MSG > ERR_MSG > WARN_MSG >
+// INFO_MSG. Messages are popped by priority as well.
+class MessageQueue {
+public:
+  static constexpr size_t DEFAULT_CAPACITY = 64;
+
+  explicit MessageQueue(uint32_t coalesceSec,
+                        size_t capacity = DEFAULT_CAPACITY);
+
+  MessageQueue(const MessageQueue &) = delete;
+  MessageQueue &operator=(const MessageQueue &) = delete;
+
+  void setCoalesceWindow(uint32_t coalesceSec);
+
+  void push(Message &&msg);
+  // Puts back a message that could not be delivered, without coalescing it
+  // again. Its notes are kept and new repeats are added to them.
+  void requeue(Message &&msg);
+
+  std::optional<Message> try_pop();
+  // Waits up to 500ms for a message
+  std::optional<Message> limited_wait_for_pop();
+
+  // Wakes up all waiting consumers right away, from now on waits only return
+  // the remaining messages
+  void interrupt();
+
+  bool empty() const;
+
+private:
+  // (deviceId, msgType, msg)
+  using Key = std::tuple<uint32_t, uint8_t, std::string>;
+
+  struct Recent {
+    // start of the current coalesce window
+    std::time_t windowStart;
+    // first of the repeats that were not yet delivered
+    std::time_t firstRepeat;
+    uint32_t repeats;
+    // a copy is waiting in the queue, repeats are attached to it
+    bool queued;
+  };
+
+  static size_t priority(Message::MessageType type);
+
+  void enqueue(Message &&msg, bool front);
+  std::optional<Message> pop();
+  void prune(std::time_t now);
+
+  const size_t capacity;
+  uint32_t coalesceSec;
+
+  mutable std::mutex mutex;
+  std::condition_variable dataCond;
+  bool interrupted = false;
+
+  // one FIFO per priority, index 0 has the lowest priority
+  std::deque<Message> queues[4];
+  size_t size = 0;
+  uint32_t dropped = 0;
+
+  std::map<Key, Recent> recent;
+};
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstdint>
+#include <limits>
+
+// Exponentially weighted mean & variance of a series, O(1) memory
+class OnlineStats {
+public:
+  void add(double x, double alpha) {
+    if (n == 0) {
+      m = x;
+      var = 0;
+    } else {
+      // incremental update of the exponentially weighted mean & variance
+      const double diff = x - m;
+      const double incr = alpha * diff;
+      m += incr;
+      var = (1 - alpha) * (var + diff * incr);
+    }
+    if (n != std::numeric_limits<uint32_t>::max()) {
+      ++n;
+    }
+  }
+
+  uint32_t count() const { return n; }
+  double mean() const { return m; }
+  double variance() const { return var; }
+
+private:
+  uint32_t n = 0;
+  double m = 0;
+  double var = 0;
+};
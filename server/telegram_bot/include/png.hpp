@@ -0,0 +1,17 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+struct Rgb {
+  uint8_t r, g, b;
+};
+
+// Minimal encoder for 8 bit palette PNGs. The image data is compressed with
+// fixed Huffman codes and run-length matches, which suits the large uniform
+// areas of charts well, no zlib needed.
+std::string encodePalettePng(uint32_t width, uint32_t height,
+                             const std::vector<uint8_t> &pixels,
+                             const std::vector<Rgb> &palette);
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstdint>
+#include <set>
+#include <string>
+#include <yaml-cpp/yaml.h>
+
+#include "battery_monitor.hpp"
+#include "irrigation_tuner.hpp"
+
+struct WakeScheduleConfig {
+  // time between two wake ups of a controller
+  uint32_t periodSec = 6 * 60 * 60;
+  // wake ups are aligned to this offset after local midnight
+  uint32_t anchorSec = 0;
+  // controllers are spread deterministically over this window after the
+  // anchor, 0 aligns all controllers to the same wake time
+  uint32_t spreadSec = 0;
+};
+
+// Everything of the YAML config that can be changed while running, see
+// ConfigWatcher. The bot token requires a restart.
+struct RuntimeConfig {
+  uint16_t tcpPort = 42424;
+  std::set<std::int64_t> userWhitelist;
+  std::set<std::int64_t> userChats;
+  WakeScheduleConfig wakeSchedule;
+  IrrigationTuningConfig tuning;
+  BatteryConfig battery;
+  // identical messages of a controller are sent at most once per window
+  uint32_t alertCoalesceSec = 12 * 60 * 60;
+  // record trace events, written to traceFile on SIGUSR1
+  bool trace = false;
+  std::string traceFile = "drynomore_trace.bin";
+};
+
+// Parses and validates the runtime part of the config. Returns false and a
+// description of the first problem in error if the config is invalid.
+bool parseRuntimeConfig(const YAML::Node &config, RuntimeConfig &runtime,
+                        std::string &error);
@@ -1,22 +1,109 @@
 #pragma once
 
+#include <stdint.h>
+
 #include "packed.hpp"
 
+// The firmware derives these from its board description (see board.hpp), the
+// server has to be built with the same values as the controllers it talks to.
+#ifndef MAX_MOISTURE_SENSOR_COUNT
 #define MAX_MOISTURE_SENSOR_COUNT 6
+#endif
+#ifndef MAX_WATER_SENSOR_COUNT
+#define MAX_WATER_SENSOR_COUNT 2
+#endif
+
+// 0x0012: hardwareFailureBitmap replaced the flag of the whole controller
+#define SETTINGS_VERSION_NUM 0x0012
 
-#define SETTINGS_VERSION_NUM 0x0011
+// Number of bits needed to store the water sensor index of a plant
+constexpr uint8_t waterSensIdxBits(uint8_t tankCount) {
+  return tankCount <= 2 ? 1 : 1 + waterSensIdxBits((tankCount + 1) / 2);
+}
 
 PACKED_STRUCT_DEF(SensConfig, uint16_t minValue; uint16_t maxValue;);
+
+// Percentage of a raw ADC reading within the calibrated range. Inverted as an
+// increase in moisture/water level results in a lower ADC value. Shared so that
+// the server expands raw readings exactly like the controller interprets them.
+inline uint8_t rawToPercentage(uint16_t raw, uint16_t min, uint16_t max) {
+  if (max <= min) {
+    return raw > min ? 0 : 100;
+  }
+  if (raw < min) {
+    raw = min;
+  } else if (raw > max) {
+    raw = max;
+  }
+  return 100 - static_cast<uint8_t>(static_cast<uint32_t>(raw - min) * 100 /
+                                    (max - min));
+}
+
 PACKED_STRUCT_DEF(WaterLvlThresholds, uint8_t warnThres; uint8_t emptyThres;);
 
+template <uint8_t PlantCount, uint8_t TankCount>
 PACKED_STRUCT_DEF(
-    Settings, SensConfig sensConfs[(MAX_MOISTURE_SENSOR_COUNT) + 2];
-    WaterLvlThresholds waterLvlThres[2];
-    uint8_t targetMoisture[MAX_MOISTURE_SENSOR_COUNT];
-    uint8_t burstDuration[MAX_MOISTURE_SENSOR_COUNT];
-    uint8_t burstDelay[MAX_MOISTURE_SENSOR_COUNT];
-    uint8_t maxBursts[MAX_MOISTURE_SENSOR_COUNT];
-    uint8_t ticksBetweenIrrigation[MAX_MOISTURE_SENSOR_COUNT]; uint8_t
-        moistSensToWaterSensBitmap[((MAX_MOISTURE_SENSOR_COUNT) + 8 - 1) / 8];
-    uint8_t skipBitmap[((MAX_MOISTURE_SENSOR_COUNT) + 8 - 1) / 8];
-    uint8_t numPlants; bool hardwareFailure; bool debug;);
+    SettingsLayout, SensConfig sensConfs[PlantCount + TankCount];
+    WaterLvlThresholds waterLvlThres[TankCount];
+    uint8_t targetMoisture[PlantCount]; uint8_t burstDuration[PlantCount];
+    uint8_t burstDelay[PlantCount]; uint8_t maxBursts[PlantCount];
+    uint8_t ticksBetweenIrrigation[PlantCount];
+    uint8_t moistSensToWaterSensBitmap
+        [(PlantCount * waterSensIdxBits(TankCount) + 8 - 1) / 8];
+    uint8_t skipBitmap[(PlantCount + 8 - 1) / 8]; uint8_t numPlants;
+    uint8_t hardwareFailureBitmap[(PlantCount + 8 - 1) / 8]; bool debug;);
+
+typedef SettingsLayout<MAX_MOISTURE_SENSOR_COUNT, MAX_WATER_SENSOR_COUNT>
+    Settings;
+
+template <uint8_t PlantCount, uint8_t TankCount>
+inline uint8_t
+getWaterSensIdx(const SettingsLayout<PlantCount, TankCount> &settings,
+                uint8_t plantIdx) {
+  constexpr uint8_t bits = waterSensIdxBits(TankCount);
+  uint8_t waterSensIdx = 0;
+  for (uint8_t b = 0; b < bits; ++b) {
+    const uint16_t bit = static_cast<uint16_t>(plantIdx) * bits + b;
+    waterSensIdx |= ((settings.moistSensToWaterSensBitmap[bit / 8] >>
+                      (bit & 7 /*aka mod 8*/)) &
+                     0x01)
+                    << b;
+  }
+  return waterSensIdx;
+}
+
+template <uint8_t PlantCount, uint8_t TankCount>
+inline void setWaterSensIdx(SettingsLayout<PlantCount, TankCount> &settings,
+                            uint8_t plantIdx, uint8_t waterSensIdx) {
+  constexpr uint8_t bits = waterSensIdxBits(TankCount);
+  for (uint8_t b = 0; b < bits; ++b) {
+    const uint16_t bit = static_cast<uint16_t>(plantIdx) * bits + b;
+    const uint8_t mask = static_cast<uint8_t>(1) << (bit & 7 /*aka mod 8*/);
+    if ((waterSensIdx >> b) & 0x01) {
+      settings.moistSensToWaterSensBitmap[bit / 8] |= mask;
+    } else {
+      settings.moistSensToWaterSensBitmap[bit / 8] &= ~mask;
+    }
+  }
+}
+
+// A hardware failure only stops the irrigation of the affected plant
+template <uint8_t PlantCount, uint8_t TankCount>
+inline bool
+hasHardwareFailure(const SettingsLayout<PlantCount, TankCount> &settings,
+                   uint8_t plantIdx) {
+  return ((settings.hardwareFailureBitmap[plantIdx / 8] >>
+           (plantIdx & 7 /*aka mod 8*/)) &
+          0x01) != 0;
+}
+
+template <uint8_t PlantCount, uint8_t TankCount>
+inline void setHardwareFailure(SettingsLayout<PlantCount, TankCount> &settings,
+                               uint8_t plantIdx, bool failure) {
+  const uint8_t mask = static_cast<uint8_t>(1) << (plantIdx & 7 /*aka mod 8*/);
+  if (failure) {
+    settings.hardwareFailureBitmap[plantIdx / 8] |= mask;
+  } else {
+    settings.hardwareFailureBitmap[plantIdx / 8] &= ~mask;
+  }
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "lan_protocol.hpp"
+
+// Encodes the changed bytes as SettingsDeltaRun entries, the controller applies
+// them with applySettingsDelta()
+void encodeSettingsDelta(const Settings &from, const Settings &to,
+                         std::vector<uint8_t> &delta);
+
+// Settings recently sent to or received from the controllers, keyed by their
+// hash. Used as base for the deltas sent in reply to REQUEST_SETTINGS.
+class SettingsHistory {
+public:
+  const Settings *find(uint16_t hash) const {
+    for (const auto &entry : entries) {
+      if (entry.hash == hash) {
+        return &entry.settings;
+      }
+    }
+    return nullptr;
+  }
+
+  void remember(uint16_t hash, const Settings &settings) {
+    if (find(hash)) {
+      return;
+    }
+    if (entries.size() < MAX_ENTRIES) {
+      entries.push_back({hash, settings});
+    } else {
+      entries[next] = {hash, settings};
+    }
+    next = (next + 1) % MAX_ENTRIES;
+  }
+
+private:
+  static constexpr size_t MAX_ENTRIES = 8;
+
+  struct Entry {
+    uint16_t hash;
+    Settings settings;
+  };
+  std::vector<Entry> entries;
+  size_t next = 0;
+};
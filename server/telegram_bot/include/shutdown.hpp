@@ -0,0 +1,28 @@
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+// Cancellation of the blocking waits of the bot threads. Waits register a
+// callback to be interrupted, e.g. to wake up a condition variable.
+class Shutdown {
+public:
+  Shutdown() : flag(false) {}
+
+  Shutdown(const Shutdown &) = delete;
+  Shutdown &operator=(const Shutdown &) = delete;
+
+  void request();
+  bool requested() const { return flag.load(std::memory_order_acquire); }
+
+  // Called once on request, or right away if it was already requested
+  void onRequest(std::function<void()> &&callback) const;
+
+private:
+  std::atomic<bool> flag;
+
+  mutable std::mutex callbackMutex;
+  mutable std::vector<std::function<void()>> callbacks;
+};
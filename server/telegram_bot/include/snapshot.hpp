@@ -0,0 +1,74 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+
+// Versioned, immutable snapshots of a shared value (RCU-style pointer swap).
+//
+// Readers obtain a reference counted pointer to the current version and can
+// use it as long as they like without holding a mutex, writers build a new
+// version off to the side and publish it with an atomic pointer swap.
+// Superseded versions are freed once their last reader drops them.
+//
+// This is not lock-free: libstdc++ guards std::atomic<std::shared_ptr> with an
+// internal spin lock. It is only held to copy or swap the pointer, hence
+// readers & writers never block each other for long.
+template <class T>
+class Snapshot {
+public:
+  struct Version {
+    Version(uint64_t version, const T &value)
+        : version(version), value(value) {}
+
+    const uint64_t version;
+    const T value;
+  };
+  using Ptr = std::shared_ptr<const Version>;
+
+  Snapshot() = default;
+  Snapshot(const Snapshot &) = delete;
+  Snapshot &operator=(const Snapshot &) = delete;
+
+  // Returns the current version or nullptr if nothing was published yet
+  Ptr load() const { return current.load(std::memory_order_acquire); }
+
+  // Unconditionally replace the current version
+  Ptr publish(const T &value) {
+    Ptr old = load();
+    Ptr next;
+    do {
+      next = std::make_shared<const Version>(old ? old->version + 1 : 1,
+                                             value);
+    } while (!current.compare_exchange_weak(old, next,
+                                            std::memory_order_acq_rel,
+                                            std::memory_order_acquire));
+    return next;
+  }
+
+  // Derive a new version from the current one, modify is called with a copy
+  // of the current value and may be invoked multiple times if concurrent
+  // writers interfere. Returns false without publishing if there is no
+  // current version or modify returns false.
+  template <class Modifier>
+  bool update(Modifier &&modify) {
+    Ptr old = load();
+    Ptr next;
+    do {
+      if (!old) {
+        return false;
+      }
+      T value = old->value;
+      if (!modify(value)) {
+        return false;
+      }
+      next = std::make_shared<const Version>(old->version + 1, value);
+    } while (!current.compare_exchange_weak(old, next,
+                                            std::memory_order_acq_rel,
+                                            std::memory_order_acquire));
+    return true;
+  }
+
+private:
+  std::atomic<Ptr> current;
+};
@@ -1,13 +1,24 @@
 #pragma once
 
-#include <atomic>
-#include <set>
+#include <functional>
+#include <string>
 
-#include "ts_queue.hpp"
+#include "shutdown.hpp"
+#include "message_queue.hpp"
 #include "types.hpp"
 
+namespace TgBot {
+  class HttpClient;
+} // namespace TgBot
+
+// The user whitelist is taken from state.config, reloaded user_chats are
+// merged with the chats that registered since the start.
+// All requests go through httpClient to the Bot API at apiUrl.
+// Once the shutdown is requested, the remaining messages are sent and drained
+// is called. Returning afterwards may take up to the long poll timeout.
 void runDryNoMoreTelegramBot(const std::string &token,
-                             const std::set<std::int64_t> &userWhitelist,
-                             std::set<std::int64_t> &broadcastChats,
-                             StateWrapper &state, ts_queue<Message> &msgQueue,
-                             const std::atomic<bool> &running);
+                             const std::string &apiUrl,
+                             const TgBot::HttpClient &httpClient,
+                             StateWrapper &state, MessageQueue &msgQueue,
+                             const Shutdown &shutdown,
+                             const std::function<void()> &drained);
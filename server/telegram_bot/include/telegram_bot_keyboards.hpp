@@ -8,7 +8,8 @@
 #include <string>
 #include <vector>
 
-struct Settings;
+#include "settings_defs.hpp"
+
 struct Button;
 
 struct Keyboard {
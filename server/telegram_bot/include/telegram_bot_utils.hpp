@@ -1,10 +1,11 @@
 #pragma once
 
+#include <cstdint>
 #include <string>
 #include <vector>
 
-class Settings;
-class Status;
+#include "history_store.hpp"
+#include "lan_protocol.hpp"
 
 std::string generateTable(
     const std::vector<std::vector<std::string>> &table,
@@ -14,5 +15,18 @@ std::string generateTable(
 std::string generateWaterSettingsTable(const Settings &settings);
 std::string generateMoistSettingsTable(const Settings &settings);
 std::string generateSettingsTable(const Settings &settings);
+std::string generateTuningTable(const Settings &current,
+                                const Settings &proposal);
 
 std::string generateStatusTable(const Status &status);
+// Table of history records, at most maxRows of the newest ones are listed.
+// withChannel adds the plant or tank name, withWatering the moisture rise &
+// the number of bursts.
+std::string generateHistoryTable(const std::vector<HistoryRecord> &records,
+                                 bool withChannel, bool withWatering,
+                                 size_t maxRows = 30);
+
+// Parses a plant ("P3") or tank ("W1") name into a HistoryStore channel
+bool parseChannel(const std::string &str, uint8_t &channel);
+// Parses a duration like "12h", "30d" or "2w" into seconds
+bool parseDuration(const std::string &str, uint32_t &seconds);
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+#include "packed.hpp"
+
+// "DNMT" followed by the format version
+#define TRACE_MAGIC 0x544D4E44
+#define TRACE_VERSION 1
+
+// A single trace event, also the on disk format
+PACKED_STRUCT_DEF(TraceRecord,
+                  // steady clock, see TraceFileHeader::realtimeOffsetNs
+                  uint64_t timeNs;
+                  // connection of the status server or notification number
+                  uint32_t id;
+                  // event specific, see Trace::Event
+                  uint32_t arg; uint8_t event;
+                  // index of the recording thread
+                  uint8_t thread;);
+
+// Followed by count records sorted by time
+PACKED_STRUCT_DEF(TraceFileHeader, uint32_t magic; uint16_t version;
+                  uint16_t recordSize;
+                  // added to TraceRecord::timeNs gives the unix time in ns
+                  int64_t realtimeOffsetNs;
+                  uint32_t count;);
+
+// Binary tracing of the request handling, cheap enough to stay enabled in
+// production. Every thread records into its own ring of the last
+// RING_SIZE events without taking any lock, dump() writes all rings to a
+// file for the offline decoder drynomore-trace-decode.
+class Trace {
+public:
+  enum Event : uint8_t {
+    // status server, id is the connection
+    ACCEPT = 0,
+    // arg: bytes received
+    READ = 1,
+    // arg: packet type
+    PARSE = 2,
+    // arg: packet type
+    STATE_UPDATE = 3,
+    // arg: bytes sent
+    REPLY = 4,
+    CLOSE = 5,
+    // telegram bot, id is the notification, arg: message type or 0 for the
+    // status table
+    TELEGRAM_SEND = 6,
+    // arg: 1 on success
+    TELEGRAM_SENT = 7,
+  };
+  static constexpr size_t RING_SIZE = 4096;
+
+  static const char *eventName(uint8_t event);
+
+  static void setEnabled(bool enable) {
+    enabled.store(enable, std::memory_order_relaxed);
+  }
+
+  static void event(Event event, uint32_t id, uint32_t arg = 0) {
+    if (enabled.load(std::memory_order_relaxed)) {
+      record(event, id, arg);
+    }
+  }
+
+  // Writes the events of all threads, returns false on failure
+  static bool dump(const std::string &path);
+
+private:
+  static void record(Event event, uint32_t id, uint32_t arg);
+
+  static std::atomic<bool> enabled;
+};
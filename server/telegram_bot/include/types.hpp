@@ -1,8 +1,15 @@
 #pragma once
 
-#include <mutex>
+#include <cstdint>
+#include <ctime>
+#include <set>
+#include <string>
+#include <vector>
 
+#include "history_store.hpp"
 #include "lan_protocol.hpp"
+#include "runtime_config.hpp"
+#include "snapshot.hpp"
 
 struct Message {
   // TODO/NOTE: this has to match the PacketType definitions in lan_protocol.hpp
@@ -14,29 +21,47 @@ struct Message {
     FAILURE_MSG = 8
   };
 
-  Message() : msg(), msgType(INVALID) {}
+  Message() : msg(), msgType(INVALID), deviceId(0) {}
 
-  Message(std::string &&msg, MessageType msgType)
-      : msg(std::move(msg)), msgType(msgType) {}
+  Message(std::string &&msg, MessageType msgType, uint32_t deviceId = 0)
+      : msg(std::move(msg)), msgType(msgType), deviceId(deviceId) {}
 
   std::string msg;
 
   MessageType msgType;
-};
 
-struct StatusWrapper {
-  mutable std::mutex mut;
-  Status status;
-  bool unpublished = false;
-};
+  // Controller the message originates from, 0 for the server itself. Only
+  // identical messages of the same device are coalesced.
+  uint32_t deviceId;
+
+  // Attached by the MessageQueue, msg itself stays untouched as it identifies
+  // the message for coalescing
+  uint32_t repeats = 0;
+  std::time_t firstRepeat = 0;
+  uint32_t dropped = 0;
+
+  // Chats that still have to receive the message, empty for all registered
+  // chats
+  std::vector<std::int64_t> pendingChats;
 
-struct SettingsWrapper {
-  mutable std::mutex mut;
-  Settings settings;
-  bool valid = false;
+  // msg with the notes of the MessageQueue, as it is sent
+  std::string text() const;
 };
 
+// Shared state between the status server and the telegram bot. Readers never
+// block writers, see snapshot.hpp.
 struct StateWrapper {
-  StatusWrapper statusWrap;
-  SettingsWrapper settingsWrap;
+  // Last status report worth publishing, the telegram bot remembers the
+  // version it published last
+  Snapshot<Status> status;
+  // Current settings, nullptr until they were synchronized with the
+  // controller or read from the config
+  Snapshot<Settings> settings;
+  // Measurements of all status reports
+  HistoryStore history;
+  // Runtime part of the YAML config, republished on every valid change of
+  // the config file
+  Snapshot<RuntimeConfig> config;
+  // Chats receiving the notifications
+  Snapshot<std::set<std::int64_t>> chats;
 };
@@ -0,0 +1,544 @@
+// Local stand-in for the Telegram Bot API to exercise the bot offline, i.e. in
+// end-to-end tests and benchmarks. Point the bot at it with
+//   api_url: 'http://127.0.0.1:8081'
+// in the config file, any token is accepted.
+//
+// Usage: ./drynomore-mock-bot-api [port] [--latency <ms>] [--fail-every <n>]
+//
+// Every Bot API call (POST /bot<token>/<method>) is recorded, answered after
+// the configured latency and every n-th call, except for getUpdates, is
+// rejected with 429 Too Many Requests. Malformed requests are answered with
+// 400 Bad Request and close the connection.
+//
+// tools/mock_latency.py drives the bot against the mock and measures the
+// reply latency of a command, it runs as part of `make test`.
+//
+// The mock is scripted through these endpoints, all of them reply with JSON
+// and "time_us", the wall clock time in microseconds that the recorded calls
+// use as well:
+//   POST /mock/message?chat_id=<id>&text=<text>
+//     queue a message update
+//   POST /mock/callback?chat_id=<id>&data=<data>[&message_id=<id>]
+//     queue a callback query, by default for the last message sent to the chat
+//   GET  /mock/calls[?since=<seq>]
+//     recorded calls with a sequence number larger than since
+//   POST /mock/config?latency_ms=<ms>&fail_every=<n>
+//   POST /mock/reset
+//     forget the recorded calls and the queued updates
+
+// Boost 1.74 uses std::exchange in its coroutine support without <utility>
+#include <utility>
+
+#include <algorithm>
+#include <boost/asio.hpp>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <iostream>
+#include <list>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace asio = boost::asio;
+using asio::awaitable;
+using asio::use_awaitable;
+using asio::ip::tcp;
+
+#define DEFAULT_PORT 8081
+#define MAX_HEADER_SIZE (64 * 1024)
+#define MAX_BODY_SIZE (16 * 1024 * 1024)
+// Upper bound of the getUpdates long poll timeout
+#define MAX_POLL_TIMEOUT_SEC 50
+
+using Params = std::map<std::string, std::string>;
+
+static int64_t nowUs() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+             std::chrono::system_clock::now().time_since_epoch())
+      .count();
+}
+
+static std::string jsonEscape(const std::string &str) {
+  std::string res = "\"";
+  for (unsigned char c : str) {
+    switch (c) {
+      case '"':
+        res += "\\\"";
+        break;
+      case '\\':
+        res += "\\\\";
+        break;
+      case '\n':
+        res += "\\n";
+        break;
+      case '\r':
+        res += "\\r";
+        break;
+      case '\t':
+        res += "\\t";
+        break;
+      default:
+        if (c < 0x20) {
+          char buf[8];
+          std::snprintf(buf, sizeof(buf), "\\u%04x", c);
+          res += buf;
+        } else {
+          res += static_cast<char>(c);
+        }
+    }
+  }
+  return res + "\"";
+}
+
+static std::string jsonObject(const Params &params) {
+  std::string res = "{";
+  for (const auto &[key, value] : params) {
+    if (res.size() > 1) {
+      res += ',';
+    }
+    res += jsonEscape(key) + ':' + jsonEscape(value);
+  }
+  return res + "}";
+}
+
+static std::string urlDecode(const std::string &str) {
+  std::string res;
+  for (size_t i = 0; i < str.size(); ++i) {
+    if (str[i] == '+') {
+      res += ' ';
+    } else if (str[i] == '%' && i + 2 < str.size()) {
+      res += static_cast<char>(std::stoi(str.substr(i + 1, 2), nullptr, 16));
+      i += 2;
+    } else {
+      res += str[i];
+    }
+  }
+  return res;
+}
+
+static void parseUrlEncoded(const std::string &str, Params &params) {
+  std::istringstream in(str);
+  for (std::string pair; std::getline(in, pair, '&');) {
+    const size_t eq = pair.find('=');
+    if (eq == std::string::npos) {
+      params[urlDecode(pair)] = "";
+    } else {
+      params[urlDecode(pair.substr(0, eq))] = urlDecode(pair.substr(eq + 1));
+    }
+  }
+}
+
+// Files, i.e. of sendPhoto, are only recorded with their size
+static void parseMultipart(const std::string &body, const std::string &boundary,
+                           Params &params) {
+  const std::string delimiter = "--" + boundary;
+  for (size_t pos = body.find(delimiter); pos != std::string::npos;) {
+    const size_t partStart = pos + delimiter.size() + 2;
+    const size_t next = body.find("\r\n" + delimiter, partStart);
+    if (next == std::string::npos) {
+      break;
+    }
+    const size_t headerEnd = body.find("\r\n\r\n", partStart);
+    if (headerEnd != std::string::npos && headerEnd < next) {
+      const std::string header = body.substr(partStart, headerEnd - partStart);
+      const size_t nameStart = header.find("name=\"");
+      if (nameStart != std::string::npos) {
+        const size_t nameEnd = header.find('"', nameStart + 6);
+        const std::string name =
+            header.substr(nameStart + 6, nameEnd - nameStart - 6);
+        const std::string value =
+            body.substr(headerEnd + 4, next - headerEnd - 4);
+        params[name] = header.find("filename=\"") != std::string::npos
+                           ? "<" + std::to_string(value.size()) + " bytes>"
+                           : value;
+      }
+    }
+    pos = next + 2;
+  }
+}
+
+struct Request {
+  std::string method;
+  std::string path;
+  Params params;
+};
+
+struct Response {
+  int status;
+  std::string body;
+};
+
+class MockBotApi {
+public:
+  MockBotApi(asio::io_context &io, unsigned latencyMs, unsigned failEvery)
+      : io(io), latencyMs(latencyMs), failEvery(failEvery) {}
+
+  awaitable<void> serve(tcp::acceptor &acceptor) {
+    for (;;) {
+      tcp::socket socket = co_await acceptor.async_accept(use_awaitable);
+      socket.set_option(tcp::no_delay(true));
+      asio::co_spawn(io, session(std::move(socket)), asio::detached);
+    }
+  }
+
+private:
+  struct Call {
+    uint64_t seq;
+    int64_t timeUs;
+    std::string method;
+    Params params;
+    int status;
+  };
+
+  struct Update {
+    uint64_t id;
+    std::string json;
+  };
+
+  awaitable<void> session(tcp::socket socket) {
+    std::string pending;
+    try {
+      for (bool keepAlive = true; keepAlive;) {
+        Request request;
+        Response response;
+        try {
+          if (!co_await readRequest(socket, pending, request)) {
+            co_return;
+          }
+          response = co_await handle(request);
+        } catch (const std::logic_error &e) {
+          // std::stoul & co. failed on a malformed number, the rest of the
+          // stream can't be trusted either
+          response = {400, R"({"ok":false,"error_code":400,"description":)" +
+                               jsonEscape(std::string("Bad Request: ") +
+                                          e.what()) +
+                               "}"};
+          keepAlive = false;
+        }
+        std::string out = "HTTP/1.1 " + std::to_string(response.status) +
+                          (response.status == 200 ? " OK" : " Error") +
+                          "\r\nContent-Type: application/json"
+                          "\r\nContent-Length: " +
+                          std::to_string(response.body.size()) +
+                          (keepAlive ? "\r\nConnection: keep-alive\r\n\r\n"
+                                     : "\r\nConnection: close\r\n\r\n") +
+                          response.body;
+        co_await asio::async_write(socket, asio::buffer(out), use_awaitable);
+      }
+    } catch (const boost::system::system_error &) {
+      // the client disconnected
+    }
+  }
+
+  static awaitable<bool> readRequest(tcp::socket &socket, std::string &pending,
+                                     Request &request) {
+    char buf[4096];
+    size_t headerEnd;
+    while ((headerEnd = pending.find("\r\n\r\n")) == std::string::npos) {
+      if (pending.size() > MAX_HEADER_SIZE) {
+        co_return false;
+      }
+      boost::system::error_code ec;
+      const size_t size = co_await socket.async_read_some(
+          asio::buffer(buf), asio::redirect_error(use_awaitable, ec));
+      if (ec) {
+        co_return false;
+      }
+      pending.append(buf, size);
+    }
+
+    std::string header = pending.substr(0, headerEnd + 2);
+    pending.erase(0, headerEnd + 4);
+
+    std::istringstream lines(header);
+    std::string target;
+    lines >> request.method >> target;
+    const size_t query = target.find('?');
+    request.path = target.substr(0, query);
+    if (query != std::string::npos) {
+      parseUrlEncoded(target.substr(query + 1), request.params);
+    }
+
+    size_t contentLength = 0;
+    std::string contentType;
+    for (std::string line; std::getline(lines, line);) {
+      const size_t colon = line.find(':');
+      if (colon == std::string::npos) {
+        continue;
+      }
+      std::string name = line.substr(0, colon);
+      std::transform(name.begin(), name.end(), name.begin(),
+                     [](unsigned char c) { return std::tolower(c); });
+      std::string value = line.substr(colon + 1);
+      value.erase(0, value.find_first_not_of(' '));
+      value.erase(value.find_last_not_of("\r ") + 1);
+      if (name == "content-length") {
+        contentLength = std::stoul(value);
+      } else if (name == "content-type") {
+        contentType = value;
+      }
+    }
+    if (contentLength > MAX_BODY_SIZE) {
+      co_return false;
+    }
+
+    while (pending.size() < contentLength) {
+      boost::system::error_code ec;
+      const size_t size = co_await socket.async_read_some(
+          asio::buffer(buf), asio::redirect_error(use_awaitable, ec));
+      if (ec) {
+        co_return false;
+      }
+      pending.append(buf, size);
+    }
+    const std::string body = pending.substr(0, contentLength);
+    pending.erase(0, contentLength);
+
+    if (const size_t boundary = contentType.find("boundary=");
+        contentType.starts_with("multipart/form-data") &&
+        boundary != std::string::npos) {
+      parseMultipart(body, contentType.substr(boundary + 9), request.params);
+    } else {
+      parseUrlEncoded(body, request.params);
+    }
+    co_return true;
+  }
+
+  awaitable<Response> handle(const Request &request) {
+    if (request.path.starts_with("/mock/")) {
+      co_return control(request.path.substr(6), request.params);
+    }
+
+    // /bot<token>/<method>
+    const size_t slash = request.path.rfind('/');
+    if (!request.path.starts_with("/bot") || slash == 0) {
+      co_return Response{404, R"({"ok":false,"error_code":404,)"
+                              R"("description":"Not Found"})"};
+    }
+    const std::string method = request.path.substr(slash + 1);
+
+    if (latencyMs != 0) {
+      asio::steady_timer delay(io, std::chrono::milliseconds(latencyMs));
+      co_await delay.async_wait(use_awaitable);
+    }
+
+    if (method == "getUpdates") {
+      std::string body = co_await getUpdates(request.params);
+      co_return Response{200, std::move(body)};
+    }
+
+    if (failEvery != 0 && ++apiCalls % failEvery == 0) {
+      record(method, request.params, 429);
+      co_return Response{429, R"({"ok":false,"error_code":429,)"
+                              R"("description":"Too Many Requests: retry )"
+                              R"(after 1","parameters":{"retry_after":1}})"};
+    }
+
+    record(method, request.params, 200);
+    co_return Response{200, R"({"ok":true,"result":)" +
+                                result(method, request.params) + "}"};
+  }
+
+  void record(const std::string &method, const Params &params, int status) {
+    calls.push_back({++callSeq, nowUs(), method, params, status});
+  }
+
+  std::string messageJson(int64_t messageId, int64_t chatId,
+                          const std::string &text) const {
+    return R"({"message_id":)" + std::to_string(messageId) +
+           R"(,"date":)" + std::to_string(nowUs() / 1000000) +
+           R"(,"chat":{"id":)" + std::to_string(chatId) +
+           R"(,"type":"private"},"from":{"id":)" + std::to_string(chatId) +
+           R"(,"is_bot":false,"first_name":"Mock"},"text":)" +
+           jsonEscape(text) + "}";
+  }
+
+  std::string result(const std::string &method, const Params &params) {
+    const auto param = [&params](const char *name) {
+      const auto it = params.find(name);
+      return it == params.end() ? std::string() : it->second;
+    };
+    const int64_t chatId = std::atoll(param("chat_id").c_str());
+
+    if (method == "getMe") {
+      return R"({"id":1,"is_bot":true,"first_name":"DryNoMore",)"
+             R"("username":"drynomore_mock_bot"})";
+    } else if (method == "sendMessage" || method == "sendPhoto") {
+      const int64_t messageId = ++lastMessageId;
+      lastMessageOfChat[chatId] = messageId;
+      std::string message = messageJson(messageId, chatId, param("text"));
+      if (method == "sendPhoto") {
+        message.pop_back();
+        message += R"(,"photo":[{"file_id":"photo)" +
+                   std::to_string(messageId) + R"(","file_unique_id":"u)" +
+                   std::to_string(messageId) +
+                   R"(","width":640,"height":320}]})";
+      }
+      return message;
+    } else if (method.starts_with("editMessage")) {
+      return messageJson(std::atoll(param("message_id").c_str()), chatId,
+                         param("text"));
+    }
+    return "true";
+  }
+
+  awaitable<std::string> getUpdates(const Params &params) {
+    const auto param = [&params](const char *name) -> int64_t {
+      const auto it = params.find(name);
+      return it == params.end() ? 0 : std::atoll(it->second.c_str());
+    };
+    // confirmed updates are dropped, like the real API does
+    const uint64_t offset = static_cast<uint64_t>(param("offset"));
+    while (!updates.empty() && updates.front().id < offset) {
+      updates.pop_front();
+    }
+
+    if (updates.empty()) {
+      const int64_t timeout =
+          std::clamp<int64_t>(param("timeout"), 0, MAX_POLL_TIMEOUT_SEC);
+      asio::steady_timer wait(io, std::chrono::seconds(timeout));
+      const auto poller = pollers.insert(pollers.end(), &wait);
+      boost::system::error_code ec;
+      co_await wait.async_wait(asio::redirect_error(use_awaitable, ec));
+      pollers.erase(poller);
+    }
+
+    const int64_t limit = param("limit");
+    std::string res = R"({"ok":true,"result":[)";
+    int64_t count = 0;
+    for (const auto &update : updates) {
+      if (update.id < offset || (limit > 0 && count == limit)) {
+        continue;
+      }
+      res += (count++ ? "," : "") + update.json;
+    }
+    co_return res + "]}";
+  }
+
+  void queueUpdate(const std::string &json) {
+    const uint64_t id = ++lastUpdateId;
+    updates.push_back(
+        {id, R"({"update_id":)" + std::to_string(id) + "," + json + "}"});
+    // wake up the pending long polls
+    for (auto *poller : pollers) {
+      poller->cancel();
+    }
+  }
+
+  Response control(const std::string &command, const Params &params) {
+    const auto param = [&params](const char *name) {
+      const auto it = params.find(name);
+      return it == params.end() ? std::string() : it->second;
+    };
+    const int64_t chatId = std::atoll(param("chat_id").c_str());
+    const std::string timeUs = std::to_string(nowUs());
+
+    if (command == "message") {
+      const int64_t messageId = ++lastMessageId;
+      queueUpdate(R"("message":)" +
+                  messageJson(messageId, chatId, param("text")));
+      return {200, R"({"ok":true,"time_us":)" + timeUs +
+                       R"(,"message_id":)" + std::to_string(messageId) + "}"};
+    } else if (command == "callback") {
+      int64_t messageId = std::atoll(param("message_id").c_str());
+      if (messageId == 0) {
+        messageId = lastMessageOfChat[chatId];
+      }
+      const std::string queryId = std::to_string(++lastQueryId);
+      queueUpdate(R"("callback_query":{"id":")" + queryId +
+                  R"(","chat_instance":"1","from":{"id":)" +
+                  std::to_string(chatId) +
+                  R"(,"is_bot":false,"first_name":"Mock"},"message":)" +
+                  messageJson(messageId, chatId, "") +
+                  R"(,"data":)" + jsonEscape(param("data")) + "}");
+      return {200, R"({"ok":true,"time_us":)" + timeUs + R"(,"query_id":")" +
+                       queryId + R"(","message_id":)" +
+                       std::to_string(messageId) + "}"};
+    } else if (command == "calls") {
+      const uint64_t since = std::strtoull(param("since").c_str(), nullptr, 10);
+      std::string res = R"({"ok":true,"time_us":)" + timeUs + R"(,"calls":[)";
+      bool first = true;
+      for (const auto &call : calls) {
+        if (call.seq <= since) {
+          continue;
+        }
+        res += (first ? "" : ",") + std::string(R"({"seq":)") +
+               std::to_string(call.seq) + R"(,"time_us":)" +
+               std::to_string(call.timeUs) + R"(,"status":)" +
+               std::to_string(call.status) + R"(,"method":)" +
+               jsonEscape(call.method) + R"(,"params":)" +
+               jsonObject(call.params) + "}";
+        first = false;
+      }
+      return {200, res + "]}"};
+    } else if (command == "config") {
+      if (params.contains("latency_ms")) {
+        latencyMs = std::stoul(param("latency_ms"));
+      }
+      if (params.contains("fail_every")) {
+        failEvery = std::stoul(param("fail_every"));
+        apiCalls = 0;
+      }
+      return {200, R"({"ok":true,"time_us":)" + timeUs + R"(,"latency_ms":)" +
+                       std::to_string(latencyMs) + R"(,"fail_every":)" +
+                       std::to_string(failEvery) + "}"};
+    } else if (command == "reset") {
+      calls.clear();
+      updates.clear();
+      return {200, R"({"ok":true,"time_us":)" + timeUs + "}"};
+    }
+    return {404, R"({"ok":false,"description":"unknown mock command"})"};
+  }
+
+  asio::io_context &io;
+  unsigned latencyMs;
+  unsigned failEvery;
+  unsigned apiCalls = 0;
+
+  std::vector<Call> calls;
+  uint64_t callSeq = 0;
+
+  std::deque<Update> updates;
+  uint64_t lastUpdateId = 0;
+  std::list<asio::steady_timer *> pollers;
+
+  int64_t lastMessageId = 0;
+  uint64_t lastQueryId = 0;
+  std::map<int64_t, int64_t> lastMessageOfChat;
+};
+
+int main(int argc, char **argv) {
+  uint16_t port = DEFAULT_PORT;
+  unsigned latencyMs = 0;
+  unsigned failEvery = 0;
+
+  for (int i = 1; i < argc; ++i) {
+    const std::string arg = argv[i];
+    if (arg == "--latency" && i + 1 < argc) {
+      latencyMs = std::stoul(argv[++i]);
+    } else if (arg == "--fail-every" && i + 1 < argc) {
+      failEvery = std::stoul(argv[++i]);
+    } else if (!arg.starts_with("-")) {
+      port = static_cast<uint16_t>(std::stoul(arg));
+    } else {
+      std::cout << "Usage: " << argv[0]
+                << " [port] [--latency <ms>] [--fail-every <n>]" << std::endl;
+      return 1;
+    }
+  }
+
+  asio::io_context io;
+  tcp::acceptor acceptor(io, tcp::endpoint(asio::ip::address_v4::loopback(),
+                                           port));
+  MockBotApi api(io, latencyMs, failEvery);
+  asio::co_spawn(io, api.serve(acceptor), asio::detached);
+
+  std::cout << "Mock Telegram Bot API listening on http://127.0.0.1:" << port
+            << std::endl;
+  io.run();
+}
@@ -0,0 +1,119 @@
+#include <algorithm>
+#include <cmath>
+
+#include "anomaly_detector.hpp"
+
+std::string Anomaly::describe() const {
+  const std::string sensor =
+      (isPlant ? "moisture sensor P" : "water level sensor W") +
+      std::to_string(idx + 1);
+  const std::string consequence =
+      isFailure ? ", irrigation of P" + std::to_string(idx + 1) + " disabled!"
+                : "!";
+
+  switch (kind) {
+    case OUT_OF_RANGE:
+      return sensor + " reads " + std::to_string(raw) +
+             ", it is probably disconnected or shorted" + consequence;
+    case STUCK_VALUE:
+      return sensor + " is stuck at " + std::to_string(raw) + consequence;
+    case STEP_CHANGE:
+      return sensor + " jumped to " + std::to_string(raw) +
+             ", check if it moved" + consequence;
+    case NO_MOISTURE_GAIN:
+      return "P" + std::to_string(idx + 1) +
+             " did not get any wetter while being irrigated, check the pump "
+             "and its hose" +
+             consequence;
+  }
+  return sensor + ": unknown anomaly" + consequence;
+}
+
+void AnomalyDetector::checkSensor(SensorState &sensor, bool isPlant,
+                                  uint8_t idx, uint16_t raw,
+                                  std::vector<Anomaly> &anomalies) {
+  if (raw <= conf.rawLowerRail || raw >= conf.rawUpperRail) {
+    anomalies.push_back({Anomaly::OUT_OF_RANGE, isPlant, idx, raw, isPlant});
+    return;
+  }
+
+  // a run is compared to its first reading, a slow drift breaks it as well
+  if (sensor.runRaw != UNDEFINED_LEVEL_16 &&
+      std::abs(raw - sensor.runRaw) <= conf.stuckTolerance) {
+    // report once when the threshold is reached
+    if (++sensor.sameReadings == conf.stuckReadings) {
+      anomalies.push_back({Anomaly::STUCK_VALUE, isPlant, idx, raw, isPlant});
+    }
+    sensor.sameReadings = std::min(sensor.sameReadings, conf.stuckReadings);
+  } else {
+    sensor.runRaw = raw;
+    sensor.sameReadings = 0;
+  }
+
+  OnlineStats &stats = sensor.stats;
+  if (stats.count() >= conf.warmupReadings) {
+    const double stdDev =
+        std::max(std::sqrt(stats.variance()), conf.minStdDev);
+    if (std::abs(raw - stats.mean()) > conf.stepSigma * stdDev) {
+      anomalies.push_back({Anomaly::STEP_CHANGE, isPlant, idx, raw, false});
+    }
+  }
+  stats.add(raw, conf.alpha);
+}
+
+std::vector<Anomaly> AnomalyDetector::analyze(uint32_t deviceId,
+                                              const Status &status,
+                                              const Settings *settings) {
+  std::vector<Anomaly> anomalies;
+  auto &[plants, tanks, noGainCycles] = devices[deviceId];
+
+  const uint8_t numWaterSensors = std::min(
+      status.numWaterSensors, static_cast<uint8_t>(MAX_WATER_SENSOR_COUNT));
+  for (uint8_t i = 0; i < numWaterSensors; ++i) {
+    if (status.beforeWaterLevelsRaw[i] != UNDEFINED_LEVEL_16) {
+      checkSensor(tanks[i], false, i, status.beforeWaterLevelsRaw[i],
+                  anomalies);
+    }
+  }
+
+  const uint8_t numPlants = std::min(
+      status.numPlants, static_cast<uint8_t>(MAX_MOISTURE_SENSOR_COUNT));
+  for (uint8_t i = 0; i < numPlants; ++i) {
+    const uint16_t beforeRaw = status.beforeMoistureLevelsRaw[i];
+    if (beforeRaw == UNDEFINED_LEVEL_16 ||
+        (settings && hasHardwareFailure(*settings, i))) {
+      // not measured or already flagged
+      continue;
+    }
+    // The readings before the irrigation are comparable between cycles
+    checkSensor(plants[i], true, i, beforeRaw, anomalies);
+
+    if (!settings) {
+      continue;
+    }
+    const uint8_t before = status.beforeMoistureLevels[i];
+    const uint8_t after = status.afterMoistureLevels[i];
+    const uint8_t tankIdx = getWaterSensIdx(*settings, i);
+    const uint8_t tankLevel = status.afterWaterLevels[tankIdx];
+    const uint8_t emptyThres = settings->waterLvlThres[tankIdx].emptyThres;
+    // The controller may lower the target on a low battery, trust its bursts.
+    // Legacy reports lack them.
+    const uint8_t bursts = status.bursts[i];
+    const bool irrigated = (bursts != UNDEFINED_LEVEL_8
+                                ? bursts != 0
+                                : before < settings->targetMoisture[i]) &&
+                           tankLevel != UNDEFINED_LEVEL_8 &&
+                           tankLevel > emptyThres;
+    if (irrigated && after != UNDEFINED_LEVEL_8 && after <= before) {
+      if (++noGainCycles[i] == conf.noGainCycles) {
+        anomalies.push_back({Anomaly::NO_MOISTURE_GAIN, true, i,
+                             status.afterMoistureLevelsRaw[i], true});
+        noGainCycles[i] = 0;
+      }
+    } else if (irrigated) {
+      noGainCycles[i] = 0;
+    }
+  }
+
+  return anomalies;
+}
@@ -0,0 +1,257 @@
+#include <algorithm>
+#include <cctype>
+#include <future>
+
+#include "asio_http_client.hpp"
+
+namespace asio = boost::asio;
+namespace ssl = asio::ssl;
+using asio::awaitable;
+using asio::use_awaitable;
+using asio::ip::tcp;
+
+// Upper bound of a single request, has to exceed the long poll timeout
+#define REQUEST_TIMEOUT std::chrono::seconds(60)
+// The long poll and the notifications need one each, a few spare ones
+// cover bursts of command replies
+#define MAX_IDLE_CONNECTIONS 4
+#define MAX_HEADER_SIZE (64 * 1024)
+
+struct AsioHttpClient::Connection {
+  Connection(asio::io_context &io, ssl::context &sslContext,
+             const std::string &host, const std::string &port, bool useTls)
+      : host(host), port(port), plain(io), timer(io) {
+    if (useTls) {
+      tls = std::make_unique<ssl::stream<tcp::socket>>(io, sslContext);
+    }
+  }
+
+  tcp::socket &socket() { return tls ? tls->next_layer() : plain; }
+
+  awaitable<void> write(const std::string &data) {
+    if (tls) {
+      co_await asio::async_write(*tls, asio::buffer(data), use_awaitable);
+    } else {
+      co_await asio::async_write(plain, asio::buffer(data), use_awaitable);
+    }
+  }
+
+  // Appends the next received bytes to pending
+  awaitable<void> receive() {
+    char buf[4096];
+    const size_t size =
+        tls ? co_await tls->async_read_some(asio::buffer(buf), use_awaitable)
+            : co_await plain.async_read_some(asio::buffer(buf), use_awaitable);
+    pending.append(buf, size);
+    received += size;
+  }
+
+  awaitable<void> receiveAtLeast(size_t size) {
+    while (pending.size() < size) {
+      co_await receive();
+    }
+  }
+
+  const std::string host;
+  const std::string port;
+  tcp::socket plain;
+  std::unique_ptr<ssl::stream<tcp::socket>> tls;
+  // closes the socket once a request takes too long
+  asio::steady_timer timer;
+  // bytes received but not yet consumed
+  std::string pending;
+  // bytes received over the lifetime of the connection
+  size_t received = 0;
+};
+
+// Whether the server closed the connection in an orderly way
+static bool isEndOfStream(const boost::system::error_code &ec) {
+  return ec == asio::error::eof || ec == ssl::error::stream_truncated;
+}
+
+AsioHttpClient::AsioHttpClient(asio::io_context &io)
+    : io(io), sslContext(ssl::context::tls_client) {
+  sslContext.set_default_verify_paths();
+  sslContext.set_verify_mode(ssl::verify_peer);
+}
+
+AsioHttpClient::~AsioHttpClient() = default;
+
+std::string
+AsioHttpClient::makeRequest(const TgBot::Url &url,
+                            const std::vector<TgBot::HttpReqArg> &args) const {
+  const bool useTls = url.protocol == "https";
+  std::string host = url.host;
+  std::string port = useTls ? "443" : "80";
+  if (const auto colon = host.find(':'); colon != std::string::npos) {
+    port = host.substr(colon + 1);
+    host.resize(colon);
+  }
+
+  auto response = asio::co_spawn(
+      io,
+      request(useTls, host, port, httpParser.generateRequest(url, args, true)),
+      asio::use_future);
+  return response.get();
+}
+
+awaitable<std::shared_ptr<AsioHttpClient::Connection>>
+AsioHttpClient::connect(bool useTls, const std::string &host,
+                        const std::string &port) const {
+  tcp::resolver resolver(io);
+  const auto endpoints =
+      co_await resolver.async_resolve(host, port, use_awaitable);
+
+  auto conn = std::make_shared<Connection>(io, sslContext, host, port, useTls);
+  co_await asio::async_connect(conn->socket(), endpoints, use_awaitable);
+  conn->socket().set_option(tcp::no_delay(true));
+
+  if (useTls) {
+    // SNI, required by most servers
+    SSL_set_tlsext_host_name(conn->tls->native_handle(), host.c_str());
+    conn->tls->set_verify_callback(ssl::host_name_verification(host));
+    co_await conn->tls->async_handshake(ssl::stream_base::client,
+                                        use_awaitable);
+  }
+  co_return conn;
+}
+
+awaitable<bool> AsioHttpClient::readResponse(Connection &conn,
+                                             std::string &body) const {
+  size_t headerEnd;
+  while ((headerEnd = conn.pending.find("\r\n\r\n")) == std::string::npos) {
+    if (conn.pending.size() > MAX_HEADER_SIZE) {
+      throw std::runtime_error("HTTP response header too large");
+    }
+    co_await conn.receive();
+  }
+  std::string header = conn.pending.substr(0, headerEnd + 2);
+  conn.pending.erase(0, headerEnd + 4);
+  std::transform(header.begin(), header.end(), header.begin(),
+                 [](unsigned char c) { return std::tolower(c); });
+
+  const bool keepAlive = header.starts_with("http/1.1") &&
+                         header.find("\r\nconnection: close") ==
+                             std::string::npos;
+
+  body.clear();
+  if (header.find("\r\ntransfer-encoding: chunked") != std::string::npos) {
+    for (;;) {
+      size_t lineEnd;
+      while ((lineEnd = conn.pending.find("\r\n")) == std::string::npos) {
+        co_await conn.receive();
+      }
+      const size_t chunkSize = std::stoul(conn.pending, nullptr, 16);
+      conn.pending.erase(0, lineEnd + 2);
+
+      if (chunkSize == 0) {
+        // skip the trailers up to the final empty line
+        while ((lineEnd = conn.pending.find("\r\n")) != 0) {
+          if (lineEnd == std::string::npos) {
+            co_await conn.receive();
+          } else {
+            conn.pending.erase(0, lineEnd + 2);
+          }
+        }
+        conn.pending.erase(0, 2);
+        break;
+      }
+
+      co_await conn.receiveAtLeast(chunkSize + 2);
+      body.append(conn.pending, 0, chunkSize);
+      conn.pending.erase(0, chunkSize + 2);
+    }
+  } else if (const auto pos = header.find("\r\ncontent-length:");
+             pos != std::string::npos) {
+    const size_t length = std::stoul(header.substr(pos + 17));
+    co_await conn.receiveAtLeast(length);
+    body = conn.pending.substr(0, length);
+    conn.pending.erase(0, length);
+  } else {
+    // the body ends with the connection
+    boost::system::error_code ec;
+    while (!ec) {
+      char buf[4096];
+      const size_t size =
+          conn.tls ? co_await conn.tls->async_read_some(
+                         asio::buffer(buf),
+                         asio::redirect_error(use_awaitable, ec))
+                   : co_await conn.plain.async_read_some(
+                         asio::buffer(buf),
+                         asio::redirect_error(use_awaitable, ec));
+      conn.pending.append(buf, size);
+      conn.received += size;
+    }
+    body = std::move(conn.pending);
+    conn.pending.clear();
+    co_return false;
+  }
+
+  co_return keepAlive;
+}
+
+awaitable<std::string> AsioHttpClient::request(bool useTls,
+                                               std::string host,
+                                               std::string port,
+                                               std::string payload) const {
+  for (;;) {
+    std::shared_ptr<Connection> conn;
+    auto idle = std::find_if(idleConnections.rbegin(), idleConnections.rend(),
+                             [&](const auto &c) {
+                               return (c->tls != nullptr) == useTls &&
+                                      c->host == host && c->port == port;
+                             });
+    const bool reused = idle != idleConnections.rend();
+    if (reused) {
+      conn = std::move(*idle);
+      idleConnections.erase(std::next(idle).base());
+    } else {
+      conn = co_await connect(useTls, host, port);
+    }
+
+    // an expiry that was already queued may run after the connection is gone
+    conn->timer.expires_after(REQUEST_TIMEOUT);
+    conn->timer.async_wait([weakConn = std::weak_ptr<Connection>(conn)](
+                               boost::system::error_code ec) {
+      const auto timedConn = weakConn.lock();
+      if (!ec && timedConn) {
+        timedConn->socket().close();
+      }
+    });
+
+    std::string body;
+    bool keepAlive = false;
+    bool written = false;
+    const size_t receivedBefore = conn->received;
+    std::exception_ptr error;
+    boost::system::error_code errorCode;
+    try {
+      co_await conn->write(payload);
+      written = true;
+      keepAlive = co_await readResponse(*conn, body);
+    } catch (const boost::system::system_error &e) {
+      error = std::current_exception();
+      errorCode = e.code();
+    }
+    conn->timer.cancel();
+
+    if (error) {
+      // The server closes idle connections after a while, this is only
+      // noticed when using them again. The request is only sent again if the
+      // server can not have processed it, i.e. a sendMessage must not be
+      // delivered twice.
+      const bool unprocessed =
+          !written ||
+          (isEndOfStream(errorCode) && conn->received == receivedBefore);
+      if (reused && unprocessed) {
+        continue;
+      }
+      std::rethrow_exception(error);
+    }
+
+    if (keepAlive && idleConnections.size() < MAX_IDLE_CONNECTIONS) {
+      idleConnections.push_back(std::move(conn));
+    }
+    co_return body;
+  }
+}
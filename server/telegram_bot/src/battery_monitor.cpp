@@ -0,0 +1,99 @@
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <sstream>
+
+#include "battery_monitor.hpp"
+
+#define SEC_PER_DAY (24.0 * 60 * 60)
+
+std::string BatteryForecast::describe(std::time_t now) const {
+  std::stringstream ss;
+  ss << std::fixed << std::setprecision(2) << "battery at "
+     << milliVolt / 1000.0 << " V";
+  if (milliVoltPerDay < 0) {
+    ss << std::setprecision(0) << ", dropping " << -milliVoltPerDay
+       << " mV per day";
+  }
+  if (emptyAt > now) {
+    ss << std::setprecision(1) << ", replace it within "
+       << (emptyAt - now) / SEC_PER_DAY << " days!";
+  } else if (emptyAt != 0) {
+    ss << ", replace it now!";
+  }
+  return ss.str();
+}
+
+void BatteryMonitor::predict(const Device &device, std::time_t now,
+                             BatteryForecast &forecast) const {
+  forecast.milliVoltPerDay = 0;
+  forecast.emptyAt = forecast.milliVolt <= conf.emptyMilliVolt ? now : 0;
+  const auto &readings = device.readings;
+  if (readings.size() < conf.minReadings ||
+      readings.back().time - readings.front().time <
+          static_cast<std::time_t>(conf.minTrendSec) ||
+      forecast.emptyAt != 0) {
+    return;
+  }
+
+  // least squares fit, the times relative to the oldest reading keep the
+  // sums precise
+  const std::time_t origin = readings.front().time;
+  double meanT = 0;
+  double meanV = 0;
+  for (const auto &reading : readings) {
+    meanT += (reading.time - origin) / SEC_PER_DAY;
+    meanV += reading.milliVolt;
+  }
+  meanT /= readings.size();
+  meanV /= readings.size();
+  double cov = 0;
+  double var = 0;
+  for (const auto &reading : readings) {
+    const double dt = (reading.time - origin) / SEC_PER_DAY - meanT;
+    cov += dt * (reading.milliVolt - meanV);
+    var += dt * dt;
+  }
+  if (var <= 0) {
+    return;
+  }
+  forecast.milliVoltPerDay = cov / var;
+  if (forecast.milliVoltPerDay >= 0) {
+    return;
+  }
+
+  // the fitted voltage of now is less noisy than the last reading
+  const double nowDay = (now - origin) / SEC_PER_DAY;
+  const double fitted = meanV + forecast.milliVoltPerDay * (nowDay - meanT);
+  const double daysLeft =
+      std::max(0.0, (fitted - conf.emptyMilliVolt) / -forecast.milliVoltPerDay);
+  forecast.emptyAt = now + static_cast<std::time_t>(daysLeft * SEC_PER_DAY);
+}
+
+bool BatteryMonitor::record(uint32_t deviceId, uint16_t milliVolt,
+                            std::time_t now, BatteryForecast &forecast) {
+  if (milliVolt == 0) {
+    return false;
+  }
+  Device &device = devices[deviceId];
+  auto &readings = device.readings;
+  if (!readings.empty() &&
+      milliVolt >= readings.back().milliVolt + conf.replacedRiseMilliVolt) {
+    readings.clear();
+    device.warned = false;
+  }
+  readings.push_back({now, milliVolt});
+  while (now - readings.front().time >
+         static_cast<std::time_t>(conf.trendWindowSec)) {
+    readings.pop_front();
+  }
+
+  forecast.milliVolt = milliVolt;
+  predict(device, now, forecast);
+  if (device.warned || forecast.emptyAt == 0 ||
+      forecast.emptyAt - now > static_cast<std::time_t>(conf.warnAheadSec)) {
+    return false;
+  }
+  device.warned = true;
+  return true;
+}
@@ -0,0 +1,322 @@
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <ctime>
+
+#include "chart.hpp"
+#include "png.hpp"
+
+namespace {
+  enum Color : uint8_t {
+    BACKGROUND,
+    FRAME,
+    GRID,
+    TEXT,
+    TARGET,
+    SERIES_0,
+    SERIES_1,
+    SERIES_2,
+    SERIES_3
+  };
+
+  const std::vector<Rgb> palette = {
+      {255, 255, 255}, // BACKGROUND
+      {80, 80, 80},    // FRAME
+      {225, 225, 225}, // GRID
+      {40, 40, 40},    // TEXT
+      {220, 60, 60},   // TARGET
+      {30, 110, 200},  // SERIES_0
+      {40, 160, 80},   // SERIES_1
+      {230, 150, 30},  // SERIES_2
+      {140, 70, 170},  // SERIES_3
+  };
+
+  // 3x5 pixel font, 3 bits per row from top to bottom, MSb is the left pixel
+  constexpr uint16_t glyph(uint8_t r0, uint8_t r1, uint8_t r2, uint8_t r3,
+                           uint8_t r4) {
+    return (r0 << 12) | (r1 << 9) | (r2 << 6) | (r3 << 3) | r4;
+  }
+
+  uint16_t glyphFor(char c) {
+    switch (std::toupper(static_cast<unsigned char>(c))) {
+      // clang-format off
+      case '0': return glyph(07, 05, 05, 05, 07);
+      case '1': return glyph(02, 06, 02, 02, 07);
+      case '2': return glyph(07, 01, 07, 04, 07);
+      case '3': return glyph(07, 01, 07, 01, 07);
+      case '4': return glyph(05, 05, 07, 01, 01);
+      case '5': return glyph(07, 04, 07, 01, 07);
+      case '6': return glyph(07, 04, 07, 05, 07);
+      case '7': return glyph(07, 01, 01, 02, 02);
+      case '8': return glyph(07, 05, 07, 05, 07);
+      case '9': return glyph(07, 05, 07, 01, 07);
+      case 'A': return glyph(02, 05, 07, 05, 05);
+      case 'B': return glyph(06, 05, 06, 05, 06);
+      case 'C': return glyph(03, 04, 04, 04, 03);
+      case 'D': return glyph(06, 05, 05, 05, 06);
+      case 'E': return glyph(07, 04, 06, 04, 07);
+      case 'F': return glyph(07, 04, 06, 04, 04);
+      case 'G': return glyph(03, 04, 05, 05, 03);
+      case 'H': return glyph(05, 05, 07, 05, 05);
+      case 'I': return glyph(07, 02, 02, 02, 07);
+      case 'J': return glyph(01, 01, 01, 05, 02);
+      case 'K': return glyph(05, 05, 06, 05, 05);
+      case 'L': return glyph(04, 04, 04, 04, 07);
+      case 'M': return glyph(05, 07, 07, 05, 05);
+      case 'N': return glyph(06, 05, 05, 05, 05);
+      case 'O': return glyph(02, 05, 05, 05, 02);
+      case 'P': return glyph(06, 05, 06, 04, 04);
+      case 'Q': return glyph(02, 05, 05, 06, 03);
+      case 'R': return glyph(06, 05, 06, 05, 05);
+      case 'S': return glyph(03, 04, 02, 01, 06);
+      case 'T': return glyph(07, 02, 02, 02, 02);
+      case 'U': return glyph(05, 05, 05, 05, 07);
+      case 'V': return glyph(05, 05, 05, 05, 02);
+      case 'W': return glyph(05, 05, 07, 07, 05);
+      case 'X': return glyph(05, 05, 02, 05, 05);
+      case 'Y': return glyph(05, 05, 02, 02, 02);
+      case 'Z': return glyph(07, 01, 02, 04, 07);
+      case '%': return glyph(05, 01, 02, 04, 05);
+      case '-': return glyph(00, 00, 07, 00, 00);
+      case ':': return glyph(00, 02, 00, 02, 00);
+      case '.': return glyph(00, 00, 00, 00, 02);
+      case '/': return glyph(01, 01, 02, 04, 04);
+      default: return 0;
+      // clang-format on
+    }
+  }
+
+  class Canvas {
+  public:
+    Canvas(int width, int height)
+        : width(width), height(height),
+          pixels(static_cast<size_t>(width) * height, BACKGROUND) {}
+
+    void set(int x, int y, uint8_t color) {
+      if (x >= 0 && y >= 0 && x < width && y < height) {
+        pixels[static_cast<size_t>(y) * width + x] = color;
+      }
+    }
+
+    void fillRect(int x, int y, int w, int h, uint8_t color) {
+      for (int j = y; j < y + h; ++j) {
+        for (int i = x; i < x + w; ++i) {
+          set(i, j, color);
+        }
+      }
+    }
+
+    void hLine(int x0, int x1, int y, uint8_t color, int dash = 0) {
+      for (int x = x0; x <= x1; ++x) {
+        if (dash == 0 || ((x - x0) / dash) % 2 == 0) {
+          set(x, y, color);
+        }
+      }
+    }
+
+    void vLine(int x, int y0, int y1, uint8_t color) {
+      for (int y = y0; y <= y1; ++y) {
+        set(x, y, color);
+      }
+    }
+
+    // Bresenham, thickness 2 to stay visible when scaled down by telegram
+    void line(int x0, int y0, int x1, int y1, uint8_t color) {
+      const int dx = std::abs(x1 - x0), sx = x0 < x1 ? 1 : -1;
+      const int dy = -std::abs(y1 - y0), sy = y0 < y1 ? 1 : -1;
+      for (int err = dx + dy;;) {
+        fillRect(x0, y0, 2, 2, color);
+        if (x0 == x1 && y0 == y1) {
+          break;
+        }
+        const int e2 = 2 * err;
+        if (e2 >= dy) {
+          err += dy;
+          x0 += sx;
+        }
+        if (e2 <= dx) {
+          err += dx;
+          y0 += sy;
+        }
+      }
+    }
+
+    static int textWidth(const std::string &text, int scale) {
+      return static_cast<int>(text.size()) * 4 * scale;
+    }
+
+    void text(int x, int y, const std::string &text, uint8_t color,
+              int scale) {
+      for (char c : text) {
+        const uint16_t g = glyphFor(c);
+        for (int row = 0; row < 5; ++row) {
+          for (int col = 0; col < 3; ++col) {
+            if ((g >> ((4 - row) * 3 + (2 - col))) & 1) {
+              fillRect(x + col * scale, y + row * scale, scale, scale, color);
+            }
+          }
+        }
+        x += 4 * scale;
+      }
+    }
+
+    std::string png() const {
+      return encodePalettePng(width, height, pixels, palette);
+    }
+
+    const int width;
+    const int height;
+
+  private:
+    std::vector<uint8_t> pixels;
+  };
+
+  std::string formatTime(uint32_t time, const char *format) {
+    const std::time_t t = time;
+    std::tm tm;
+    localtime_r(&t, &tm);
+    char buf[32];
+    std::strftime(buf, sizeof(buf), format, &tm);
+    return buf;
+  }
+
+  // Maps time & percentage into a plot area
+  struct Plot {
+    int x, y, w, h;
+    uint32_t from, to;
+
+    int px(uint32_t time) const {
+      const double span = std::max<uint32_t>(to - from, 1);
+      return x + static_cast<int>((time - from) * (w - 1) / span);
+    }
+    int py(uint8_t value) const {
+      return y + h - 1 - std::min<int>(value, 100) * (h - 1) / 100;
+    }
+  };
+
+  void drawSeries(Canvas &canvas, const Plot &plot, const ChartSeries &series,
+                  uint8_t color) {
+    bool first = true;
+    int lastX = 0, lastY = 0;
+    for (const auto &p : series.points) {
+      if (p.time < plot.from || p.time > plot.to || p.value > 100) {
+        continue;
+      }
+      const int x = plot.px(p.time);
+      const int y = plot.py(p.value);
+      if (first) {
+        canvas.fillRect(x, y, 2, 2, color);
+      } else {
+        canvas.line(lastX, lastY, x, y, color);
+      }
+      first = false;
+      lastX = x;
+      lastY = y;
+    }
+  }
+} // namespace
+
+std::string renderLineChart(const std::string &title, uint32_t from,
+                            uint32_t to, const std::vector<ChartSeries> &series,
+                            uint8_t targetLine) {
+  constexpr int scale = 2;
+  Canvas canvas(640, 320);
+  const Plot plot{60, 40, canvas.width - 80, canvas.height - 90, from, to};
+
+  canvas.text(plot.x, 12, title, TEXT, scale + 1);
+
+  for (int v = 0; v <= 100; v += 25) {
+    const int y = plot.py(v);
+    canvas.hLine(plot.x, plot.x + plot.w - 1, y, GRID);
+    const std::string label = std::to_string(v) + "%";
+    canvas.text(plot.x - 8 - Canvas::textWidth(label, scale), y - 5, label,
+                TEXT, scale);
+  }
+  if (targetLine <= 100) {
+    canvas.hLine(plot.x, plot.x + plot.w - 1, plot.py(targetLine), TARGET, 6);
+  }
+
+  // frame & time axis labels
+  canvas.hLine(plot.x, plot.x + plot.w - 1, plot.y + plot.h, FRAME);
+  canvas.vLine(plot.x - 1, plot.y, plot.y + plot.h, FRAME);
+  const bool showTime = to - from <= 2 * 24 * 60 * 60;
+  for (int i = 0; i <= 4; ++i) {
+    const uint32_t t = from + static_cast<uint32_t>(
+                                  static_cast<uint64_t>(to - from) * i / 4);
+    const int x = plot.px(t);
+    canvas.vLine(x, plot.y + plot.h, plot.y + plot.h + 4, FRAME);
+    const std::string label = formatTime(t, showTime ? "%H:%M" : "%m-%d");
+    const int w = Canvas::textWidth(label, scale);
+    canvas.text(std::clamp(x - w / 2, 0, canvas.width - w),
+                plot.y + plot.h + 10, label, TEXT, scale);
+  }
+
+  // legend
+  int legendX = plot.x;
+  const int legendY = canvas.height - 22;
+  for (size_t i = 0; i < series.size() && i < 4; ++i) {
+    const uint8_t color = SERIES_0 + i;
+    drawSeries(canvas, plot, series[i], color);
+    canvas.fillRect(legendX, legendY + 2, 14, 6, color);
+    canvas.text(legendX + 20, legendY, series[i].label, TEXT, scale);
+    legendX += 20 + Canvas::textWidth(series[i].label, scale) + 24;
+  }
+
+  return canvas.png();
+}
+
+std::string renderSparklines(uint32_t from, uint32_t to,
+                             const std::vector<ChartSeries> &series) {
+  constexpr int scale = 2;
+  constexpr int rowHeight = 40;
+  constexpr int labelWidth = 60;
+  Canvas canvas(400, std::max<int>(series.size(), 1) * rowHeight + 8);
+
+  for (size_t i = 0; i < series.size(); ++i) {
+    const int top = 4 + static_cast<int>(i) * rowHeight;
+    canvas.text(4, top + rowHeight / 2 - 5, series[i].label, TEXT, scale);
+
+    const Plot plot{labelWidth, top + 4, canvas.width - labelWidth - 50,
+                    rowHeight - 8, from, to};
+    canvas.hLine(plot.x, plot.x + plot.w - 1, plot.py(50), GRID, 4);
+    drawSeries(canvas, plot, series[i], SERIES_0);
+
+    // latest value
+    for (auto it = series[i].points.rbegin(); it != series[i].points.rend();
+         ++it) {
+      if (it->value <= 100 && it->time <= to) {
+        canvas.text(plot.x + plot.w + 8, top + rowHeight / 2 - 5,
+                    std::to_string(it->value) + "%", TEXT, scale);
+        break;
+      }
+    }
+  }
+
+  return canvas.png();
+}
+
+ChartCache::Entry *ChartCache::find(const std::string &key) {
+  auto it = index.find(key);
+  if (it == index.end()) {
+    return nullptr;
+  }
+  // mark as most recently used
+  entries.splice(entries.begin(), entries, it->second);
+  return &it->second->second;
+}
+
+ChartCache::Entry &ChartCache::insert(const std::string &key,
+                                      std::string &&png) {
+  if (Entry *entry = find(key)) {
+    entry->png = std::move(png);
+    entry->fileId.clear();
+    return *entry;
+  }
+  entries.emplace_front(key, Entry{std::move(png), std::string()});
+  index[key] = entries.begin();
+  while (entries.size() > capacity) {
+    index.erase(entries.back().first);
+    entries.pop_back();
+  }
+  return entries.front().second;
+}
@@ -0,0 +1,117 @@
+#include <filesystem>
+#include <iostream>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+#include "config_watcher.hpp"
+#include "networking.hpp"
+
+namespace asio = boost::asio;
+
+ConfigWatcher::ConfigWatcher(asio::io_context &io, const std::string &path,
+                             StateWrapper &state, MessageQueue &msgQueue,
+                             std::function<void()> &&onReload)
+    : path(path), state(state), msgQueue(msgQueue),
+      onReload(std::move(onReload)), inotify(io) {
+  const int inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (inotifyFd < 0) {
+    std::cerr << "Failed to initialize inotify, config changes require a "
+                 "restart: ";
+    printErrno();
+    return;
+  }
+
+  // Editors usually write a new file and rename it over the old one, hence
+  // the directory is watched instead of the file itself
+  std::filesystem::path dir = std::filesystem::path(path).parent_path();
+  if (dir.empty()) {
+    dir = ".";
+  }
+  if (inotify_add_watch(inotifyFd, dir.c_str(),
+                        IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+    std::cerr << "Failed to watch " << dir
+              << ", config changes require a restart: ";
+    printErrno();
+    close(inotifyFd);
+  } else {
+    inotify.assign(inotifyFd);
+  }
+
+  try {
+    const YAML::Node node = YAML::LoadFile(path);
+    token = node["token"].as<std::string>("");
+    apiUrl = node["api_url"].as<std::string>("");
+  } catch (const YAML::Exception &) {
+  }
+}
+
+bool ConfigWatcher::reload() {
+  RuntimeConfig config;
+  std::string error;
+  try {
+    const YAML::Node node = YAML::LoadFile(path);
+    if (node["token"].as<std::string>("") != token) {
+      msgQueue.push(Message("Changing the bot token requires a restart!",
+                            Message::WARN_MSG));
+    }
+    if (node["api_url"].as<std::string>("") != apiUrl) {
+      msgQueue.push(Message("Changing the api_url requires a restart!",
+                            Message::WARN_MSG));
+    }
+    parseRuntimeConfig(node, config, error);
+  } catch (const YAML::Exception &e) {
+    error = std::string("Failed to load config file: ") + e.what();
+  }
+
+  if (!error.empty()) {
+    msgQueue.push(Message("Config reload failed, keeping the previous "
+                          "config: " +
+                              error,
+                          Message::WARN_MSG));
+    return false;
+  }
+
+  state.config.publish(config);
+  std::cout << "Reloaded config " << path << std::endl;
+  return true;
+}
+
+void ConfigWatcher::start() {
+  if (inotify.is_open()) {
+    asio::co_spawn(inotify.get_executor(), watch(), asio::detached);
+  }
+}
+
+void ConfigWatcher::stop() {
+  boost::system::error_code ec;
+  inotify.close(ec);
+}
+
+asio::awaitable<void> ConfigWatcher::watch() {
+  const std::string fileName = std::filesystem::path(path).filename();
+  alignas(struct inotify_event) char buf[4096];
+
+  for (;;) {
+    boost::system::error_code ec;
+    co_await inotify.async_wait(asio::posix::descriptor_base::wait_read,
+                                asio::redirect_error(asio::use_awaitable, ec));
+    if (ec) {
+      // closed by stop()
+      co_return;
+    }
+
+    bool changed = false;
+    for (ssize_t len;
+         (len = read(inotify.native_handle(), buf, sizeof(buf))) > 0;) {
+      for (char *ptr = buf; ptr < buf + len;) {
+        const auto *event = reinterpret_cast<const struct inotify_event *>(ptr);
+        changed |= event->len != 0 && fileName == event->name;
+        ptr += sizeof(struct inotify_event) + event->len;
+      }
+    }
+
+    if (changed && reload()) {
+      onReload();
+    }
+  }
+}
@@ -1,45 +1,613 @@
+#include <algorithm>
+#include <chrono>
 #include <cstddef>
 #include <cstring>
+#include <ctime>
 #include <iostream>
+#include <limits>
 #include <memory>
+#include <unordered_map>
+#include <vector>
 
-// Networking stuff
-#include <cerrno>
-#include <sys/socket.h>
-#include <unistd.h>
-
+#include "anomaly_detector.hpp"
 #include "dry_no_more_server.hpp"
-#include "networking.hpp"
+#include "settings_delta.hpp"
+#include "telegram_bot_utils.hpp"
+#include "trace.hpp"
+
+namespace asio = boost::asio;
+using asio::awaitable;
+using asio::use_awaitable;
+using asio::ip::tcp;
+using asio::ip::udp;
 
 // #define DEBUG_PRINTS
 
-#ifdef DEBUG_PRINTS
-// Taken from here: https://stackoverflow.com/a/18822888
-class IosFlagSaver {
+static WakeSchedule computeWakeSchedule(const WakeScheduleConfig &conf,
+                                        uint32_t deviceId) {
+  WakeSchedule schedule;
+  const std::time_t now = std::time(nullptr);
+  schedule.serverTime = static_cast<uint32_t>(now);
+  schedule.nextWakeSec = 0;
+  schedule.periodSec = conf.periodSec;
+
+  if (conf.periodSec == 0) {
+    return schedule;
+  }
+
+  std::tm localMidnight;
+  localtime_r(&now, &localMidnight);
+  localMidnight.tm_hour = 0;
+  localMidnight.tm_min = 0;
+  localMidnight.tm_sec = 0;
+  const std::time_t midnight = std::mktime(&localMidnight);
+
+  // deterministic per device offset to spread the server load
+  const uint32_t spreadOffset =
+      conf.spreadSec != 0 ? (deviceId * UINT32_C(2654435761)) % conf.spreadSec
+                          : 0;
+
+  const int64_t period = conf.periodSec;
+  int64_t sinceAnchor = static_cast<int64_t>(now - midnight) -
+                        conf.anchorSec - spreadOffset;
+  sinceAnchor = ((sinceAnchor % period) + period) % period;
+
+  int64_t nextWake = period - sinceAnchor;
+  // The controller woke up a bit too early, i.e. due to watchdog drift ->
+  // skip to the following slot instead of waking up again right away
+  if (nextWake < period / 2) {
+    nextWake += period;
+  }
+
+  schedule.nextWakeSec = static_cast<uint32_t>(
+      std::min<int64_t>(nextWake, std::numeric_limits<uint32_t>::max()));
+  return schedule;
+}
+
+// TODO use config?
+#define BUF_SIZE 1024
+#define CLIENT_TIMEOUT std::chrono::seconds(1)
+// The rest of a split SettingsRequest follows within this wait, controllers
+// predating it send the type byte alone and wait seconds for the reply
+#define LEGACY_REQUEST_WAIT std::chrono::milliseconds(200)
+// Datagrams with the seq of the previous one are retransmissions within this
+// window, afterwards the seq counter of the controller may have wrapped
+#define UDP_DUPLICATE_WINDOW std::chrono::seconds(30)
+#define MAX_UDP_SESSIONS 256
+
+// State of the status server that outlives a connection
+struct ServerState {
+  explicit ServerState(const RuntimeConfig &config)
+      : irrigationTuner(config.tuning, config.wakeSchedule.periodSec),
+        batteryMonitor(config.battery) {}
+
+  SettingsHistory settingsHistory;
+  AnomalyDetector anomalyDetector;
+  IrrigationTuner irrigationTuner;
+  BatteryMonitor batteryMonitor;
+};
+
+// Connection to a controller. A controller that stops talking is dropped
+// after CLIENT_TIMEOUT, without blocking the other connections.
+class ClientConnection {
 public:
-  explicit IosFlagSaver(std::ostream &_ios) : ios(_ios), f(_ios.flags()) {}
-  ~IosFlagSaver() { ios.flags(f); }
+  ClientConnection(tcp::socket &&socket, uint32_t id)
+      : id(id), socket(std::move(socket)), timer(this->socket.get_executor()) {
+    Trace::event(Trace::ACCEPT, id);
+  }
+  ~ClientConnection() { Trace::event(Trace::CLOSE, id); }
+
+  uint32_t deviceId() const {
+    boost::system::error_code ec;
+    const auto remote = socket.remote_endpoint(ec);
+    return !ec && remote.address().is_v4() ? remote.address().to_v4().to_uint()
+                                           : 0;
+  }
+
+  // Returns 0 if the connection was closed, timed out or failed. Sets
+  // timedOut to tell a silent but open connection from the others.
+  awaitable<size_t> read(uint8_t *buf, size_t size,
+                         std::chrono::steady_clock::duration timeout =
+                             CLIENT_TIMEOUT,
+                         bool *timedOut = nullptr) {
+    armTimeout(timeout);
+    boost::system::error_code ec;
+    const size_t res = co_await socket.async_read_some(
+        asio::buffer(buf, size), asio::redirect_error(use_awaitable, ec));
+    timer.cancel();
+    Trace::event(Trace::READ, id, ec ? 0 : res);
+    if (timedOut) {
+      *timedOut = expired;
+    }
+
+    if (ec && ec != asio::error::eof &&
+        ec != asio::error::operation_aborted) {
+      std::cerr << "DryNoMore status server: failed to receive request from "
+                   "client: "
+                << ec.message() << std::endl;
+    }
+    co_return ec ? 0 : res;
+  }
+
+  awaitable<bool> write(const uint8_t *data, size_t size) {
+    armTimeout();
+    boost::system::error_code ec;
+    co_await asio::async_write(socket, asio::buffer(data, size),
+                               asio::redirect_error(use_awaitable, ec));
+    timer.cancel();
+    Trace::event(Trace::REPLY, id, ec ? 0 : size);
+
+    if (ec) {
+      std::cerr << "DryNoMore status server: writing settings failed: "
+                << ec.message() << std::endl;
+      co_return false;
+    }
+    co_return true;
+  }
 
-  IosFlagSaver(const IosFlagSaver &rhs) = delete;
-  IosFlagSaver &operator=(const IosFlagSaver &rhs) = delete;
+  // numbers the connections for the trace
+  const uint32_t id;
 
 private:
-  std::ostream &ios;
-  std::ios::fmtflags f;
+  void armTimeout(std::chrono::steady_clock::duration timeout =
+                      CLIENT_TIMEOUT) {
+    expired = false;
+    timer.expires_after(timeout);
+    timer.async_wait([this](boost::system::error_code ec) {
+      if (!ec) {
+        expired = true;
+        socket.cancel();
+      }
+    });
+  }
+
+  tcp::socket socket;
+  asio::steady_timer timer;
+  bool expired = false;
 };
+
+// Controllers predating the per plant failures treat hardwareFailureBitmap as
+// a single flag of the whole controller
+static void toLegacySettings(Settings &settings) {
+  bool failure = false;
+  for (auto &bm : settings.hardwareFailureBitmap) {
+    failure |= bm != 0;
+    bm = 0;
+  }
+  settings.hardwareFailureBitmap[0] = failure ? 1 : 0;
+}
+
+static void fromLegacySettings(Settings &settings) {
+  const bool failure = settings.hardwareFailureBitmap[0] != 0;
+  for (auto &bm : settings.hardwareFailureBitmap) {
+    bm = failure ? 0xFF : 0;
+  }
+}
+
+// Adopts the settings sent by a controller after SETTINGS_UNKNOWN
+static void storeSettings(const uint8_t *data, size_t size,
+                          StateWrapper &state, SettingsHistory &history,
+                          uint32_t traceId, bool legacy = false) {
+  if (size == sizeof(Settings)) {
+    Settings settings;
+    std::memcpy(reinterpret_cast<void *>(&settings),
+                reinterpret_cast<const void *>(data), sizeof(settings));
+    if (legacy) {
+      fromLegacySettings(settings);
+    }
+    history.remember(settingsHash(settings), settings);
+    state.settings.publish(settings);
+    Trace::event(Trace::STATE_UPDATE, traceId, REQUEST_SETTINGS);
+  } else {
+    std::cerr << "Unexpected Settings packet size of " << size
+              << " instead of " << (sizeof(Settings)) << std::endl;
+  }
+}
+
+static awaitable<void> receiveSettings(uint8_t *buf, StateWrapper &state,
+                                       SettingsHistory &history,
+                                       ClientConnection &client,
+                                       size_t bufSize, bool legacy = false) {
+  const size_t readSize = co_await client.read(buf, bufSize);
+  storeSettings(buf, readSize, state, history, client.id, legacy);
+}
+
+// Requests without SettingsRequest come from controllers predating the delta
+// synchronisation. They get the plain settings or a single byte, as they
+// check the size of the reply, and know no wake schedule.
+static awaitable<void>
+handleLegacySettingsRequest(uint8_t *buf, StateWrapper &state,
+                            SettingsHistory &history, ClientConnection &client,
+                            size_t bufSize) {
+  if (const auto settings = state.settings.load()) {
+    // send current settings!
+    Settings legacy = settings->value;
+    toLegacySettings(legacy);
+    co_await client.write(reinterpret_cast<const uint8_t *>(&legacy),
+                          sizeof(legacy));
+  } else {
+    // send dummy response as indication that we want to receive the
+    // settings ourselves!
+    const uint8_t response = 42;
+    if (co_await client.write(&response, sizeof(response))) {
+      co_await receiveSettings(buf, state, history, client, bufSize, true);
+    }
+  }
+}
+
+// Answers a SettingsRequest with a SettingsReply, followed by the settings or
+// a delta if the controller is outdated
+static SettingsReplyType buildSettingsReply(const SettingsRequest &request,
+                                            StateWrapper &state,
+                                            SettingsHistory &history,
+                                            const WakeSchedule &schedule,
+                                            std::vector<uint8_t> &response) {
+  SettingsReply reply;
+  reply.schedule = schedule;
+
+  // The snapshot stays valid without holding any lock while writing
+  const auto settings = state.settings.load();
+  if (!settings) {
+    // We have no settings yet, receive them from the MCU
+    reply.type = SETTINGS_UNKNOWN;
+    reply.settingsHash = request.settingsHash;
+  } else {
+    const Settings &current = settings->value;
+    reply.settingsHash = settingsHash(current);
+    history.remember(reply.settingsHash, current);
+
+    if (request.settingsHash == reply.settingsHash) {
+      reply.type = SETTINGS_UNCHANGED;
+    } else {
+      if (const Settings *base = history.find(request.settingsHash)) {
+        encodeSettingsDelta(*base, current, response);
+      }
+      if (!response.empty() && response.size() < sizeof(Settings)) {
+        reply.type = SETTINGS_DELTA;
+      } else {
+        reply.type = SETTINGS_FULL;
+        const uint8_t *bytes = reinterpret_cast<const uint8_t *>(&current);
+        response.assign(bytes, bytes + sizeof(current));
+      }
+    }
+  }
+
+  reply.payloadSize = static_cast<uint16_t>(response.size());
+  const uint8_t *replyBytes = reinterpret_cast<const uint8_t *>(&reply);
+  response.insert(response.begin(), replyBytes, replyBytes + sizeof(reply));
+
+#ifdef DEBUG_PRINTS
+  std::cout << "Settings reply type " << static_cast<unsigned>(reply.type)
+            << " with " << response.size() << " bytes" << std::endl;
 #endif
+  return static_cast<SettingsReplyType>(reply.type);
+}
+
+static awaitable<void>
+handleSettingsRequest(uint8_t *buf, StateWrapper &state,
+                      SettingsHistory &history, ClientConnection &client,
+                      const WakeSchedule &schedule, size_t readSize,
+                      size_t bufSize) {
+  if (readSize != 1 + sizeof(SettingsRequest)) {
+    co_await handleLegacySettingsRequest(buf, state, history, client, bufSize);
+    co_return;
+  }
+
+  SettingsRequest request;
+  std::memcpy(&request, buf + 1, sizeof(request));
+
+  std::vector<uint8_t> response;
+  const SettingsReplyType type =
+      buildSettingsReply(request, state, history, schedule, response);
+  if (co_await client.write(response.data(), response.size()) &&
+      type == SETTINGS_UNKNOWN) {
+    co_await receiveSettings(buf, state, history, client, bufSize);
+  }
+}
+
+// Runs the anomaly detection on every report and disables the irrigation of
+// plants with failing sensors or pumps
+static void checkAnomalies(ServerState &server, StateWrapper &state,
+                           MessageQueue &msgQueue, const Status &status,
+                           uint32_t deviceId) {
+  const auto settings = state.settings.load();
+  const auto anomalies = server.anomalyDetector.analyze(
+      deviceId, status, settings ? &settings->value : nullptr);
+
+  for (const auto &anomaly : anomalies) {
+    if (anomaly.isFailure) {
+      state.settings.update([&anomaly](Settings &settings) {
+        setHardwareFailure(settings, anomaly.idx, true);
+        return true;
+      });
+    }
+    msgQueue.push(Message(anomaly.describe(),
+                          anomaly.isFailure ? Message::FAILURE_MSG
+                                            : Message::WARN_MSG,
+                          deviceId));
+  }
+}
+
+// Trends the supply voltage of the controller and warns ahead of an empty
+// battery
+static void checkBattery(ServerState &server, MessageQueue &msgQueue,
+                         const Status &status, uint32_t deviceId) {
+  const std::time_t now = std::time(nullptr);
+  BatteryForecast forecast;
+  if (server.batteryMonitor.record(deviceId, status.supplyMilliVolt, now,
+                                   forecast)) {
+    msgQueue.push(
+        Message(forecast.describe(now), Message::WARN_MSG, deviceId));
+  }
+}
+
+// Learns the irrigation parameters of the plants and proposes or applies
+// better ones
+static void tuneIrrigation(ServerState &server, StateWrapper &state,
+                           MessageQueue &msgQueue, const Status &status) {
+  const auto settings = state.settings.load();
+  Settings proposal;
+  if (!settings) {
+    return;
+  }
+  if (!server.irrigationTuner.learn(status, settings->value,
+                                    std::time(nullptr), proposal)) {
+    return;
+  }
+
+  const std::string table = generateTuningTable(settings->value, proposal);
+  switch (server.irrigationTuner.config().mode) {
+    case IrrigationTuningConfig::OFF: {
+      break;
+    }
+    case IrrigationTuningConfig::PROPOSE: {
+      msgQueue.push(Message("Proposed irrigation settings, apply them with "
+                            "/edit:\n" +
+                                table,
+                            Message::INFO_MSG));
+      break;
+    }
+    case IrrigationTuningConfig::AUTO: {
+      // The proposal is based on the settings loaded above, they may have
+      // been edited since. Tune the latest settings again so that no edit is
+      // reverted.
+      const IrrigationTuner &tuner = server.irrigationTuner;
+      std::string applied;
+      if (state.settings.update([&tuner, &applied](Settings &settings) {
+            const Settings latest = settings;
+            if (!tuner.retune(settings)) {
+              return false;
+            }
+            applied = generateTuningTable(latest, settings);
+            return true;
+          })) {
+        msgQueue.push(
+            Message("Applied tuned irrigation settings:\n" + applied,
+                    Message::INFO_MSG));
+      }
+      break;
+    }
+  }
+}
+
+// Only issue a status update iff the moisture of at least one plant changed or
+// we are in debug mode!
+static void publishStatusIfChanged(StateWrapper &state, const Status &status) {
+  bool changed = false;
+  if (auto settings = state.settings.load()) {
+    changed = settings->value.debug;
+  }
+  const uint8_t numPlants = std::min(
+      status.numPlants, static_cast<uint8_t>(MAX_MOISTURE_SENSOR_COUNT));
+  for (uint8_t i = 0; !changed && i < numPlants; ++i) {
+    changed = status.beforeMoistureLevels[i] < status.afterMoistureLevels[i];
+  }
+  if (changed) {
+    state.status.publish(status);
+  }
+}
+
+// Status packets of controllers predating REPORT_STATUS_V2 end with the number
+// of water sensors
+#define LEGACY_STATUS_SIZE offsetof(Status, cycleStartTime)
+
+static bool isBitSet(const uint8_t *bitmap, uint8_t idx) {
+  return ((bitmap[idx / 8] >> (idx & 7 /*aka mod 8*/)) & 0x01) != 0;
+}
+
+// Expands a sparse REPORT_STATUS_V2 packet into a Status, the percentages are
+// derived from the raw readings using the current settings.
+static bool expandStatusV2(const uint8_t *data, int size, StateWrapper &state,
+                           Status &status) {
+  StatusHeaderV2 header;
+  if (size < static_cast<int>(sizeof(header))) {
+    std::cerr << "Unexpected StatusV2 packet size of " << size << std::endl;
+    return false;
+  }
+  std::memcpy(&header, data, sizeof(header));
+  const uint8_t *end = data + size;
+  const uint8_t *pos = data + sizeof(header);
+
+  if (header.numPlants > MAX_MOISTURE_SENSOR_COUNT ||
+      header.numWaterSensors > MAX_WATER_SENSOR_COUNT ||
+      end - pos < header.numPlants) {
+    std::cerr << "Invalid StatusV2 header: " << +header.numPlants
+              << " plants, " << +header.numWaterSensors << " water sensors"
+              << std::endl;
+    return false;
+  }
+
+  std::memset(&status, 0, sizeof(status));
+  status.numPlants = header.numPlants;
+  status.numWaterSensors = header.numWaterSensors;
+  status.cycleStartTime = header.cycleStartTime;
+  status.supplyMilliVolt = header.supplyMilliVolt;
+  std::fill(std::begin(status.ticksSinceIrrigation),
+            std::end(status.ticksSinceIrrigation), 255);
+  std::copy(pos, pos + header.numPlants, status.ticksSinceIrrigation);
+  pos += header.numPlants;
+
+  const auto settingsPtr = state.settings.load();
+  auto toPercentage = [&](uint8_t confIdx, uint16_t raw) -> uint8_t {
+    if (raw == UNDEFINED_LEVEL_16 || !settingsPtr) {
+      return UNDEFINED_LEVEL_8;
+    }
+    const SensConfig &conf = settingsPtr->value.sensConfs[confIdx];
+    return rawToPercentage(raw, conf.minValue, conf.maxValue);
+  };
+  // Consumes the next reading iff the sensor was measured, returns false if
+  // the packet is truncated
+  auto nextReading = [&](const uint8_t *bitmap, uint8_t idx, uint8_t count,
+                         auto &reading) {
+    if (idx >= count || !isBitSet(bitmap, idx)) {
+      return true;
+    }
+    if (end - pos < static_cast<std::ptrdiff_t>(sizeof(reading))) {
+      std::cerr << "StatusV2 packet is truncated!" << std::endl;
+      return false;
+    }
+    std::memcpy(&reading, pos, sizeof(reading));
+    pos += sizeof(reading);
+    return true;
+  };
+
+  for (uint8_t i = 0; i < MAX_WATER_SENSOR_COUNT; ++i) {
+    RawReading reading{UNDEFINED_LEVEL_16, UNDEFINED_LEVEL_16};
+    if (!nextReading(header.measuredTanks, i, header.numWaterSensors,
+                     reading)) {
+      return false;
+    }
+    const uint8_t confIdx = (MAX_MOISTURE_SENSOR_COUNT) + i;
+    status.beforeWaterLevelsRaw[i] = reading.before;
+    status.afterWaterLevelsRaw[i] = reading.after;
+    status.beforeWaterLevels[i] = toPercentage(confIdx, reading.before);
+    status.afterWaterLevels[i] = toPercentage(confIdx, reading.after);
+  }
+  for (uint8_t i = 0; i < MAX_MOISTURE_SENSOR_COUNT; ++i) {
+    PlantReading reading{{UNDEFINED_LEVEL_16, UNDEFINED_LEVEL_16},
+                         UNDEFINED_LEVEL_8};
+    if (!nextReading(header.measuredPlants, i, header.numPlants, reading)) {
+      return false;
+    }
+    status.beforeMoistureLevelsRaw[i] = reading.moisture.before;
+    status.afterMoistureLevelsRaw[i] = reading.moisture.after;
+    status.beforeMoistureLevels[i] = toPercentage(i, reading.moisture.before);
+    status.afterMoistureLevels[i] = toPercentage(i, reading.moisture.after);
+    status.bursts[i] = reading.bursts;
+  }
+  return true;
+}
+
+static Message eventToMessage(const Event &event) {
+  const std::string arg = std::to_string(event.arg + 1);
+  switch (static_cast<EventCode>(event.code)) {
+    case EVT_WATER_LOW:
+      return Message("running low on water at water level sensor W" + arg +
+                         "!",
+                     Message::WARN_MSG);
+    case EVT_WATER_EMPTY:
+      return Message("water reservoir W" + arg + " is empty!",
+                     Message::ERR_MSG);
+    case EVT_IRRIGATION_TIMEOUT:
+      return Message("irrigation timed out, assuming a hardware failure at "
+                     "either the moisture sensor P" +
+                         arg + " or its pump!",
+                     Message::FAILURE_MSG);
+  }
+  return Message("unknown event " + std::to_string(event.code) +
+                     " with argument " + std::to_string(event.arg),
+                 Message::WARN_MSG);
+}
+
+static void processEvents(const uint8_t *data, int size, StateWrapper &state,
+                          MessageQueue &msgQueue, uint32_t deviceId) {
+  if (size < 1 || size - 1 < data[0] * static_cast<int>(sizeof(Event))) {
+    std::cerr << "Unexpected Event packet size of " << size << std::endl;
+    return;
+  }
+  const uint8_t count = data[0];
+  for (uint8_t i = 0; i < count; ++i) {
+    Event event;
+    std::memcpy(&event, data + 1 + i * sizeof(Event), sizeof(event));
+    if (event.code == EVT_IRRIGATION_TIMEOUT &&
+        event.arg < MAX_MOISTURE_SENSOR_COUNT) {
+      // Mirror the failure flag the controller set for this plant
+      state.settings.update([&event](Settings &settings) {
+        setHardwareFailure(settings, event.arg, true);
+        return true;
+      });
+    }
+    Message msg = eventToMessage(event);
+    msg.deviceId = deviceId;
+    msgQueue.push(std::move(msg));
+  }
+}
+
+// Size of the first packet of the received bytes as the controller sends its
+// reports back to back. Returns 0 if the packet is incomplete. Packets without
+// a size extend to the end of the received bytes.
+static size_t packetSize(const uint8_t *data, size_t size) {
+  switch (static_cast<PacketType>(data[0])) {
+    case REQUEST_SETTINGS: {
+      // a legacy request without SettingsRequest is told apart by the
+      // transport
+      const size_t expected = 1 + sizeof(SettingsRequest);
+      return size >= expected ? expected : 0;
+    }
+    case REPORT_STATUS: {
+      const size_t expected = LEGACY_STATUS_SIZE + 1;
+      return size >= expected ? expected : 0;
+    }
+    case REPORT_STATUS_V2: {
+      StatusHeaderV2 header;
+      if (size < 1 + sizeof(header)) {
+        return 0;
+      }
+      std::memcpy(&header, data + 1, sizeof(header));
+      if (header.numPlants > MAX_MOISTURE_SENSOR_COUNT ||
+          header.numWaterSensors > MAX_WATER_SENSOR_COUNT) {
+        // rejected by expandStatusV2()
+        return size;
+      }
+      size_t expected = 1 + sizeof(header) + header.numPlants;
+      for (uint8_t i = 0; i < header.numWaterSensors; ++i) {
+        if (isBitSet(header.measuredTanks, i)) {
+          expected += sizeof(RawReading);
+        }
+      }
+      for (uint8_t i = 0; i < header.numPlants; ++i) {
+        if (isBitSet(header.measuredPlants, i)) {
+          expected += sizeof(PlantReading);
+        }
+      }
+      return size >= expected ? expected : 0;
+    }
+    case EVENT_MSG: {
+      if (size < 2) {
+        return 0;
+      }
+      const size_t expected = 2 + data[1] * sizeof(Event);
+      return size >= expected ? expected : 0;
+    }
+    default:
+      return size;
+  }
+}
 
-static void processDryNoMoreRequest(std::unique_ptr<uint8_t[]> &buf,
-                                    StateWrapper &state,
-                                    ts_queue<Message> &msgQueue, int client_fd,
-                                    int readSize, int bufSize) {
+// Handles the packets that do not need a reply, shared by both transports
+static void processReport(const uint8_t *buf, size_t readSize,
+                          StateWrapper &state, ServerState &server,
+                          MessageQueue &msgQueue, uint32_t deviceId,
+                          uint32_t traceId) {
   switch (static_cast<PacketType>(buf[0])) {
     case FAILURE_MSG: {
-      {
-        // Set the hardware failure flag!
-        std::scoped_lock lock(state.settingsWrap.mut);
-        state.settingsWrap.settings.hardwareFailure = true;
-      }
+      // Legacy controllers do not name the plant, stop all of them!
+      state.settings.update([](Settings &settings) {
+        for (auto &bm : settings.hardwareFailureBitmap) {
+          bm = 0xFF;
+        }
+        return true;
+      });
       // Intentional fall through to also send the failure message!
     } /* fall through */
     case INFO_MSG:
@@ -47,8 +615,8 @@ static void processDryNoMoreRequest(std::unique_ptr<uint8_t[]> &buf,
     case ERR_MSG: {
       // forward as telegram msg
       Message::MessageType msgType = static_cast<Message::MessageType>(buf[0]);
-      std::string str(reinterpret_cast<char *>(buf.get() + 1), readSize - 1);
-      msgQueue.push(Message(std::move(str), msgType));
+      std::string str(reinterpret_cast<const char *>(buf + 1), readSize - 1);
+      msgQueue.push(Message(std::move(str), msgType, deviceId));
 
 #ifdef DEBUG_PRINTS
       std::cout << "Received *_MSG request." << std::endl;
@@ -57,152 +625,398 @@ static void processDryNoMoreRequest(std::unique_ptr<uint8_t[]> &buf,
 #endif
       break;
     }
+    case EVENT_MSG: {
+#ifdef DEBUG_PRINTS
+      std::cout << "Received EVENT_MSG request." << std::endl;
+#endif
+      processEvents(buf + 1, readSize - 1, state, msgQueue, deviceId);
+      break;
+    }
     case REPORT_STATUS: {
 #ifdef DEBUG_PRINTS
       std::cout << "Received REPORT_STATUS request." << std::endl;
 #endif
-      if (readSize == sizeof(Status) + 1) {
-        // Only issue a status update iff the moisture of at least one plant
-        // changed or we are in debug mode!
-        bool changed;
-        {
-          std::scoped_lock lock(state.settingsWrap.mut);
-          changed =
-              state.settingsWrap.valid && state.settingsWrap.settings.debug;
-        }
-        if (!changed) {
-          uint8_t numPlants =
-              std::min(*(buf.get() + 1 + offsetof(Status, numPlants)),
-                       static_cast<uint8_t>(MAX_MOISTURE_SENSOR_COUNT));
-          const uint8_t *moistBefore =
-              buf.get() + 1 + offsetof(Status, beforeMoistureLevels);
-          const uint8_t *moistAfter =
-              buf.get() + 1 + offsetof(Status, afterMoistureLevels);
-          for (uint8_t i = 0; i < numPlants; ++i) {
-            if (moistBefore[i] < moistAfter[i]) {
-              changed = true;
-              break;
-            }
-          }
-        }
-        if (changed) {
-          std::scoped_lock lock(state.statusWrap.mut);
-          state.statusWrap.unpublished = true;
-          std::memcpy(reinterpret_cast<void *>(&state.statusWrap.status),
-                      reinterpret_cast<const void *>(buf.get() + 1),
-                      sizeof(state.statusWrap.status));
-        }
+      if (readSize == LEGACY_STATUS_SIZE + 1) {
+        Status status;
+        std::memcpy(reinterpret_cast<void *>(&status),
+                    reinterpret_cast<const void *>(buf + 1),
+                    LEGACY_STATUS_SIZE);
+        status.cycleStartTime = 0;
+        std::fill(std::begin(status.bursts), std::end(status.bursts),
+                  UNDEFINED_LEVEL_8);
+        status.supplyMilliVolt = 0;
+        state.history.record(status, std::time(nullptr));
+        checkAnomalies(server, state, msgQueue, status, deviceId);
+        publishStatusIfChanged(state, status);
+        Trace::event(Trace::STATE_UPDATE, traceId, REPORT_STATUS);
       } else {
         std::cerr << "Unexpected Status packet size of " << readSize
-                  << " instead of " << (sizeof(Status) + 1) << std::endl;
+                  << " instead of " << (LEGACY_STATUS_SIZE + 1) << std::endl;
       }
 
       break;
     }
-    case REQUEST_SETTINGS: {
+    case REPORT_STATUS_V2: {
 #ifdef DEBUG_PRINTS
-      std::cout << "Received REQUEST_SETTINGS request." << std::endl;
+      std::cout << "Received REPORT_STATUS_V2 request." << std::endl;
 #endif
-      std::unique_lock lock(state.settingsWrap.mut);
-      if (state.settingsWrap.valid) {
-        // send current settings!
-        int res =
-            write(client_fd,
-                  reinterpret_cast<const void *>(&state.settingsWrap.settings),
-                  sizeof(state.settingsWrap.settings));
-        if (res <= 0) {
-          std::cerr << "DryNoMore status server: writing settings failed: ";
-          printErrno();
-        } else if (res != sizeof(state.settingsWrap.settings)) {
-          std::cerr << "DryNoMore status server: WARNING written only " << res
-                    << "/" << sizeof(state.settingsWrap.settings)
-                    << " of the settings bytes!" << std::endl;
-#ifdef DEBUG_PRINTS
-        } else {
-          std::cout << "Successfully sent settings! Bytes:" << std::endl;
-          IosFlagSaver s(std::cout);
-          for (unsigned i = 0; i < sizeof(state.settingsWrap.settings); ++i) {
-            std::cout << "  " << std::hex
-                      << static_cast<unsigned>(
-                             reinterpret_cast<const uint8_t *>(
-                                 &state.settingsWrap.settings)[i])
-                      << std::endl;
-          }
-#endif
-        }
-      } else {
-        // We have no settings yet! -> unlock
-        lock.unlock();
+      Status status;
+      if (expandStatusV2(buf + 1, readSize - 1, state, status)) {
+        state.history.record(status, std::time(nullptr));
+        checkAnomalies(server, state, msgQueue, status, deviceId);
+        checkBattery(server, msgQueue, status, deviceId);
+        tuneIrrigation(server, state, msgQueue, status);
+        publishStatusIfChanged(state, status);
+        Trace::event(Trace::STATE_UPDATE, traceId, REPORT_STATUS_V2);
+      }
+      break;
+    }
+    case REQUEST_SETTINGS: {
+      // answered by the transport
+      break;
+    }
+  }
+}
+
+static awaitable<void>
+processDryNoMoreRequest(uint8_t *buf, StateWrapper &state, ServerState &server,
+                        MessageQueue &msgQueue, ClientConnection &client,
+                        const WakeSchedule &schedule, size_t readSize,
+                        size_t bufSize) {
+  Trace::event(Trace::PARSE, client.id, buf[0]);
+  if (buf[0] == REQUEST_SETTINGS) {
 #ifdef DEBUG_PRINTS
-        std::cout << "Settings are not valid, try receiving them from the MCU."
-                  << std::endl;
+    std::cout << "Received REQUEST_SETTINGS request." << std::endl;
 #endif
-        // send dummy response as indication that we want to receive the
-        // settings ourselves!
-        uint8_t dummyData = 42;
-        int res = write(client_fd, reinterpret_cast<const void *>(&dummyData),
-                        sizeof(dummyData));
-        if (res <= 0) {
-          std::cerr << "DryNoMore status server: dummy write failed: ";
-          printErrno();
-          return;
-        }
+    co_await handleSettingsRequest(buf, state, server.settingsHistory, client,
+                                   schedule, readSize, bufSize);
+  } else {
+    processReport(buf, readSize, state, server, msgQueue, client.deviceId(),
+                  client.id);
+  }
+}
 
-        // receive currently used settings
-        readSize =
-            read(client_fd, reinterpret_cast<void *>(buf.get()), bufSize);
-
-        if (readSize == sizeof(Settings)) {
-          lock.lock();
-          state.settingsWrap.valid = true;
-          std::memcpy(reinterpret_cast<void *>(&state.settingsWrap.settings),
-                      reinterpret_cast<const void *>(buf.get()),
-                      sizeof(state.settingsWrap.settings));
-        } else {
-          std::cerr << "Unexpected Settings packet size of " << readSize
-                    << " instead of " << (sizeof(Settings)) << std::endl;
-        }
-      }
+// Last datagram of a controller, a retransmission is answered with the same
+// reply without processing its packets again
+struct UdpSession {
+  uint8_t seq;
+  std::chrono::steady_clock::time_point received;
+  std::vector<uint8_t> reply;
+};
+
+struct DryNoMoreStatusServer::Impl {
+  Impl(asio::io_context &io, StateWrapper &state, MessageQueue &msgQueue)
+      : io(io), state(state), msgQueue(msgQueue),
+        config(state.config.load()), server(config->value),
+        tcpPort(config->value.tcpPort) {}
+
+  awaitable<void> serveClient(tcp::socket socket);
+  awaitable<void> acceptClients(std::shared_ptr<tcp::acceptor> acceptor);
+  std::shared_ptr<tcp::acceptor> listen(uint16_t port);
+  awaitable<void> receiveDatagrams(std::shared_ptr<udp::socket> socket);
+  std::vector<uint8_t> processDatagram(const UdpHeader &header,
+                                       const uint8_t *data, size_t size,
+                                       uint32_t deviceId, uint32_t traceId);
+  std::shared_ptr<udp::socket> bindUdp(uint16_t port);
+  void switchPort();
+
+  asio::io_context &io;
+  StateWrapper &state;
+  MessageQueue &msgQueue;
+  Snapshot<RuntimeConfig>::Ptr config;
+  ServerState server;
+  uint16_t tcpPort;
+  uint32_t connections = 0;
+  std::shared_ptr<tcp::acceptor> acceptor;
+  std::shared_ptr<udp::socket> udpSocket;
+  std::unordered_map<uint32_t, UdpSession> udpSessions;
+};
+
+awaitable<void> DryNoMoreStatusServer::Impl::serveClient(tcp::socket socket) {
+  ClientConnection client(std::move(socket), ++connections);
+  // the schedule is computed once per connection to reflect the time the
+  // controller woke up
+  const WakeSchedule schedule =
+      computeWakeSchedule(config->value.wakeSchedule, client.deviceId());
+  // every connection has its own buffer as they are served concurrently
+  std::unique_ptr<uint8_t[]> buf = std::make_unique<uint8_t[]>(BUF_SIZE);
+
+  size_t filled = 0;
+  while (true) {
+    // a REQUEST_SETTINGS type byte that nothing follows within
+    // LEGACY_REQUEST_WAIT comes from a controller predating SettingsRequest
+    const bool lonelyRequest = filled == 1 && buf[0] == REQUEST_SETTINGS;
+    bool timedOut = false;
+    const size_t res = co_await client.read(
+        buf.get() + filled, BUF_SIZE - 1 - filled,
+        lonelyRequest ? LEGACY_REQUEST_WAIT : CLIENT_TIMEOUT, &timedOut);
+    if (res == 0 && lonelyRequest && timedOut) {
+      co_await processDryNoMoreRequest(buf.get(), state, server, msgQueue,
+                                       client, schedule, filled, BUF_SIZE);
+      filled = 0;
+      continue;
+    }
+    if (res == 0) {
       break;
     }
+    filled += res;
+    buf[filled] = '\0';
+
+    size_t pos = 0;
+    for (size_t size; pos < filled &&
+                      (size = packetSize(buf.get() + pos, filled - pos)) != 0;
+         pos += size) {
+      co_await processDryNoMoreRequest(buf.get() + pos, state, server,
+                                       msgQueue, client, schedule, size,
+                                       BUF_SIZE - pos);
+    }
+
+    // keep the start of an incomplete packet for the next read
+    filled -= pos;
+    std::memmove(buf.get(), buf.get() + pos, filled);
+    if (filled == BUF_SIZE - 1) {
+      std::cerr << "Dropping " << filled << " bytes of an oversized packet"
+                << std::endl;
+      filled = 0;
+    }
+  }
+  if (filled != 0) {
+    std::cerr << "Dropping " << filled << " bytes of an incomplete packet"
+              << std::endl;
   }
 }
 
-void runDryNoMoreStatusServer(int fd, StateWrapper &state,
-                              ts_queue<Message> &msgQueue,
-                              const std::atomic<bool> &running) {
-// TODO use config?
-#define BUF_SIZE 1024
+awaitable<void> DryNoMoreStatusServer::Impl::acceptClients(
+    std::shared_ptr<tcp::acceptor> acceptor) {
+  while (acceptor->is_open()) {
+    boost::system::error_code ec;
+    tcp::socket socket = co_await acceptor->async_accept(
+        asio::redirect_error(use_awaitable, ec));
+    if (!ec) {
+      asio::co_spawn(io, serveClient(std::move(socket)), asio::detached);
+    } else if (ec != asio::error::operation_aborted) {
+      std::cerr << "DryNoMore status server: failed to accept client: "
+                << ec.message() << std::endl;
+    }
+  }
+}
 
-  std::unique_ptr<uint8_t[]> buf = std::make_unique<uint8_t[]>(BUF_SIZE);
+std::shared_ptr<tcp::acceptor>
+DryNoMoreStatusServer::Impl::listen(uint16_t port) {
+  auto next = std::make_shared<tcp::acceptor>(io);
+  const tcp::endpoint endpoint(tcp::v4(), port);
+  boost::system::error_code ec;
+  next->open(endpoint.protocol(), ec);
+  if (!ec) {
+    next->set_option(tcp::acceptor::reuse_address(true), ec);
+  }
+  if (!ec) {
+    next->bind(endpoint, ec);
+  }
+  if (!ec) {
+    next->listen(asio::socket_base::max_listen_connections, ec);
+  }
+  if (ec) {
+    std::cerr << "Failed to listen on tcp port " << port << ": "
+              << ec.message() << std::endl;
+    return nullptr;
+  }
 
-  for (int client_fd; running.load(std::memory_order_relaxed);) {
-    if ((client_fd = accept(fd, nullptr /*client address*/,
-                            nullptr /*client address storage size*/)) < 0) {
-      if (errno != EAGAIN /*&& errno != EWOULDBLOCK*/) {
-        std::cerr << "DryNoMore status server: failed to accept client: ";
-        printErrno();
-      }
+  asio::co_spawn(io, acceptClients(next), asio::detached);
+  return next;
+}
+
+// The reply starts with the UdpHeader of the request as acknowledgement
+std::vector<uint8_t> DryNoMoreStatusServer::Impl::processDatagram(
+    const UdpHeader &header, const uint8_t *data, size_t size,
+    uint32_t deviceId, uint32_t traceId) {
+  UdpHeader ack = header;
+  ack.flags = 0;
+  const uint8_t *ackBytes = reinterpret_cast<const uint8_t *>(&ack);
+  std::vector<uint8_t> reply(ackBytes, ackBytes + sizeof(ack));
+
+  if (header.flags & UDP_SETTINGS_UPLOAD) {
+    storeSettings(data, size, state, server.settingsHistory, traceId);
+    return reply;
+  }
+
+  for (size_t pos = 0, packet; pos < size; pos += packet) {
+    if ((packet = packetSize(data + pos, size - pos)) == 0) {
+      std::cerr << "Dropping " << (size - pos)
+                << " bytes of an incomplete packet in a datagram" << std::endl;
+      break;
+    }
+    Trace::event(Trace::PARSE, traceId, data[pos]);
+    if (data[pos] != REQUEST_SETTINGS) {
+      processReport(data + pos, packet, state, server, msgQueue, deviceId,
+                    traceId);
     } else {
-      for (int res = 0;
-           (res = read(client_fd, reinterpret_cast<void *>(buf.get()),
-                       BUF_SIZE - 1));) {
-
-        if (res < 0) {
-          std::cerr
-              << "DryNoMore status server: failed to receive request from "
-                 "client: ";
-          printErrno();
-          break;
-        } else {
-          buf[res] = '\0';
-        }
+      SettingsRequest request;
+      std::memcpy(&request, data + pos + 1, sizeof(request));
+      std::vector<uint8_t> response;
+      buildSettingsReply(
+          request, state, server.settingsHistory,
+          computeWakeSchedule(config->value.wakeSchedule, deviceId), response);
+      reply.insert(reply.end(), response.begin(), response.end());
+    }
+  }
+  return reply;
+}
 
-        processDryNoMoreRequest(buf, state, msgQueue, client_fd, res, BUF_SIZE);
+awaitable<void> DryNoMoreStatusServer::Impl::receiveDatagrams(
+    std::shared_ptr<udp::socket> socket) {
+  std::unique_ptr<uint8_t[]> buf = std::make_unique<uint8_t[]>(BUF_SIZE);
+  while (socket->is_open()) {
+    udp::endpoint sender;
+    boost::system::error_code ec;
+    const size_t size = co_await socket->async_receive_from(
+        asio::buffer(buf.get(), BUF_SIZE), sender,
+        asio::redirect_error(use_awaitable, ec));
+    if (ec) {
+      if (ec != asio::error::operation_aborted) {
+        std::cerr << "DryNoMore status server: failed to receive datagram: "
+                  << ec.message() << std::endl;
       }
+      continue;
+    }
+
+    const uint32_t id = ++connections;
+    Trace::event(Trace::ACCEPT, id);
+    Trace::event(Trace::READ, id, size);
+    UdpHeader header;
+    if (size < sizeof(header)) {
+      Trace::event(Trace::CLOSE, id);
+      continue;
+    }
+    std::memcpy(&header, buf.get(), sizeof(header));
+    const uint32_t deviceId =
+        sender.address().is_v4() ? sender.address().to_v4().to_uint() : 0;
+
+    const auto now = std::chrono::steady_clock::now();
+    auto [it, inserted] = udpSessions.try_emplace(deviceId);
+    UdpSession &session = it->second;
+    if (inserted || session.seq != header.seq ||
+        now - session.received > UDP_DUPLICATE_WINDOW) {
+      session.seq = header.seq;
+      session.received = now;
+      session.reply = processDatagram(header, buf.get() + sizeof(header),
+                                      size - sizeof(header), deviceId, id);
+    }
+    // the session might be gone once the reply was sent
+    const std::vector<uint8_t> reply = session.reply;
 
-      // Close the connection and release the file descriptor again!
-      close(client_fd);
+    if (udpSessions.size() > MAX_UDP_SESSIONS) {
+      std::erase_if(udpSessions, [now](const auto &entry) {
+        return now - entry.second.received > UDP_DUPLICATE_WINDOW;
+      });
     }
+
+    co_await socket->async_send_to(asio::buffer(reply), sender,
+                                   asio::redirect_error(use_awaitable, ec));
+    Trace::event(Trace::REPLY, id, ec ? 0 : reply.size());
+    Trace::event(Trace::CLOSE, id);
+    if (ec) {
+      std::cerr << "DryNoMore status server: failed to acknowledge datagram: "
+                << ec.message() << std::endl;
+    }
+  }
+}
+
+std::shared_ptr<udp::socket>
+DryNoMoreStatusServer::Impl::bindUdp(uint16_t port) {
+  auto next = std::make_shared<udp::socket>(io);
+  boost::system::error_code ec;
+  next->open(udp::v4(), ec);
+  if (!ec) {
+    next->bind(udp::endpoint(udp::v4(), port), ec);
+  }
+  if (ec) {
+    std::cerr << "Failed to bind udp port " << port << ": " << ec.message()
+              << std::endl;
+    return nullptr;
+  }
+
+  asio::co_spawn(io, receiveDatagrams(next), asio::detached);
+  return next;
+}
+
+// Binds the new port first, so the controllers can always connect. Clients
+// already waiting in the backlog of the old listener are still served.
+void DryNoMoreStatusServer::Impl::switchPort() {
+  auto next = listen(tcpPort);
+  if (!next) {
+    msgQueue.push(Message("Failed to listen on the new tcp port " +
+                              std::to_string(tcpPort) +
+                              ", keeping the old one!",
+                          Message::WARN_MSG));
+    return;
+  }
+
+  std::swap(acceptor, next);
+  if (next) {
+    next->non_blocking(true);
+    boost::system::error_code ec;
+    for (tcp::socket socket(io); next->accept(socket, ec), !ec;
+         socket = tcp::socket(io)) {
+      asio::co_spawn(io, serveClient(std::move(socket)), asio::detached);
+    }
+    next->close();
+  }
+
+  // Datagrams still queued at the old socket are retransmitted by the
+  // controllers
+  if (auto nextUdp = bindUdp(tcpPort)) {
+    std::swap(udpSocket, nextUdp);
+    if (nextUdp) {
+      nextUdp->close();
+    }
+  } else {
+    msgQueue.push(Message("Failed to bind the new udp port " +
+                              std::to_string(tcpPort) +
+                              ", keeping the old one!",
+                          Message::WARN_MSG));
+  }
+
+  msgQueue.push(Message("Status server now listens on tcp port " +
+                            std::to_string(tcpPort),
+                        Message::INFO_MSG));
+}
+
+DryNoMoreStatusServer::DryNoMoreStatusServer(asio::io_context &io,
+                                             StateWrapper &state,
+                                             MessageQueue &msgQueue)
+    : impl(std::make_unique<Impl>(io, state, msgQueue)) {}
+
+DryNoMoreStatusServer::~DryNoMoreStatusServer() = default;
+
+bool DryNoMoreStatusServer::start() {
+  impl->acceptor = impl->listen(impl->tcpPort);
+  impl->udpSocket = impl->bindUdp(impl->tcpPort);
+  return impl->acceptor != nullptr && impl->udpSocket != nullptr;
+}
+
+void DryNoMoreStatusServer::reconfigure() {
+  auto latest = impl->state.config.load();
+  if (latest == impl->config) {
+    return;
+  }
+  impl->config = std::move(latest);
+  const RuntimeConfig &config = impl->config->value;
+  impl->server.irrigationTuner.reconfigure(config.tuning,
+                                           config.wakeSchedule.periodSec);
+  impl->server.batteryMonitor.reconfigure(config.battery);
+  if (config.tcpPort != impl->tcpPort) {
+    // do not retry a failed port on every reload
+    impl->tcpPort = config.tcpPort;
+    impl->switchPort();
+  }
+}
+
+void DryNoMoreStatusServer::stop() {
+  if (impl->acceptor) {
+    impl->acceptor->close();
+  }
+  if (impl->udpSocket) {
+    impl->udpSocket->close();
   }
 }
@@ -0,0 +1,266 @@
+#include <algorithm>
+#include <cstring>
+#include <ctime>
+#include <filesystem>
+#include <iostream>
+#include <mutex>
+
+#include "history_store.hpp"
+
+// "DNMH" followed by the format version
+#define HISTORY_MAGIC 0x484D4E44
+#define HISTORY_VERSION 1
+// The file is not rewritten for less expired records
+#define MIN_COMPACT_RECORDS 1024
+
+PACKED_STRUCT_DEF(HistoryFileHeader, uint32_t magic; uint16_t version;
+                  uint16_t recordSize;);
+
+static bool operator<(const HistoryRecord &record, uint32_t time) {
+  return record.time < time;
+}
+static bool operator<(uint32_t time, const HistoryRecord &record) {
+  return time < record.time;
+}
+
+std::string HistoryStore::channelName(uint8_t channel) {
+  return (isTankChannel(channel) ? "W" : "P") +
+         std::to_string((channel & ~TANK_CHANNEL) + 1);
+}
+
+bool HistoryStore::isWatering(const HistoryRecord &record) {
+  if (isTankChannel(record.channel)) {
+    return false;
+  }
+  if (record.bursts != UNDEFINED_LEVEL_8) {
+    return record.bursts != 0;
+  }
+  return record.after != UNDEFINED_LEVEL_8 && record.after > record.before;
+}
+
+void HistoryStore::setMaxAge(uint32_t maxAgeSec) {
+  std::unique_lock lock(mutex);
+  this->maxAgeSec = maxAgeSec;
+}
+
+bool HistoryStore::open(const std::string &path) {
+  namespace fs = std::filesystem;
+
+  const HistoryFileHeader expected{HISTORY_MAGIC, HISTORY_VERSION,
+                                   sizeof(HistoryRecord)};
+  std::error_code ec;
+  if (fs::exists(path, ec)) {
+    std::ifstream in(path, std::ios::binary);
+    HistoryFileHeader header;
+    if (!in.read(reinterpret_cast<char *>(&header), sizeof(header)) ||
+        std::memcmp(&header, &expected, sizeof(header)) != 0) {
+      std::cerr << "History file " << path
+                << " has an unknown format, moving it to " << path << ".old"
+                << std::endl;
+      in.close();
+      fs::rename(path, path + ".old", ec);
+    } else {
+      std::unique_lock lock(mutex);
+      for (HistoryRecord record;
+           in.read(reinterpret_cast<char *>(&record), sizeof(record));) {
+        insert(record);
+        ++fileRecords;
+      }
+      // Drop a partially written record, e.g. due to a crash
+      const auto size = fs::file_size(path, ec);
+      if (!ec && (size - sizeof(header)) % sizeof(HistoryRecord) != 0) {
+        fs::resize_file(path,
+                        size - (size - sizeof(header)) % sizeof(HistoryRecord),
+                        ec);
+      }
+    }
+  }
+
+  std::unique_lock lock(mutex);
+  this->path = path;
+  const bool newFile = !fs::exists(path, ec);
+  file.open(path, std::ios::binary | std::ios::app);
+  if (!file) {
+    std::cerr << "Failed to open history file " << path << std::endl;
+    return false;
+  }
+  if (newFile) {
+    file.write(reinterpret_cast<const char *>(&expected), sizeof(expected));
+    file.flush();
+  }
+  expire(static_cast<uint32_t>(std::time(nullptr)));
+  if (fileRecords != recordCount) {
+    compact();
+  }
+  return true;
+}
+
+void HistoryStore::expire(uint32_t now) {
+  if (maxAgeSec == 0 || now <= maxAgeSec) {
+    return;
+  }
+  const uint32_t cutoff = now - maxAgeSec;
+  auto drop = [cutoff](std::vector<HistoryRecord> &records) {
+    const auto end = std::lower_bound(records.begin(), records.end(), cutoff);
+    const size_t dropped = end - records.begin();
+    records.erase(records.begin(), end);
+    return dropped;
+  };
+  for (auto it = channelRecords.begin(); it != channelRecords.end();) {
+    recordCount -= drop(it->second.records);
+    drop(it->second.waterings);
+    it = it->second.records.empty() ? channelRecords.erase(it) : std::next(it);
+  }
+}
+
+void HistoryStore::compact() {
+  namespace fs = std::filesystem;
+
+  // Written aside and renamed, a crash keeps either file intact
+  const std::string tmpPath = path + ".tmp";
+  std::ofstream out(tmpPath, std::ios::binary | std::ios::trunc);
+  const HistoryFileHeader header{HISTORY_MAGIC, HISTORY_VERSION,
+                                 sizeof(HistoryRecord)};
+  out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+  for (const auto &[channel, records] : channelRecords) {
+    out.write(reinterpret_cast<const char *>(records.records.data()),
+              records.records.size() * sizeof(HistoryRecord));
+  }
+  out.close();
+
+  std::error_code ec;
+  if (!out) {
+    std::cerr << "Failed to compact history file " << path << std::endl;
+    fs::remove(tmpPath, ec);
+    return;
+  }
+  file.close();
+  fs::rename(tmpPath, path, ec);
+  if (ec) {
+    std::cerr << "Failed to replace history file " << path << ": "
+              << ec.message() << std::endl;
+    fs::remove(tmpPath, ec);
+  } else {
+    fileRecords = recordCount;
+  }
+  file.open(path, std::ios::binary | std::ios::app);
+}
+
+void HistoryStore::insert(const HistoryRecord &record) {
+  auto &channel = channelRecords[record.channel];
+  // Usually an append, only a clock step causes an insertion
+  auto append = [&record](std::vector<HistoryRecord> &records) {
+    records.insert(
+        std::upper_bound(records.begin(), records.end(), record.time), record);
+  };
+  append(channel.records);
+  if (isWatering(record)) {
+    append(channel.waterings);
+  }
+  ++recordCount;
+}
+
+void HistoryStore::record(const Status &status, uint32_t time) {
+  std::vector<HistoryRecord> measured;
+
+  const uint8_t numPlants = std::min(
+      status.numPlants, static_cast<uint8_t>(MAX_MOISTURE_SENSOR_COUNT));
+  for (uint8_t i = 0; i < numPlants; ++i) {
+    if (status.beforeMoistureLevels[i] != UNDEFINED_LEVEL_8) {
+      measured.push_back(HistoryRecord{
+          time, plantChannel(i), status.beforeMoistureLevels[i],
+          status.afterMoistureLevels[i], status.beforeMoistureLevelsRaw[i],
+          status.afterMoistureLevelsRaw[i], status.bursts[i]});
+    }
+  }
+  const uint8_t numTanks = std::min(
+      status.numWaterSensors, static_cast<uint8_t>(MAX_WATER_SENSOR_COUNT));
+  for (uint8_t i = 0; i < numTanks; ++i) {
+    if (status.beforeWaterLevels[i] != UNDEFINED_LEVEL_8) {
+      measured.push_back(HistoryRecord{
+          time, tankChannel(i), status.beforeWaterLevels[i],
+          status.afterWaterLevels[i], status.beforeWaterLevelsRaw[i],
+          status.afterWaterLevelsRaw[i], UNDEFINED_LEVEL_8});
+    }
+  }
+
+  std::unique_lock lock(mutex);
+  for (const auto &record : measured) {
+    insert(record);
+  }
+  expire(time);
+  if (file.is_open() && !measured.empty()) {
+    file.write(reinterpret_cast<const char *>(measured.data()),
+               measured.size() * sizeof(HistoryRecord));
+    file.flush();
+    fileRecords += measured.size();
+    if (fileRecords >=
+        recordCount + std::max<size_t>(recordCount, MIN_COMPACT_RECORDS)) {
+      compact();
+    }
+  }
+}
+
+std::vector<HistoryRecord>
+HistoryStore::slice(const std::vector<HistoryRecord> &records, uint32_t from,
+                    uint32_t to) {
+  if (from > to) {
+    return {};
+  }
+  return std::vector<HistoryRecord>(
+      std::lower_bound(records.begin(), records.end(), from),
+      std::upper_bound(records.begin(), records.end(), to));
+}
+
+std::vector<HistoryRecord> HistoryStore::range(uint8_t channel, uint32_t from,
+                                               uint32_t to) const {
+  std::shared_lock lock(mutex);
+  auto it = channelRecords.find(channel);
+  return it == channelRecords.end() ? std::vector<HistoryRecord>()
+                                    : slice(it->second.records, from, to);
+}
+
+std::vector<HistoryRecord> HistoryStore::waterings(uint8_t channel,
+                                                   uint32_t from,
+                                                   uint32_t to) const {
+  std::shared_lock lock(mutex);
+  auto it = channelRecords.find(channel);
+  return it == channelRecords.end() ? std::vector<HistoryRecord>()
+                                    : slice(it->second.waterings, from, to);
+}
+
+bool HistoryStore::last(uint8_t channel, HistoryRecord &record) const {
+  std::shared_lock lock(mutex);
+  auto it = channelRecords.find(channel);
+  if (it == channelRecords.end() || it->second.records.empty()) {
+    return false;
+  }
+  record = it->second.records.back();
+  return true;
+}
+
+bool HistoryStore::lastWatering(uint8_t channel, HistoryRecord &record) const {
+  std::shared_lock lock(mutex);
+  auto it = channelRecords.find(channel);
+  if (it == channelRecords.end() || it->second.waterings.empty()) {
+    return false;
+  }
+  record = it->second.waterings.back();
+  return true;
+}
+
+uint32_t HistoryStore::lastTime(uint8_t channel) const {
+  HistoryRecord record;
+  return last(channel, record) ? record.time : 0;
+}
+
+std::vector<uint8_t> HistoryStore::channels() const {
+  std::shared_lock lock(mutex);
+  std::vector<uint8_t> result;
+  for (const auto &[channel, records] : channelRecords) {
+    if (!records.records.empty()) {
+      result.push_back(channel);
+    }
+  }
+  return result;
+}
@@ -0,0 +1,146 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "irrigation_tuner.hpp"
+
+// Firmware default if the server does not schedule the wake ups
+#define DEFAULT_WAKE_PERIOD_SEC (6 * 60 * 60)
+
+// Only propose a new value if it differs enough from the current one, this
+// avoids flip-flopping between neighbouring values due to noise
+static uint8_t withHysteresis(uint8_t current, long proposed) {
+  proposed = std::clamp<long>(proposed, 1, 255);
+  const long tolerance = std::max<long>(1, current / 5);
+  return std::abs(proposed - current) > tolerance
+             ? static_cast<uint8_t>(proposed)
+             : current;
+}
+
+void IrrigationTuner::observe(PlantModel &model, const Status &status,
+                              uint8_t idx, std::time_t now) {
+  const uint8_t before = status.beforeMoistureLevels[idx];
+  const uint8_t after = status.afterMoistureLevels[idx];
+  const uint8_t bursts = status.bursts[idx];
+
+  if (model.lastAfter != UNDEFINED_LEVEL_8 && now > model.lastTime) {
+    const double hours = (now - model.lastTime) / 3600.0;
+    const int delta = static_cast<int>(model.lastAfter) - before;
+    model.drying.add(std::max(delta, 0) / hours, conf.alpha);
+    if (model.lastBursts != 0) {
+      model.seepage.add(std::max(-delta, 0), conf.alpha);
+    }
+  }
+
+  if (bursts != UNDEFINED_LEVEL_8 && bursts != 0 &&
+      after != UNDEFINED_LEVEL_8) {
+    const int gain = static_cast<int>(after) - before;
+    model.gain.add(std::max(gain, 0) / static_cast<double>(bursts),
+                   conf.alpha);
+    model.afterIrrigation.add(after, conf.alpha);
+  }
+
+  model.lastAfter = after;
+  model.lastBursts = bursts == UNDEFINED_LEVEL_8 ? 0 : bursts;
+  model.lastTime = now;
+}
+
+bool IrrigationTuner::tune(const PlantModel &model, const Settings &settings,
+                           uint8_t idx, Settings &proposal) const {
+  if (model.drying.count() < conf.minSamples ||
+      model.gain.count() < conf.minSamples || model.gain.mean() < 0.5 ||
+      settings.burstDuration[idx] == 0) {
+    // not enough data, or the pump does not work which is up to the anomaly
+    // detection
+    return false;
+  }
+
+  const double periodHours =
+      (wakePeriodSec != 0 ? wakePeriodSec : DEFAULT_WAKE_PERIOD_SEC) / 3600.0;
+  const double dryingPerTick = model.drying.mean() * periodHours;
+  const uint8_t target = settings.targetMoisture[idx];
+
+  // Skip the wake ups until the plant is expected to fall below its target
+  uint8_t ticks = conf.maxTicksBetweenIrrigation;
+  if (dryingPerTick > 0.1) {
+    const double margin = model.afterIrrigation.mean() - target;
+    ticks = static_cast<uint8_t>(std::clamp<double>(
+        std::floor(margin / dryingPerTick), 0, conf.maxTicksBetweenIrrigation));
+  }
+
+  // Scale the burst length so that a single burst adds about gainPerBurst
+  const uint8_t duration = settings.burstDuration[idx];
+  const uint8_t newDuration = withHysteresis(
+      duration,
+      std::lround(duration * conf.gainPerBurst / model.gain.mean()));
+  const double newGain = model.gain.mean() * newDuration / duration;
+
+  // The controller stops as soon as the target is reached, maxBursts only
+  // bounds the pumping if something is broken
+  const double neededGain = dryingPerTick * (ticks + 1);
+  const uint8_t maxBursts =
+      withHysteresis(settings.maxBursts[idx],
+                     std::lround(std::ceil(neededGain / newGain)) + 2);
+
+  // Wait longer between the bursts if the moisture kept rising after the
+  // irrigation, shorten it if the soil takes the water right away
+  uint8_t delay = settings.burstDelay[idx];
+  if (model.seepage.count() >= conf.minSamples) {
+    if (model.seepage.mean() > conf.gainPerBurst / 2) {
+      delay = withHysteresis(delay, delay * 3 / 2 + 1);
+    } else if (model.seepage.mean() < 0.5) {
+      delay = withHysteresis(delay, delay * 3 / 4);
+    }
+  }
+
+  proposal.ticksBetweenIrrigation[idx] = ticks;
+  proposal.burstDuration[idx] = newDuration;
+  proposal.maxBursts[idx] = maxBursts;
+  proposal.burstDelay[idx] = delay;
+
+  return ticks != settings.ticksBetweenIrrigation[idx] ||
+         newDuration != duration || maxBursts != settings.maxBursts[idx] ||
+         delay != settings.burstDelay[idx];
+}
+
+bool IrrigationTuner::retune(Settings &settings) const {
+  Settings current;
+  std::memcpy(&current, &settings, sizeof(current));
+
+  bool changed = false;
+  const uint8_t numPlants = std::min(
+      settings.numPlants, static_cast<uint8_t>(MAX_MOISTURE_SENSOR_COUNT));
+  for (uint8_t i = 0; i < numPlants; ++i) {
+    if (!hasHardwareFailure(current, i)) {
+      changed |= tune(plants[i], current, i, settings);
+    }
+  }
+  return changed;
+}
+
+bool IrrigationTuner::learn(const Status &status, const Settings &settings,
+                            std::time_t now, Settings &proposal) {
+  std::memcpy(&proposal, &settings, sizeof(proposal));
+
+  bool changed = false;
+  const uint8_t numPlants = std::min(
+      {status.numPlants, settings.numPlants,
+       static_cast<uint8_t>(MAX_MOISTURE_SENSOR_COUNT)});
+  for (uint8_t i = 0; i < numPlants; ++i) {
+    if (status.beforeMoistureLevels[i] == UNDEFINED_LEVEL_8 ||
+        hasHardwareFailure(settings, i)) {
+      // not measured in this cycle
+      continue;
+    }
+    observe(plants[i], status, i, now);
+    changed |= tune(plants[i], settings, i, proposal);
+  }
+
+  if (!changed || (hasProposal && std::memcmp(&proposal, &lastProposal,
+                                              sizeof(proposal)) == 0)) {
+    return false;
+  }
+  std::memcpy(&lastProposal, &proposal, sizeof(lastProposal));
+  hasProposal = true;
+  return true;
+}
@@ -1,21 +1,28 @@
+// Boost 1.74 uses std::exchange in its coroutine support without <utility>
+#include <utility>
+
+#include <algorithm>
+#include <boost/asio.hpp>
+#include <csignal>
+#include <cstdlib>
 #include <fstream>
+#include <functional>
 #include <iostream>
-#include <signal.h>
 #include <thread>
 #include <type_traits>
 #include <yaml-cpp/yaml.h>
 
+#include "asio_http_client.hpp"
+#include "config_watcher.hpp"
 #include "dry_no_more_server.hpp"
-#include "networking.hpp"
+#include "shutdown.hpp"
 #include "telegram_bot.hpp"
+#include "trace.hpp"
 
-static std::atomic<bool> running(true);
-
-static void signalHandler(int signal) {
-  if (signal == SIGINT || signal == SIGTERM) {
-    running.store(false);
-  }
-}
+// Time to deliver the remaining notifications on shutdown
+#define DRAIN_TIMEOUT std::chrono::seconds(3)
+#define DEFAULT_API_URL "https://api.telegram.org"
+#define SEC_PER_DAY (24 * 60 * 60)
 
 // This code is required to change uint8_t values to uint16_t otherwise YAML
 // export and import treats the values as characters!
@@ -91,8 +98,9 @@ namespace YAML {
       auto burstDelayNode = node["burstDelay"];
       auto maxBurstsNode = node["maxBursts"];
       auto ticksBetweenIrrigationNode = node["ticksBetweenIrrigation"];
-      auto moistSensToWaterSensBitmapNode = node["moistSensToWaterSensBitmap"];
+      auto moistSensToWaterSensNode = node["moistSensToWaterSens"];
       auto skipBitmapNode = node["skipBitmap"];
+      auto hardwareFailureNode = node["hardwareFailure"];
 
       for (const auto &w : set.waterLvlThres) {
         waterThresNode.push_back(w);
@@ -108,16 +116,17 @@ namespace YAML {
         ticksBetweenIrrigationNode.push_back(
             yaml_encode(set.ticksBetweenIrrigation[i]));
 
+        moistSensToWaterSensNode.push_back(
+            yaml_encode(getWaterSensIdx(set, i)));
+
         // handle bitmaps
-        bool val = (set.moistSensToWaterSensBitmap[i / 8] &
-                    (static_cast<uint8_t>(1) << (i & 7 /*aka mod 8*/))) != 0;
-        moistSensToWaterSensBitmapNode.push_back(yaml_encode(val));
-        val = (set.skipBitmap[i / 8] &
+        bool val = (set.skipBitmap[i / 8] &
                (static_cast<uint8_t>(1) << (i & 7 /*aka mod 8*/))) != 0;
         skipBitmapNode.push_back(yaml_encode(val));
+        hardwareFailureNode.push_back(
+            yaml_encode(hasHardwareFailure(set, i)));
       }
       node["numPlants"] = yaml_encode(set.numPlants);
-      node["hardwareFailure"] = yaml_encode(set.hardwareFailure);
       node["debug"] = yaml_encode(set.debug);
 
       return node;
@@ -131,6 +140,9 @@ namespace YAML {
       for (auto &s : set.skipBitmap) {
         s = 0;
       }
+      for (auto &s : set.hardwareFailureBitmap) {
+        s = 0;
+      }
 
       const auto &sensConfNode = node["sensConf"];
       const auto &waterThresNode = node["waterLvlThres"];
@@ -139,9 +151,15 @@ namespace YAML {
       const auto &burstDelayNode = node["burstDelay"];
       const auto &maxBurstsNode = node["maxBursts"];
       const auto &ticksBetweenIrrigationNode = node["ticksBetweenIrrigation"];
+      const auto &moistSensToWaterSensNode = node["moistSensToWaterSens"];
+      // Configs written before boards with more than 2 water sensors were
+      // supported store the water sensor mapping as bitmap
       const auto &moistSensToWaterSensBitmapNode =
           node["moistSensToWaterSensBitmap"];
       const auto &skipBitmapNode = node["skipBitmap"];
+      // Configs written before failures were tracked per plant store a single
+      // flag for the whole controller
+      const auto &hardwareFailureNode = node["hardwareFailure"];
 
       unsigned i = 0;
       for (auto &w : set.waterLvlThres) {
@@ -169,19 +187,33 @@ namespace YAML {
             ticksBetweenIrrigationNode[i]
                 .as<yaml_dec_type_t<decltype(set.ticksBetweenIrrigation[i])>>();
 
+        if (moistSensToWaterSensNode.IsDefined()) {
+          const auto &waterSensNode = moistSensToWaterSensNode[i];
+          const uint16_t waterSens = waterSensNode.as<uint16_t>();
+          if (waterSens >= MAX_WATER_SENSOR_COUNT) {
+            throw RepresentationException(
+                waterSensNode.Mark(),
+                "water sensor " + std::to_string(waterSens) + " of plant " +
+                    std::to_string(i) + " out of range, the board has " +
+                    std::to_string(MAX_WATER_SENSOR_COUNT));
+          }
+          setWaterSensIdx(set, i, static_cast<uint8_t>(waterSens));
+        } else {
+          setWaterSensIdx(set, i,
+                          moistSensToWaterSensBitmapNode[i].as<bool>() ? 1
+                                                                       : 0);
+        }
+
         // handle bitmaps
-        bool val = moistSensToWaterSensBitmapNode[i]
-                       .as<yaml_dec_type_t<decltype(val)>>();
-        set.moistSensToWaterSensBitmap[i / 8] |=
-            val ? (1 << (i & 7 /*aka mod 8*/)) : 0;
-        val = skipBitmapNode[i].as<yaml_dec_type_t<decltype(val)>>();
+        bool val = skipBitmapNode[i].as<yaml_dec_type_t<decltype(val)>>();
         set.skipBitmap[i / 8] |= val ? (1 << (i & 7 /*aka mod 8*/)) : 0;
+        setHardwareFailure(set, i,
+                           hardwareFailureNode.IsSequence()
+                               ? hardwareFailureNode[i].as<bool>()
+                               : hardwareFailureNode.as<bool>());
       }
       set.numPlants =
           node["numPlants"].as<yaml_dec_type_t<decltype(set.numPlants)>>();
-      set.hardwareFailure =
-          node["hardwareFailure"]
-              .as<yaml_dec_type_t<decltype(set.hardwareFailure)>>();
       set.debug = node["debug"].as<yaml_dec_type_t<decltype(set.debug)>>();
 
       return true;
@@ -189,32 +221,63 @@ namespace YAML {
   };
 } // namespace YAML
 
-static void readSettings(StateWrapper &state, const YAML::Node &config) {
+// The decoder converts the hardwareFailure flag of the previous version
+#define PREVIOUS_SETTINGS_VERSION_NUM 0x0011
+
+static bool readSettings(StateWrapper &state, const YAML::Node &config,
+                         std::string &error) {
   const auto &settingsNode = config["lastKnownSettings"];
   const auto &settingsVersionNode = config["lastKnownSettingsVersion"];
   if (settingsNode.IsDefined() && settingsVersionNode.IsDefined() &&
       settingsVersionNode.IsScalar() &&
-      settingsVersionNode.as<uint64_t>() ==
-          static_cast<uint64_t>(SETTINGS_VERSION_NUM)) {
-    state.settingsWrap.valid = true;
-    auto &set = state.settingsWrap.settings;
-    set = settingsNode.as<Settings>();
+      (settingsVersionNode.as<uint64_t>() ==
+           static_cast<uint64_t>(SETTINGS_VERSION_NUM) ||
+       settingsVersionNode.as<uint64_t>() ==
+           static_cast<uint64_t>(PREVIOUS_SETTINGS_VERSION_NUM))) {
+    try {
+      state.settings.publish(settingsNode.as<Settings>());
+    } catch (const YAML::Exception &e) {
+      error = std::string("Invalid 'lastKnownSettings' in config file: ") +
+              e.what();
+      return false;
+    }
   }
+  return true;
 }
 
 static void writeSettings(const StateWrapper &state, YAML::Node &config) {
-  if (state.settingsWrap.valid) {
+  if (const auto settings = state.settings.load()) {
     config["lastKnownSettingsVersion"] =
         static_cast<uint64_t>(SETTINGS_VERSION_NUM);
-    config["lastKnownSettings"] = state.settingsWrap.settings;
+    config["lastKnownSettings"] = settings->value;
   }
 }
 
-int main(int argc, char **argv) {
-  // Register interrupt signal handler to stop the program
-  signal(SIGINT, signalHandler);
-  signal(SIGTERM, signalHandler);
+static void writeConfig(const char *path, YAML::Node &config,
+                        const StateWrapper &state) {
+  // Start from the current file to keep changes made while running
+  try {
+    config = YAML::LoadFile(path);
+  } catch (const YAML::Exception &e) {
+    std::cerr << "Failed to reload config file, writing back the initial one: "
+              << e.what() << std::endl;
+  }
+
+  // write back config!
+  config["tcp_port"] = state.config.load()->value.tcpPort;
+  config.remove("user_chats");
+  for (auto c : state.chats.load()->value) {
+    config["user_chats"].push_back(c);
+  }
+
+  // transfer settings into the yaml config!
+  writeSettings(state, config);
+
+  std::ofstream out(path);
+  out << config;
+}
 
+int main(int argc, char **argv) {
   if (argc != 2) {
     std::cout << "Usage: ./telegram_bot <config.yaml>" << std::endl;
     return 1;
@@ -229,104 +292,139 @@ int main(int argc, char **argv) {
     return 2;
   }
 
-  const auto &tcpPortNode = config["tcp_port"];
-  if (tokenNode.IsDefined() && !tokenNode.IsScalar()) {
-    std::cout << "Invalid 'tcp_port' attribute in config file!" << std::endl;
+  RuntimeConfig runtimeConfig;
+  if (std::string error; !parseRuntimeConfig(config, runtimeConfig, error)) {
+    std::cout << error << std::endl;
     return 3;
   }
 
-  const auto &whitelistNode = config["user_whitelist"];
-  if (!whitelistNode.IsDefined() || !whitelistNode.IsSequence()) {
-    std::cout << "Invalid or missing 'user_whitelist' attribute in config file!"
-              << std::endl;
-    return 4;
-  }
-
-  const auto &userChatsNode = config["user_chats"];
-  if (!userChatsNode.IsDefined() || !userChatsNode.IsSequence()) {
-    std::cout << "Invalid or missing 'user_chats' attribute in config file!"
-              << std::endl;
-    return 5;
-  }
-
   const std::string token = tokenNode.as<std::string>();
-  uint16_t tcpPort = tcpPortNode.as<uint16_t>(42424);
-  std::set<std::int64_t> userWhitelist;
-  {
-    auto vec = whitelistNode.as<std::vector<std::int64_t>>();
-    for (auto u : vec) {
-      userWhitelist.insert(u);
-    }
-  }
-  std::set<std::int64_t> broadcastChats;
-  {
-    auto vec = userChatsNode.as<std::vector<std::int64_t>>();
-    for (auto u : vec) {
-      broadcastChats.insert(u);
-    }
-  }
+  const std::string apiUrl = config["api_url"].as<std::string>(DEFAULT_API_URL);
 
   StateWrapper state;
+  state.config.publish(runtimeConfig);
+  state.chats.publish(runtimeConfig.userChats);
 
   // read settings from the yaml file!
-  readSettings(state, config);
+  if (std::string error; !readSettings(state, config, error)) {
+    std::cout << error << std::endl;
+    return 4;
+  }
+
+  // 0 keeps the whole history
+  const uint64_t historyMaxDays = config["history_max_days"].as<uint32_t>(
+      HistoryStore::DEFAULT_MAX_AGE_SEC / SEC_PER_DAY);
+  state.history.setMaxAge(static_cast<uint32_t>(
+      std::min<uint64_t>(historyMaxDays * SEC_PER_DAY, UINT32_MAX)));
+  if (const std::string historyFile =
+          config["history_file"].as<std::string>("");
+      !historyFile.empty()) {
+    state.history.open(historyFile);
+  }
 
 // #define DEBUG_SETTINGS
 #ifdef DEBUG_SETTINGS
 #warning "DEBUG settings activated, do not use in production!"
-  state.settingsWrap.valid = true;
-  state.settingsWrap.settings.hardwareFailure = false;
-  state.settingsWrap.settings.debug = false;
-  state.settingsWrap.settings.numPlants = 2;
-  state.settingsWrap.settings.sensConfs[0].minValue = 100;
-  state.settingsWrap.settings.sensConfs[0].maxValue = 500;
-  state.settingsWrap.settings.sensConfs[1].minValue = 101;
-  state.settingsWrap.settings.sensConfs[1].maxValue = 501;
-  state.settingsWrap.settings.moistSensToWaterSensBitmap[0] = 0b010;
-  state.settingsWrap.settings.skipBitmap[0] = 0b10;
-  state.settingsWrap.settings.sensConfs[(MAX_MOISTURE_SENSOR_COUNT) + 0]
+  Settings debugSettings{};
+  debugSettings.debug = false;
+  debugSettings.numPlants = 2;
+  debugSettings.sensConfs[0].minValue = 100;
+  debugSettings.sensConfs[0].maxValue = 500;
+  debugSettings.sensConfs[1].minValue = 101;
+  debugSettings.sensConfs[1].maxValue = 501;
+  setWaterSensIdx(debugSettings, 1, 1);
+  debugSettings.skipBitmap[0] = 0b10;
+  debugSettings.sensConfs[(MAX_MOISTURE_SENSOR_COUNT) + 0]
       .minValue = 100;
-  state.settingsWrap.settings.sensConfs[(MAX_MOISTURE_SENSOR_COUNT) + 0]
+  debugSettings.sensConfs[(MAX_MOISTURE_SENSOR_COUNT) + 0]
       .maxValue = 500;
-  state.settingsWrap.settings.sensConfs[(MAX_MOISTURE_SENSOR_COUNT) + 1]
+  debugSettings.sensConfs[(MAX_MOISTURE_SENSOR_COUNT) + 1]
       .minValue = 101;
-  state.settingsWrap.settings.sensConfs[(MAX_MOISTURE_SENSOR_COUNT) + 1]
+  debugSettings.sensConfs[(MAX_MOISTURE_SENSOR_COUNT) + 1]
       .maxValue = 501;
-  state.settingsWrap.settings.waterLvlThres[0].warnThres = 50;
-  state.settingsWrap.settings.waterLvlThres[0].emptyThres = 10;
-  state.settingsWrap.settings.waterLvlThres[1].warnThres = 49;
-  state.settingsWrap.settings.waterLvlThres[1].emptyThres = 11;
+  debugSettings.waterLvlThres[0].warnThres = 50;
+  debugSettings.waterLvlThres[0].emptyThres = 10;
+  debugSettings.waterLvlThres[1].warnThres = 49;
+  debugSettings.waterLvlThres[1].emptyThres = 11;
+  state.settings.publish(debugSettings);
 #endif
 
-  ts_queue<Message> msgQueue;
+  MessageQueue msgQueue(runtimeConfig.alertCoalesceSec);
 
-  SocketRAII socket(tcpPort);
+  // All network I/O, i.e. the status server, the config watcher and the
+  // requests of the bot, runs as coroutines on the main thread. Only the
+  // synchronous tgbot-cpp API has threads of its own.
+  boost::asio::io_context io;
 
-  if (!socket.good()) {
+  DryNoMoreStatusServer statusServer(io, state, msgQueue);
+  if (!statusServer.start()) {
     return 6;
   }
 
-  std::thread statusServer(runDryNoMoreStatusServer, socket.fd, std::ref(state),
-                           std::ref(msgQueue), std::cref(running));
-
-  runDryNoMoreTelegramBot(token, userWhitelist, broadcastChats, state, msgQueue,
-                          running);
-
-  running.store(false);
-  statusServer.join();
-
-  // write back config!
-  config["tcp_port"] = tcpPort;
-  config.remove("user_chats");
-  for (auto c : broadcastChats) {
-    config["user_chats"].push_back(c);
-  }
-
-  // transfer settings into the yaml config!
-  writeSettings(state, config);
+  Trace::setEnabled(runtimeConfig.trace);
+
+  ConfigWatcher configWatcher(io, argv[1], state, msgQueue, [&]() {
+    const auto config = state.config.load();
+    statusServer.reconfigure();
+    msgQueue.setCoalesceWindow(config->value.alertCoalesceSec);
+    Trace::setEnabled(config->value.trace);
+  });
+  configWatcher.start();
+
+  boost::asio::signal_set dumpSignal(io, SIGUSR1);
+  std::function<void()> waitForDump = [&]() {
+    dumpSignal.async_wait([&](boost::system::error_code ec, int) {
+      if (!ec) {
+        Trace::dump(state.config.load()->value.traceFile);
+        waitForDump();
+      }
+    });
+  };
+  waitForDump();
+
+  Shutdown shutdown;
+
+  // Everything is persisted, so end the process without running destructors
+  // that might still be in use by the bot threads. Waiting for them would
+  // mean waiting for the long poll to time out.
+  auto finish = [&]() {
+    writeConfig(argv[1], config, state);
+    std::cout.flush();
+    std::cerr.flush();
+    std::_Exit(0);
+  };
 
-  std::ofstream out(argv[1]);
-  out << config;
+  AsioHttpClient httpClient(io);
+  std::thread bot(runDryNoMoreTelegramBot, std::cref(token), std::cref(apiUrl),
+                  std::cref(httpClient), std::ref(state), std::ref(msgQueue),
+                  std::cref(shutdown), [&io, &finish]() {
+                    boost::asio::post(io, finish);
+                  });
+  bot.detach();
+
+  boost::asio::steady_timer drainTimer(io);
+  boost::asio::signal_set stopSignals(io, SIGINT, SIGTERM);
+  stopSignals.async_wait([&](boost::system::error_code ec, int signal) {
+    if (ec) {
+      return;
+    }
+    std::cout << "Received signal " << signal << ", shutting down"
+              << std::endl;
+    statusServer.stop();
+    configWatcher.stop();
+    shutdown.request();
+
+    // The bot needs the io_context to send the remaining notifications
+    drainTimer.expires_after(DRAIN_TIMEOUT);
+    drainTimer.async_wait([&finish](boost::system::error_code ec) {
+      if (!ec) {
+        std::cerr << "Timeout while sending the remaining notifications!"
+                  << std::endl;
+        finish();
+      }
+    });
+  });
 
+  io.run();
   return 0;
 }
@@ -0,0 +1,185 @@
+#include <chrono>
+
+#include "message_queue.hpp"
+
+// Upper bound of the remembered messages, expired ones are forgotten first
+#define MAX_RECENT_MESSAGES 256
+
+MessageQueue::MessageQueue(uint32_t coalesceSec, size_t capacity)
+    : capacity(capacity), coalesceSec(coalesceSec) {}
+
+void MessageQueue::setCoalesceWindow(uint32_t coalesceSec) {
+  std::scoped_lock lock(mutex);
+  this->coalesceSec = coalesceSec;
+}
+
+size_t MessageQueue::priority(Message::MessageType type) {
+  switch (type) {
+    case Message::FAILURE_MSG:
+      return 3;
+    case Message::ERR_MSG:
+      return 2;
+    case Message::WARN_MSG:
+      return 1;
+    default:
+      return 0;
+  }
+}
+
+void MessageQueue::push(Message &&msg) {
+  {
+    std::scoped_lock lock(mutex);
+    const std::time_t now = std::time(nullptr);
+    auto [it, inserted] =
+        recent.try_emplace(Key(msg.deviceId, msg.msgType, msg.msg),
+                           Recent{now, 0, 0, false});
+    Recent &entry = it->second;
+
+    if (!inserted && (entry.queued || now - entry.windowStart < coalesceSec)) {
+      if (entry.repeats++ == 0) {
+        entry.firstRepeat = now;
+      }
+      return;
+    }
+
+    entry.windowStart = now;
+    entry.queued = true;
+    enqueue(std::move(msg), false);
+    prune(now);
+  }
+  dataCond.notify_one();
+}
+
+void MessageQueue::requeue(Message &&msg) {
+  {
+    std::scoped_lock lock(mutex);
+    // repeats showing up in the meantime are attached to it again
+    recent
+        .try_emplace(Key(msg.deviceId, msg.msgType, msg.msg),
+                     Recent{std::time(nullptr), 0, 0, false})
+        .first->second.queued = true;
+    enqueue(std::move(msg), true);
+  }
+  dataCond.notify_one();
+}
+
+void MessageQueue::enqueue(Message &&msg, bool front) {
+  const size_t prio = priority(msg.msgType);
+
+  if (size >= capacity) {
+    size_t lowest = 0;
+    while (queues[lowest].empty()) {
+      ++lowest;
+    }
+
+    ++dropped;
+    // the oldest message of the lowest priority makes room, unless the new
+    // one has an even lower priority
+    Message &victim = lowest <= prio ? queues[lowest].front() : msg;
+    if (auto it =
+            recent.find(Key(victim.deviceId, victim.msgType, victim.msg));
+        it != recent.end()) {
+      it->second.queued = false;
+    }
+    if (lowest > prio) {
+      return;
+    }
+    queues[lowest].pop_front();
+    --size;
+  }
+
+  if (front) {
+    queues[prio].push_front(std::move(msg));
+  } else {
+    queues[prio].push_back(std::move(msg));
+  }
+  ++size;
+}
+
+std::optional<Message> MessageQueue::pop() {
+  for (size_t prio = std::size(queues); prio-- > 0;) {
+    if (queues[prio].empty()) {
+      continue;
+    }
+    Message msg = std::move(queues[prio].front());
+    queues[prio].pop_front();
+    --size;
+
+    if (auto it = recent.find(Key(msg.deviceId, msg.msgType, msg.msg));
+        it != recent.end() && it->second.queued) {
+      Recent &entry = it->second;
+      entry.queued = false;
+      if (entry.repeats != 0) {
+        if (msg.repeats == 0 || entry.firstRepeat < msg.firstRepeat) {
+          msg.firstRepeat = entry.firstRepeat;
+        }
+        msg.repeats += entry.repeats;
+        entry.repeats = 0;
+      }
+    }
+    msg.dropped += dropped;
+    dropped = 0;
+    return msg;
+  }
+  return std::nullopt;
+}
+
+void MessageQueue::prune(std::time_t now) {
+  if (recent.size() <= MAX_RECENT_MESSAGES) {
+    return;
+  }
+  // Repeats of forgotten messages that did not show up again are lost
+  for (auto it = recent.begin(); it != recent.end();) {
+    if (!it->second.queued && now - it->second.windowStart >= coalesceSec) {
+      it = recent.erase(it);
+    } else {
+      ++it;
+    }
+  }
+  for (auto it = recent.begin();
+       recent.size() > MAX_RECENT_MESSAGES && it != recent.end();) {
+    it = it->second.queued ? std::next(it) : recent.erase(it);
+  }
+}
+
+std::optional<Message> MessageQueue::try_pop() {
+  std::scoped_lock lock(mutex);
+  return pop();
+}
+
+std::optional<Message> MessageQueue::limited_wait_for_pop() {
+  std::unique_lock lock(mutex);
+  dataCond.wait_for(lock, std::chrono::milliseconds(500),
+                    [this] { return interrupted || size != 0; });
+  return pop();
+}
+
+void MessageQueue::interrupt() {
+  {
+    std::scoped_lock lock(mutex);
+    interrupted = true;
+  }
+  dataCond.notify_all();
+}
+
+bool MessageQueue::empty() const {
+  std::scoped_lock lock(mutex);
+  return size == 0;
+}
+
+std::string Message::text() const {
+  std::string text = msg;
+  if (repeats != 0) {
+    std::tm tm;
+    localtime_r(&firstRepeat, &tm);
+    char since[16];
+    std::strftime(since, sizeof(since), "%m-%d %H:%M", &tm);
+    text += "\n(repeated " + std::to_string(repeats) + " times since " +
+            since + ")";
+  }
+  if (dropped != 0) {
+    text += "\n(" + std::to_string(dropped) +
+            " less important messages were dropped)";
+  }
+  return text;
+}
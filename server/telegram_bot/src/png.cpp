@@ -0,0 +1,192 @@
+#include <stdexcept>
+
+#include "png.hpp"
+
+namespace {
+  class Crc32 {
+  public:
+    Crc32() {
+      for (uint32_t n = 0; n < table.size(); ++n) {
+        uint32_t c = n;
+        for (int k = 0; k < 8; ++k) {
+          c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+        }
+        table[n] = c;
+      }
+    }
+
+    uint32_t update(uint32_t crc, const uint8_t *data, size_t size) const {
+      crc ^= 0xFFFFFFFFu;
+      for (size_t i = 0; i < size; ++i) {
+        crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+      }
+      return crc ^ 0xFFFFFFFFu;
+    }
+
+  private:
+    std::array<uint32_t, 256> table;
+  };
+
+  uint32_t adler32(const std::vector<uint8_t> &data) {
+    uint32_t a = 1, b = 0;
+    for (uint8_t d : data) {
+      a = (a + d) % 65521;
+      b = (b + a) % 65521;
+    }
+    return (b << 16) | a;
+  }
+
+  // Deflate writes its bits LSb first
+  class BitWriter {
+  public:
+    void write(uint32_t bits, int count) {
+      for (int i = 0; i < count; ++i) {
+        if (bitPos == 0) {
+          out.push_back(0);
+        }
+        out.back() |= ((bits >> i) & 1) << bitPos;
+        bitPos = (bitPos + 1) & 7;
+      }
+    }
+
+    // Huffman codes are defined MSb first
+    void writeCode(uint32_t code, int length) {
+      uint32_t reversed = 0;
+      for (int i = 0; i < length; ++i) {
+        reversed |= ((code >> i) & 1) << (length - 1 - i);
+      }
+      write(reversed, length);
+    }
+
+    std::vector<uint8_t> out;
+
+  private:
+    int bitPos = 0;
+  };
+
+  // Fixed Huffman code of a literal/length symbol (RFC 1951, 3.2.6)
+  void writeSymbol(BitWriter &w, uint16_t sym) {
+    if (sym < 144) {
+      w.writeCode(0x30 + sym, 8);
+    } else if (sym < 256) {
+      w.writeCode(0x190 + sym - 144, 9);
+    } else if (sym < 280) {
+      w.writeCode(sym - 256, 7);
+    } else {
+      w.writeCode(0xC0 + sym - 280, 8);
+    }
+  }
+
+  void writeLength(BitWriter &w, uint16_t length) {
+    static constexpr uint16_t base[] = {3,  4,  5,  6,   7,   8,   9,   10,
+                                        11, 13, 15, 17,  19,  23,  27,  31,
+                                        35, 43, 51, 59,  67,  83,  99,  115,
+                                        131, 163, 195, 227, 258};
+    static constexpr uint8_t extra[] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1,
+                                        1, 1, 2, 2, 2, 2, 3, 3, 3, 3,
+                                        4, 4, 4, 4, 5, 5, 5, 5, 0};
+    int code = 28;
+    while (base[code] > length) {
+      --code;
+    }
+    writeSymbol(w, 257 + code);
+    w.write(length - base[code], extra[code]);
+  }
+
+  // Only matches with distance 1 are used, i.e. runs of the same byte
+  std::vector<uint8_t> deflateRuns(const std::vector<uint8_t> &data) {
+    BitWriter w;
+    // BFINAL = 1, BTYPE = 01 (fixed Huffman codes)
+    w.write(1, 1);
+    w.write(1, 2);
+
+    for (size_t i = 0; i < data.size();) {
+      writeSymbol(w, data[i]);
+      size_t run = 0;
+      while (i + 1 + run < data.size() && data[i + 1 + run] == data[i] &&
+             run < 258) {
+        ++run;
+      }
+      if (run >= 3) {
+        writeLength(w, static_cast<uint16_t>(run));
+        // distance code 0 = distance 1, no extra bits
+        w.writeCode(0, 5);
+      } else {
+        run = 0;
+      }
+      i += 1 + run;
+    }
+    writeSymbol(w, 256);
+    return std::move(w.out);
+  }
+
+  void appendBe32(std::string &out, uint32_t v) {
+    out.push_back(static_cast<char>(v >> 24));
+    out.push_back(static_cast<char>(v >> 16));
+    out.push_back(static_cast<char>(v >> 8));
+    out.push_back(static_cast<char>(v));
+  }
+
+  void appendChunk(std::string &out, const char type[4],
+                   const std::vector<uint8_t> &data) {
+    static const Crc32 crc;
+    appendBe32(out, static_cast<uint32_t>(data.size()));
+    std::vector<uint8_t> typed(type, type + 4);
+    typed.insert(typed.end(), data.begin(), data.end());
+    out.append(reinterpret_cast<const char *>(typed.data()), typed.size());
+    appendBe32(out, crc.update(0, typed.data(), typed.size()));
+  }
+} // namespace
+
+std::string encodePalettePng(uint32_t width, uint32_t height,
+                             const std::vector<uint8_t> &pixels,
+                             const std::vector<Rgb> &palette) {
+  if (pixels.size() != static_cast<size_t>(width) * height ||
+      palette.empty() || palette.size() > 256) {
+    throw std::invalid_argument("invalid palette image");
+  }
+
+  std::string png("\x89PNG\r\n\x1a\n", 8);
+
+  std::vector<uint8_t> ihdr;
+  for (uint32_t v : {width, height}) {
+    for (int shift = 24; shift >= 0; shift -= 8) {
+      ihdr.push_back(static_cast<uint8_t>(v >> shift));
+    }
+  }
+  // bit depth 8, color type 3 (palette), deflate, no filter, no interlace
+  ihdr.insert(ihdr.end(), {8, 3, 0, 0, 0});
+  appendChunk(png, "IHDR", ihdr);
+
+  std::vector<uint8_t> plte;
+  for (const auto &c : palette) {
+    plte.insert(plte.end(), {c.r, c.g, c.b});
+  }
+  appendChunk(png, "PLTE", plte);
+
+  // Filter "Up" turns rows equal to the previous one into zeros, which the
+  // run-length matches compress to a few bytes
+  std::vector<uint8_t> raw;
+  raw.reserve((width + 1) * height);
+  for (uint32_t y = 0; y < height; ++y) {
+    raw.push_back(y == 0 ? 0 : 2);
+    const uint8_t *row = pixels.data() + static_cast<size_t>(y) * width;
+    const uint8_t *prev = y == 0 ? nullptr : row - width;
+    for (uint32_t x = 0; x < width; ++x) {
+      raw.push_back(prev ? static_cast<uint8_t>(row[x] - prev[x]) : row[x]);
+    }
+  }
+
+  // zlib stream: deflate, 32K window, no preset dictionary
+  std::vector<uint8_t> idat{0x78, 0x01};
+  const auto deflated = deflateRuns(raw);
+  idat.insert(idat.end(), deflated.begin(), deflated.end());
+  const uint32_t adler = adler32(raw);
+  for (int shift = 24; shift >= 0; shift -= 8) {
+    idat.push_back(static_cast<uint8_t>(adler >> shift));
+  }
+  appendChunk(png, "IDAT", idat);
+  appendChunk(png, "IEND", {});
+
+  return png;
+}
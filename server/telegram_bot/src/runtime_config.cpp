@@ -0,0 +1,88 @@
+#include "runtime_config.hpp"
+
+static bool parseChatIds(const YAML::Node &node, const char *key,
+                         std::set<std::int64_t> &ids, std::string &error) {
+  const auto &idsNode = node[key];
+  if (!idsNode.IsDefined() || !idsNode.IsSequence()) {
+    error = std::string("Invalid or missing '") + key +
+            "' attribute in config file!";
+    return false;
+  }
+  ids.clear();
+  for (const auto &id : idsNode) {
+    // allow the empty placeholder entries of the example config
+    if (!id.IsNull()) {
+      ids.insert(id.as<std::int64_t>());
+    }
+  }
+  return true;
+}
+
+bool parseRuntimeConfig(const YAML::Node &config, RuntimeConfig &runtime,
+                        std::string &error) {
+  try {
+    const auto &tcpPortNode = config["tcp_port"];
+    if (tcpPortNode.IsDefined() && !tcpPortNode.IsScalar()) {
+      error = "Invalid 'tcp_port' attribute in config file!";
+      return false;
+    }
+    runtime.tcpPort = tcpPortNode.as<uint16_t>(42424);
+
+    if (!parseChatIds(config, "user_whitelist", runtime.userWhitelist,
+                      error) ||
+        !parseChatIds(config, "user_chats", runtime.userChats, error)) {
+      return false;
+    }
+
+    auto &wakeSchedule = runtime.wakeSchedule;
+    wakeSchedule.periodSec =
+        config["wake_period_min"].as<uint32_t>(wakeSchedule.periodSec / 60) *
+        60;
+    wakeSchedule.anchorSec =
+        config["wake_anchor_min"].as<uint32_t>(wakeSchedule.anchorSec / 60) *
+        60;
+    wakeSchedule.spreadSec =
+        config["wake_spread_min"].as<uint32_t>(wakeSchedule.spreadSec / 60) *
+        60;
+
+    runtime.alertCoalesceSec =
+        config["alert_coalesce_min"].as<uint32_t>(runtime.alertCoalesceSec /
+                                                  60) *
+        60;
+
+    runtime.trace = config["trace"].as<bool>(runtime.trace);
+    runtime.traceFile = config["trace_file"].as<std::string>(runtime.traceFile);
+
+    auto &tuning = runtime.tuning;
+    const std::string mode =
+        config["irrigation_tuning"].as<std::string>("propose");
+    if (mode == "off") {
+      tuning.mode = IrrigationTuningConfig::OFF;
+    } else if (mode == "propose") {
+      tuning.mode = IrrigationTuningConfig::PROPOSE;
+    } else if (mode == "auto") {
+      tuning.mode = IrrigationTuningConfig::AUTO;
+    } else {
+      error = "Unknown irrigation_tuning mode '" + mode + "'!";
+      return false;
+    }
+    tuning.gainPerBurst =
+        config["tuning_gain_per_burst"].as<double>(tuning.gainPerBurst);
+    if (tuning.gainPerBurst <= 0) {
+      error = "'tuning_gain_per_burst' has to be positive!";
+      return false;
+    }
+
+    auto &battery = runtime.battery;
+    battery.emptyMilliVolt =
+        config["battery_empty_mv"].as<uint16_t>(battery.emptyMilliVolt);
+    battery.warnAheadSec =
+        config["battery_warn_days"].as<uint32_t>(battery.warnAheadSec /
+                                                 (24 * 60 * 60)) *
+        24 * 60 * 60;
+  } catch (const YAML::Exception &e) {
+    error = std::string("Invalid config file: ") + e.what();
+    return false;
+  }
+  return true;
+}
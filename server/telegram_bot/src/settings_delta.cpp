@@ -0,0 +1,39 @@
+#include <limits>
+
+#include "settings_delta.hpp"
+
+// Encodes the changed bytes as SettingsDeltaRun entries. Runs separated by less
+// than a run header are merged as the header would cost more than the gap.
+void encodeSettingsDelta(const Settings &from, const Settings &to,
+                         std::vector<uint8_t> &delta) {
+  const uint8_t *src = reinterpret_cast<const uint8_t *>(&from);
+  const uint8_t *dst = reinterpret_cast<const uint8_t *>(&to);
+  constexpr size_t maxRunLength = std::numeric_limits<uint8_t>::max();
+
+  for (size_t i = 0; i < sizeof(Settings);) {
+    if (src[i] == dst[i]) {
+      ++i;
+      continue;
+    }
+
+    size_t end = i + 1;
+    for (size_t gap = 0; end + gap < sizeof(Settings) &&
+                         gap <= sizeof(SettingsDeltaRun) &&
+                         end + gap - i < maxRunLength;) {
+      if (src[end + gap] != dst[end + gap]) {
+        end += gap + 1;
+        gap = 0;
+      } else {
+        ++gap;
+      }
+    }
+
+    SettingsDeltaRun run;
+    run.offset = static_cast<SettingsOffset>(i);
+    run.length = static_cast<uint8_t>(end - i);
+    const uint8_t *runBytes = reinterpret_cast<const uint8_t *>(&run);
+    delta.insert(delta.end(), runBytes, runBytes + sizeof(run));
+    delta.insert(delta.end(), dst + i, dst + end);
+    i = end;
+  }
+}
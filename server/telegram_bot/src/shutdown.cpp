@@ -0,0 +1,27 @@
+#include "shutdown.hpp"
+
+void Shutdown::request() {
+  std::vector<std::function<void()>> pending;
+  {
+    std::scoped_lock lock(callbackMutex);
+    if (flag.exchange(true, std::memory_order_acq_rel)) {
+      return;
+    }
+    pending.swap(callbacks);
+  }
+
+  for (auto &callback : pending) {
+    callback();
+  }
+}
+
+void Shutdown::onRequest(std::function<void()> &&callback) const {
+  {
+    std::scoped_lock lock(callbackMutex);
+    if (!requested()) {
+      callbacks.push_back(std::move(callback));
+      return;
+    }
+  }
+  callback();
+}
@@ -1,17 +1,197 @@
+#include <algorithm>
+#include <ctime>
+#include <functional>
 #include <iostream>
+#include <mutex>
+#include <optional>
+#include <sstream>
 #include <tgbot/tgbot.h> // https://github.com/reo7sp/tgbot-cpp
+#include <thread>
 #include <vector>
 
+#include "chart.hpp"
 #include "telegram_bot.hpp"
 #include "telegram_bot_keyboards.hpp"
 #include "telegram_bot_utils.hpp"
+#include "trace.hpp"
+
+#define DEFAULT_CHART_RANGE_SEC (7 * 24 * 60 * 60)
+#define DEFAULT_WATER_RANGE_SEC (30 * 24 * 60 * 60)
+// Pause after a notification failed to send
+#define SEND_RETRY_DELAY std::chrono::seconds(5)
+
+static void sendHistoryTable(const TgBot::Api &api, std::int64_t chatId,
+                             const std::vector<HistoryRecord> &records,
+                             bool withChannel, bool withWatering) {
+  if (records.empty()) {
+    api.sendMessage(chatId, "No matching history recorded!");
+  } else {
+    api.sendMessage(chatId,
+                    generateHistoryTable(records, withChannel, withWatering),
+                    false, 0, std::make_shared<TgBot::GenericReply>(),
+                    "Markdown");
+  }
+}
+
+static ChartSeries toSeries(const std::vector<HistoryRecord> &records,
+                            bool after, const char *label) {
+  ChartSeries series{label, {}};
+  series.points.reserve(records.size());
+  for (const auto &r : records) {
+    series.points.push_back(ChartPoint{r.time, after ? r.after : r.before});
+  }
+  return series;
+}
+
+// Renders the chart of a single channel or, if channel is not set, the
+// sparklines of all channels. The charts end with the latest measurement, so
+// they only change when new data arrives and are cached until then.
+static ChartCache::Entry *
+getChart(StateWrapper &state, ChartCache &cache, const uint8_t *channel,
+         uint32_t rangeSec, std::string &caption) {
+  std::vector<uint8_t> channels;
+  if (channel) {
+    channels.push_back(*channel);
+  } else {
+    channels = state.history.channels();
+  }
+
+  uint32_t to = 0;
+  for (uint8_t c : channels) {
+    to = std::max(to, state.history.lastTime(c));
+  }
+  if (to == 0) {
+    return nullptr;
+  }
+  const uint32_t from = to > rangeSec ? to - rangeSec : 0;
+
+  const uint32_t hours = rangeSec / 3600;
+  const std::string rangeName =
+      hours % (7 * 24) == 0 ? std::to_string(hours / (7 * 24)) + "w"
+      : hours % 24 == 0     ? std::to_string(hours / 24) + "d"
+                            : std::to_string(hours) + "h";
+  caption = (channel ? HistoryStore::channelName(*channel) : "Overview") +
+            " - last " + rangeName;
+  const std::string key = (channel ? HistoryStore::channelName(*channel)
+                                   : std::string("all")) +
+                          "/" + rangeName + "/" + std::to_string(to);
+  if (auto *entry = cache.find(key)) {
+    return entry;
+  }
+
+  std::string png;
+  if (channel) {
+    const auto records = state.history.range(*channel, from, to);
+    uint8_t target = 0xFF;
+    if (const auto settings = state.settings.load();
+        settings && !HistoryStore::isTankChannel(*channel)) {
+      target = settings->value.targetMoisture[*channel];
+    }
+    png = renderLineChart(
+        caption, from, to,
+        {toSeries(records, false, "before"), toSeries(records, true, "after")},
+        target);
+  } else {
+    std::vector<ChartSeries> series;
+    for (uint8_t c : channels) {
+      series.push_back(toSeries(state.history.range(c, from, to),
+                                HistoryStore::isTankChannel(c), ""));
+      series.back().label = HistoryStore::channelName(c);
+    }
+    png = renderSparklines(from, to, series);
+  }
+  return &cache.insert(key, std::move(png));
+}
+
+static void broadcast(const TgBot::Api &api, StateWrapper &state,
+                      const std::string &text) {
+  for (std::int64_t chat : state.chats.load()->value) {
+    api.sendMessage(chat, text, false, 0,
+                    std::make_shared<TgBot::GenericReply>(), "Markdown");
+  }
+}
+
+// A failing chat throws, msg.pendingChats keeps the chats that did not get it
+// yet so that a retry does not send it twice
+static void broadcast(const TgBot::Api &api, StateWrapper &state,
+                      Message &msg) {
+  const char *msgPrefix = nullptr;
+  switch (msg.msgType) {
+    case INFO_MSG: {
+      msgPrefix = "INFO: ";
+      break;
+    }
+    case WARN_MSG: {
+      msgPrefix = "WARNING: ";
+      break;
+    }
+    case ERR_MSG: {
+      msgPrefix = "ERROR: ";
+      break;
+    }
+    case FAILURE_MSG: {
+      msgPrefix = "HARDWARE FAILURE: ";
+      break;
+    }
+    default: {
+      std::cerr << "Error invalid message in msgQueue!" << std::endl;
+      return;
+    }
+  }
+  const std::string text = msgPrefix + msg.text();
+  if (msg.pendingChats.empty()) {
+    const auto chats = state.chats.load();
+    msg.pendingChats.assign(chats->value.begin(), chats->value.end());
+  }
+  while (!msg.pendingChats.empty()) {
+    api.sendMessage(msg.pendingChats.back(), text, false, 0,
+                    std::make_shared<TgBot::GenericReply>(), "Markdown");
+    msg.pendingChats.pop_back();
+  }
+}
+
+// Runs send as traced notification of the given message type. Returns false
+// if it could not be sent, i.e. Telegram is down. Only used by the sender.
+template <class Send>
+static bool sendNotification(uint8_t msgType, Send &&send) {
+  static uint32_t notifications = 0;
+  const uint32_t id = ++notifications;
+  Trace::event(Trace::TELEGRAM_SEND, id, msgType);
+  try {
+    send();
+  } catch (const std::exception &e) {
+    Trace::event(Trace::TELEGRAM_SENT, id, 0);
+    std::cerr << "Failed to send a notification: " << e.what() << std::endl;
+    return false;
+  }
+  Trace::event(Trace::TELEGRAM_SENT, id, 1);
+  return true;
+}
+
+// Runs a call of the bot setup until it succeeds, pausing like the sender
+// after a failure. Returns false if the shutdown was requested before.
+template <class Call>
+static bool retryUntilDone(const Shutdown &shutdown, const char *what,
+                           Call &&call) {
+  while (!shutdown.requested()) {
+    try {
+      call();
+      return true;
+    } catch (const std::exception &e) {
+      std::cerr << "Failed to " << what << ": " << e.what() << std::endl;
+    }
+    std::this_thread::sleep_for(SEND_RETRY_DELAY);
+  }
+  return false;
+}
 
 void runDryNoMoreTelegramBot(const std::string &token,
-                             const std::set<std::int64_t> &userWhitelist,
-                             std::set<std::int64_t> &broadcastChats,
-                             StateWrapper &state, ts_queue<Message> &msgQueue,
-                             const std::atomic<bool> &running) {
-  TgBot::Bot bot(token);
+                             const std::string &apiUrl,
+                             const TgBot::HttpClient &httpClient,
+                             StateWrapper &state, MessageQueue &msgQueue,
+                             const Shutdown &shutdown,
+                             const std::function<void()> &drained) {
+  TgBot::Bot bot(token, httpClient, apiUrl);
 
   std::vector<TgBot::BotCommand::Ptr> commands;
   std::vector<TgBot::EventBroadcaster::MessageListener> commandHandler;
@@ -34,25 +214,17 @@ void runDryNoMoreTelegramBot(const std::string &token,
   });
 
   KeyboardManager menus(settingSnapshot, [&settingSnapshot, &state]() {
-    auto &set = state.settingsWrap;
-    std::scoped_lock lock(set.mut);
-    // Move snapshot settings to actual settings!
-    std::memcpy(&set.settings, &settingSnapshot, sizeof(settingSnapshot));
+    // Publish the edited settings as new version!
+    state.settings.publish(settingSnapshot);
   });
 
   addCommand("edit", "edit the DryNoMore irrigation settings",
              [&](TgBot::Message::Ptr message) {
-               const auto &set = state.settingsWrap;
-               bool valid = false;
-               {
-                 std::scoped_lock lock(set.mut);
-                 if ((valid = set.valid)) {
-                   std::memcpy(&settingSnapshot, &set.settings,
-                               sizeof(settingSnapshot));
-                 }
-               }
+               const auto settings = state.settings.load();
+               if (settings) {
+                 std::memcpy(&settingSnapshot, &settings->value,
+                             sizeof(settingSnapshot));
 
-               if (valid) {
                  api.sendMessage(message->chat->id,
                                  generateSettingsTable(settingSnapshot), false,
                                  0, menus.init(), "Markdown");
@@ -64,20 +236,169 @@ void runDryNoMoreTelegramBot(const std::string &token,
                }
              });
 
+  // Parses "[P<plant>|W<tank>] [<n>h|<n>d|<n>w]" of the history commands,
+  // replies with the usage on errors. Commands without a range pass nullptr.
+  auto parseHistoryArgs = [&api](const TgBot::Message::Ptr &message,
+                                 uint8_t &channel, bool &hasChannel,
+                                 uint32_t *rangeSec) {
+    std::istringstream args(message->text);
+    std::string arg;
+    // skip the command itself
+    args >> arg;
+    const std::string command = arg;
+
+    hasChannel = false;
+    while (args >> arg) {
+      if (!hasChannel && parseChannel(arg, channel)) {
+        hasChannel = true;
+      } else if (!rangeSec || !parseDuration(arg, *rangeSec)) {
+        if (rangeSec) {
+          api.sendMessage(message->chat->id,
+                          "Usage: " + command +
+                              " [P<plant>|W<tank>] [<n>h|<n>d|<n>w]\nE.g. " +
+                              command + " P3 30d");
+        } else {
+          api.sendMessage(message->chat->id,
+                          "Usage: " + command + " [P<plant>|W<tank>]\nE.g. " +
+                              command + " P3");
+        }
+        return false;
+      }
+    }
+    return true;
+  };
+
+  ChartCache chartCache;
+  addCommand(
+      "chart", "moisture & water level history, e.g. /chart P3 30d",
+      [&](TgBot::Message::Ptr message) {
+        uint8_t channel;
+        bool hasChannel;
+        uint32_t rangeSec = DEFAULT_CHART_RANGE_SEC;
+        if (!parseHistoryArgs(message, channel, hasChannel, &rangeSec)) {
+          return;
+        }
+
+        std::string caption;
+        auto *chart = getChart(state, chartCache,
+                               hasChannel ? &channel : nullptr, rangeSec,
+                               caption);
+        if (!chart) {
+          api.sendMessage(message->chat->id, "No history recorded yet!");
+          return;
+        }
+
+        // Telegram keeps uploaded photos, resend them by their file id
+        if (!chart->fileId.empty()) {
+          api.sendPhoto(message->chat->id, chart->fileId, caption);
+          return;
+        }
+        auto file = std::make_shared<TgBot::InputFile>();
+        file->data = chart->png;
+        file->mimeType = "image/png";
+        file->fileName = "chart.png";
+        const auto sent = api.sendPhoto(message->chat->id, file, caption);
+        if (sent && !sent->photo.empty()) {
+          // the largest size is listed last
+          chart->fileId = sent->photo.back()->fileId;
+        }
+      });
+
+  addCommand("history", "measurements of a plant or tank, e.g. /history W1 7d",
+             [&](TgBot::Message::Ptr message) {
+               uint8_t channel;
+               bool hasChannel;
+               uint32_t rangeSec = DEFAULT_CHART_RANGE_SEC;
+               if (!parseHistoryArgs(message, channel, hasChannel, &rangeSec)) {
+                 return;
+               }
+               if (!hasChannel) {
+                 api.sendMessage(message->chat->id,
+                                 "Please name a plant or tank, e.g. "
+                                 "/history P2 7d");
+                 return;
+               }
+
+               const uint32_t now = std::time(nullptr);
+               const auto records = state.history.range(
+                   channel, now > rangeSec ? now - rangeSec : 0, now);
+               sendHistoryTable(api, message->chat->id, records, false,
+                                !HistoryStore::isTankChannel(channel));
+             });
+
+  addCommand("last", "latest measurements, e.g. /last or /last P2",
+             [&](TgBot::Message::Ptr message) {
+               uint8_t channel;
+               bool hasChannel;
+               if (!parseHistoryArgs(message, channel, hasChannel, nullptr)) {
+                 return;
+               }
+
+               std::vector<HistoryRecord> records;
+               for (uint8_t c : hasChannel ? std::vector<uint8_t>{channel}
+                                           : state.history.channels()) {
+                 HistoryRecord record;
+                 if (state.history.last(c, record)) {
+                   records.push_back(record);
+                 }
+               }
+               sendHistoryTable(api, message->chat->id, records, true, false);
+             });
+
+  addCommand(
+      "water", "last irrigations, e.g. /water or /water P2 30d",
+      [&](TgBot::Message::Ptr message) {
+        uint8_t channel;
+        bool hasChannel;
+        uint32_t rangeSec = DEFAULT_WATER_RANGE_SEC;
+        if (!parseHistoryArgs(message, channel, hasChannel, &rangeSec)) {
+          return;
+        }
+
+        std::vector<HistoryRecord> records;
+        if (hasChannel) {
+          // all irrigations of this plant within the range
+          const uint32_t now = std::time(nullptr);
+          records = state.history.waterings(
+              channel, now > rangeSec ? now - rangeSec : 0, now);
+        } else {
+          // the last irrigation of every plant
+          for (uint8_t c : state.history.channels()) {
+            HistoryRecord record;
+            if (state.history.lastWatering(c, record)) {
+              records.push_back(record);
+            }
+          }
+        }
+        sendHistoryTable(api, message->chat->id, records, !hasChannel, true);
+      });
+
+  // Chats that registered through a command since the start, they are not
+  // yet part of the config file
+  std::mutex registeredChatsMutex;
+  std::set<std::int64_t> registeredChats;
+
   // Register callbacks!
   auto &broadcaster = bot.getEvents();
 
   for (size_t i = 0; i < commands.size(); ++i) {
     broadcaster.onCommand(
         commands[i]->command, [&, i](TgBot::Message::Ptr message) {
-          if (!userWhitelist.contains(message->from->id)) {
+          if (!state.config.load()->value.userWhitelist.contains(
+                  message->from->id)) {
             api.sendMessage(message->chat->id,
                             "Access denied! Go get your own bot! User ID: " +
                                 std::to_string(message->from->id));
             return;
           }
           // save the chat ID!
-          broadcastChats.insert(message->chat->id);
+          const std::int64_t chat = message->chat->id;
+          if (state.chats.update([chat](std::set<std::int64_t> &chats) {
+                return chats.insert(chat).second;
+              })) {
+            std::scoped_lock lock(registeredChatsMutex);
+            registeredChats.insert(chat);
+          }
 
           commandHandler[i](message);
         });
@@ -85,73 +406,74 @@ void runDryNoMoreTelegramBot(const std::string &token,
 
   menus.registerActions(api, broadcaster);
 
-  // Set my commands
-  api.setMyCommands(commands);
+  // Set my commands, the bot runs on a network that may not be up yet
+  retryUntilDone(shutdown, "set the bot commands",
+                 [&]() { api.setMyCommands(commands); });
 
-  TgBot::TgLongPoll longPoll(bot);
-  while (running.load(std::memory_order_relaxed)) {
-    // check if the status was not yet published & send update
-    {
-      std::unique_lock lock(state.statusWrap.mut);
-
-      if (state.statusWrap.unpublished) {
-        state.statusWrap.unpublished = false;
-        Status statusCopy;
-        std::memcpy(&statusCopy, &state.statusWrap.status, sizeof(statusCopy));
-        lock.unlock();
-
-        std::string statusUpdate = generateStatusTable(statusCopy);
-        for (std::int64_t chat : broadcastChats) {
-          api.sendMessage(chat, statusUpdate, false, 0,
-                          std::make_shared<TgBot::GenericReply>(), "Markdown");
-        }
+  // The long poll blocks for up to its timeout and cannot be interrupted,
+  // hence it runs on its own thread and never delays the notifications
+  std::thread longPollThread([&bot, &shutdown]() {
+    // the constructor deletes the webhook, i.e. it calls the API as well
+    std::optional<TgBot::TgLongPoll> longPoll;
+    if (!retryUntilDone(shutdown, "start the long poll",
+                        [&]() { longPoll.emplace(bot); })) {
+      return;
+    }
+    while (!shutdown.requested()) {
+      // Handle user input
+      try {
+        longPoll->start();
+      } catch (const TgBot::TgException &e) {
+        std::cerr << "telegram bot error: " << e.what() << std::endl;
+      } catch (const boost::system::system_error &wtf) {
+        std::cerr << "boost system error: " << wtf.what() << std::endl;
+      } catch (const std::exception &dafuq) {
+        std::cerr << "std::exception: " << dafuq.what() << std::endl;
       }
     }
+  });
 
-    // send all messages in the message queue
-    while (running.load(std::memory_order_relaxed) && !msgQueue.empty()) {
-      if (auto msg = msgQueue.limited_wait_for_pop()) {
-        const char *msgPrefix = nullptr;
-        switch (msg->msgType) {
-          case INFO_MSG: {
-            msgPrefix = "INFO: ";
-            break;
-          }
-          case WARN_MSG: {
-            msgPrefix = "WARNING: ";
-            break;
-          }
-          case ERR_MSG: {
-            msgPrefix = "ERROR: ";
-            break;
-          }
-          case FAILURE_MSG: {
-            msgPrefix = "HARDWARE FAILURE: ";
-            break;
-          }
-          default: {
-            std::cerr << "Error invalid message in msgQueue!" << std::endl;
-            continue;
-          }
-        }
-        std::string message = msgPrefix + msg->msg;
+  shutdown.onRequest([&msgQueue]() { msgQueue.interrupt(); });
 
-        for (std::int64_t chat : broadcastChats) {
-          api.sendMessage(chat, message, false, 0,
-                          std::make_shared<TgBot::GenericReply>(), "Markdown");
-        }
-      }
+  uint64_t publishedStatusVersion = 0;
+  auto config = state.config.load();
+  while (!shutdown.requested()) {
+    if (auto latest = state.config.load(); latest != config) {
+      config = std::move(latest);
+      std::scoped_lock lock(registeredChatsMutex);
+      std::set<std::int64_t> chats = config->value.userChats;
+      chats.insert(registeredChats.begin(), registeredChats.end());
+      state.chats.publish(chats);
     }
 
-    // Handle user input
-    try {
-      longPoll.start();
-    } catch (const TgBot::TgException &e) {
-      std::cerr << "telegram bot error: " << e.what() << std::endl;
-    } catch (const boost::system::system_error &wtf) {
-      std::cerr << "boost system error: " << wtf.what() << std::endl;
-    } catch (const std::exception &dafuq) {
-      std::cerr << "std::exception: " << dafuq.what() << std::endl;
+    // check if the status was not yet published & send update
+    if (const auto status = state.status.load();
+        status && status->version != publishedStatusVersion) {
+      publishedStatusVersion = status->version;
+      // a newer status replaces this one anyway, no need to retry it
+      sendNotification(Message::INVALID, [&]() {
+        broadcast(api, state, generateStatusTable(status->value));
+      });
+    }
+
+    // the wait also bounds the delay of status updates
+    if (auto msg = msgQueue.limited_wait_for_pop();
+        msg && !sendNotification(msg->msgType,
+                                 [&]() { broadcast(api, state, *msg); })) {
+      // Keep it while Telegram is unreachable, the queue is bounded
+      msgQueue.requeue(std::move(*msg));
+      std::this_thread::sleep_for(SEND_RETRY_DELAY);
+    }
+  }
+
+  // Deliver what is left, e.g. the last warnings of the status server
+  while (auto msg = msgQueue.try_pop()) {
+    if (!sendNotification(msg->msgType,
+                          [&]() { broadcast(api, state, *msg); })) {
+      break;
     }
   }
+  drained();
+
+  longPollThread.join();
 }
@@ -335,9 +335,7 @@ KeyboardManager::KeyboardManager(Settings &settings,
               (static_cast<uint8_t>(1)
                << ((settings.numPlants - 1) & 7 /*aka mod 8*/));
           // use W1 by default
-          settings.moistSensToWaterSensBitmap[(settings.numPlants - 1) / 8] &=
-              ~(static_cast<uint8_t>(1)
-                << ((settings.numPlants - 1) & 7 /*aka mod 8*/));
+          setWaterSensIdx(settings, settings.numPlants - 1, 0);
           // update the message with the tables
           currentKb->callback(api, settings, query, currentKb);
         }
@@ -356,8 +354,12 @@ KeyboardManager::KeyboardManager(Settings &settings,
       "Clear HW-failure", "clear_hw_failure",
       [](const TgBot::Api &api, Settings &settings,
          TgBot::CallbackQuery::Ptr query, Keyboard *currentKb) {
-        if (settings.hardwareFailure) {
-          settings.hardwareFailure = false;
+        bool anyFailure = false;
+        for (auto &bm : settings.hardwareFailureBitmap) {
+          anyFailure |= bm != 0;
+          bm = 0;
+        }
+        if (anyFailure) {
           // update the message with the tables
           currentKb->callback(api, settings, query, currentKb);
         }
@@ -407,26 +409,24 @@ KeyboardManager::KeyboardManager(Settings &settings,
   // Edit Water settings buttons
   // =================================================================
 
-  auto editW1But = std::make_shared<Button>(
-      "Edit W1", "edit_w1",
-      [editValueInfo](const TgBot::Api &, Settings &, TgBot::CallbackQuery::Ptr,
-                      Keyboard *) {
-        editValueInfo->idx = 0;
-        editValueInfo->isWaterLvl = true;
-      },
-      editWaterDetailLayer);
-
-  auto editW2But = std::make_shared<Button>(
-      "Edit W2", "edit_w2",
-      [editValueInfo](const TgBot::Api &, Settings &, TgBot::CallbackQuery::Ptr,
-                      Keyboard *) {
-        editValueInfo->idx = 1;
-        editValueInfo->isWaterLvl = true;
-      },
-      editWaterDetailLayer);
+  {
+    std::vector<std::shared_ptr<Button>> buttons;
+    buttons.reserve(MAX_WATER_SENSOR_COUNT);
+    for (unsigned i = 0; i < MAX_WATER_SENSOR_COUNT; ++i) {
+      auto but = std::make_shared<Button>(
+          "Edit W" + std::to_string(i + 1), "edit_w" + std::to_string(i + 1),
+          [editValueInfo, i](const TgBot::Api &, Settings &,
+                             TgBot::CallbackQuery::Ptr, Keyboard *) {
+            editValueInfo->idx = i;
+            editValueInfo->isWaterLvl = true;
+          },
+          editWaterDetailLayer);
+      buttons.push_back(but);
+    }
 
-  Keyboard::addRow(editWaterLayer, {editW1But, editW2But});
-  Keyboard::addRow(editWaterLayer, {backBut});
+    Keyboard::addRow(editWaterLayer, std::move(buttons));
+    Keyboard::addRow(editWaterLayer, {backBut});
+  }
 
   auto editWarnThresBut = std::make_shared<Button>(
       "Edit warn thres", "edit_warn_thres",
@@ -523,8 +523,10 @@ KeyboardManager::KeyboardManager(Settings &settings,
       "Toggle water sens", "toggle_water_sens",
       [editValueInfo](const TgBot::Api &api, Settings &settings,
                       TgBot::CallbackQuery::Ptr query, Keyboard *currentKb) {
-        settings.moistSensToWaterSensBitmap[editValueInfo->idx / 8] ^=
-            (static_cast<uint8_t>(1) << (editValueInfo->idx & 7 /*aka mod 8*/));
+        // cycle through the available water sensors
+        setWaterSensIdx(settings, editValueInfo->idx,
+                        (getWaterSensIdx(settings, editValueInfo->idx) + 1) %
+                            MAX_WATER_SENSOR_COUNT);
 
         // update the message with the tables
         currentKb->callback(api, settings, query, currentKb);
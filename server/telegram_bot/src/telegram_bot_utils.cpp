@@ -1,3 +1,6 @@
+#include <cctype>
+#include <ctime>
+#include <iomanip>
 #include <sstream>
 
 #include "telegram_bot_utils.hpp"
@@ -112,7 +115,7 @@ std::string generateTable(const std::vector<std::vector<std::string>> &table,
 
 std::string generateWaterSettingsTable(const Settings &settings) {
   std::vector<std::vector<std::string>> table;
-  table.reserve(1 + 2);
+  table.reserve(1 + MAX_WATER_SENSOR_COUNT);
 
   std::vector<bool> printLeftWhitespace = {false, true, true, true, true};
   std::vector<bool> printRightWhitespace = {false, true, true, false, false};
@@ -120,7 +123,7 @@ std::string generateWaterSettingsTable(const Settings &settings) {
                                "Empty\nThres"};
   table.push_back(std::move(row));
 
-  for (int i = 0; i < 2; ++i) {
+  for (int i = 0; i < MAX_WATER_SENSOR_COUNT; ++i) {
     row = {"W" + std::to_string(i + 1),
            std::to_string(
                settings.sensConfs[(MAX_MOISTURE_SENSOR_COUNT) + i].minValue),
@@ -148,15 +151,13 @@ std::string generateMoistSettingsTable(const Settings &settings) {
   table.push_back(std::move(row));
 
   for (int i = 0; i < settings.numPlants; ++i) {
-    uint8_t sensorIdx =
-        (settings.moistSensToWaterSensBitmap[i / 8] >> (i & 7 /*aka mod 8*/)) &
-        0x01;
+    uint8_t sensorIdx = getWaterSensIdx(settings, i);
     uint8_t skip = (settings.skipBitmap[i / 8] >> (i & 7 /*aka mod 8*/)) & 0x01;
     row = {"P" + std::to_string(i + 1),
            std::to_string(settings.sensConfs[i].minValue),
            std::to_string(settings.sensConfs[i].maxValue),
            std::to_string(settings.targetMoisture[i]) + " %",
-           sensorIdx ? "W2" : "W1",
+           "W" + std::to_string(sensorIdx + 1),
            skip ? "yes" : "no"};
     table.push_back(std::move(row));
   }
@@ -185,14 +186,48 @@ std::string generateMoistSettingsTable(const Settings &settings) {
 }
 
 std::string generateSettingsTable(const Settings &settings) {
-  return (settings.hardwareFailure ? "Hardware Failure: true\n"
-                                   : "Hardware Failure: false\n") +
+  std::string hardwareFailures;
+  for (int i = 0; i < MAX_MOISTURE_SENSOR_COUNT; ++i) {
+    if (hasHardwareFailure(settings, i)) {
+      hardwareFailures += (hardwareFailures.empty() ? "P" : ", P") +
+                          std::to_string(i + 1);
+    }
+  }
+  return "Hardware Failure: " +
+         (hardwareFailures.empty() ? "none" : hardwareFailures) + '\n' +
          std::string(settings.debug ? "Debug Mode: true\n"
                                     : "Debug Mode: false\n") +
          generateMoistSettingsTable(settings) +
          generateWaterSettingsTable(settings);
 }
 
+std::string generateTuningTable(const Settings &current,
+                                const Settings &proposal) {
+  std::vector<std::vector<std::string>> table;
+  table.reserve(1 + current.numPlants);
+
+  std::vector<std::string> row{"ID", "Burst\nLen", "Burst\nDelay",
+                               "Max #\nBursts", "Tick\nb/w\nWat"};
+  table.push_back(std::move(row));
+
+  auto cell = [](uint8_t from, uint8_t to) {
+    return from == to ? std::to_string(from)
+                      : std::to_string(from) + ">" + std::to_string(to);
+  };
+
+  for (int i = 0; i < current.numPlants; ++i) {
+    row = {"P" + std::to_string(i + 1),
+           cell(current.burstDuration[i], proposal.burstDuration[i]),
+           cell(current.burstDelay[i], proposal.burstDelay[i]),
+           cell(current.maxBursts[i], proposal.maxBursts[i]),
+           cell(current.ticksBetweenIrrigation[i],
+                proposal.ticksBetweenIrrigation[i])};
+    table.push_back(std::move(row));
+  }
+
+  return generateTable(table);
+}
+
 std::string generateStatusTable(const Status &status) {
   std::vector<std::vector<std::string>> table;
   table.reserve(1 + status.numPlants);
@@ -263,6 +298,141 @@ std::string generateStatusTable(const Status &status) {
 
   std::string rawSensorReadingsTable(generateTable(table));
 
-  return "Plant Status:\n" + moistureSensorTable + "Water-level Status:\n" +
-         waterSensorTable + "Raw Sensor Readings:\n" + rawSensorReadingsTable;
+  std::string cycleStart;
+  if (status.cycleStartTime != 0) {
+    const std::time_t t = status.cycleStartTime;
+    std::tm tm;
+    localtime_r(&t, &tm);
+    std::stringstream ss;
+    ss << "Cycle started: " << std::put_time(&tm, "%F %T") << '\n';
+    cycleStart = ss.str();
+  }
+  if (status.supplyMilliVolt != 0) {
+    std::stringstream ss;
+    ss << "Supply: " << std::fixed << std::setprecision(2)
+       << status.supplyMilliVolt / 1000.0 << " V\n";
+    cycleStart += ss.str();
+  }
+
+  return cycleStart + "Plant Status:\n" + moistureSensorTable +
+         "Water-level Status:\n" + waterSensorTable +
+         "Raw Sensor Readings:\n" + rawSensorReadingsTable;
+}
+
+std::string generateHistoryTable(const std::vector<HistoryRecord> &records,
+                                 bool withChannel, bool withWatering,
+                                 size_t maxRows) {
+  std::vector<std::vector<std::string>> table;
+  const size_t first = records.size() > maxRows ? records.size() - maxRows : 0;
+  table.reserve(1 + records.size() - first);
+
+  std::vector<std::string> row;
+  if (withChannel) {
+    row.push_back("ID");
+  }
+  row.insert(row.end(), {"Time", "Before", "After"});
+  if (withWatering) {
+    row.insert(row.end(), {"Rise", "Bursts"});
+  }
+  table.push_back(std::move(row));
+
+  auto level = [](uint8_t value) {
+    return (value != UNDEFINED_LEVEL_8 ? std::to_string(value) : "--") + " %";
+  };
+
+  for (size_t i = first; i < records.size(); ++i) {
+    const auto &r = records[i];
+    row.clear();
+    if (withChannel) {
+      row.push_back(HistoryStore::channelName(r.channel));
+    }
+
+    const std::time_t time = r.time;
+    std::tm tm;
+    localtime_r(&time, &tm);
+    std::stringstream ss;
+    ss << std::put_time(&tm, "%m-%d %H:%M");
+    row.insert(row.end(), {ss.str(), level(r.before), level(r.after)});
+
+    if (withWatering) {
+      row.push_back(r.before != UNDEFINED_LEVEL_8 &&
+                            r.after != UNDEFINED_LEVEL_8
+                        ? std::to_string(static_cast<int>(r.after) - r.before) +
+                              " %"
+                        : "--");
+      row.push_back(r.bursts != UNDEFINED_LEVEL_8 ? std::to_string(r.bursts)
+                                                  : "--");
+    }
+    table.push_back(std::move(row));
+  }
+
+  std::string result = generateTable(table);
+  if (first != 0) {
+    result += std::to_string(first) + " older entries omitted\n";
+  }
+  return result;
+}
+
+bool parseChannel(const std::string &str, uint8_t &channel) {
+  if (str.size() < 2) {
+    return false;
+  }
+  const char type = static_cast<char>(std::toupper(str[0]));
+  const bool isTank = type == 'W';
+  if (!isTank && type != 'P') {
+    return false;
+  }
+  unsigned long idx;
+  try {
+    size_t end;
+    idx = std::stoul(str.substr(1), &end);
+    if (end != str.size() - 1) {
+      return false;
+    }
+  } catch (const std::exception &) {
+    return false;
+  }
+  const unsigned long count =
+      isTank ? MAX_WATER_SENSOR_COUNT : MAX_MOISTURE_SENSOR_COUNT;
+  if (idx == 0 || idx > count) {
+    return false;
+  }
+  channel = isTank ? HistoryStore::tankChannel(idx - 1)
+                   : HistoryStore::plantChannel(idx - 1);
+  return true;
+}
+
+bool parseDuration(const std::string &str, uint32_t &seconds) {
+  unsigned long value;
+  size_t end;
+  try {
+    value = std::stoul(str, &end);
+  } catch (const std::exception &) {
+    return false;
+  }
+  if (end + 1 != str.size() || value == 0) {
+    return false;
+  }
+  unsigned long unit;
+  switch (std::tolower(str[end])) {
+    case 'h': {
+      unit = 60 * 60;
+      break;
+    }
+    case 'd': {
+      unit = 24 * 60 * 60;
+      break;
+    }
+    case 'w': {
+      unit = 7 * 24 * 60 * 60;
+      break;
+    }
+    default: {
+      return false;
+    }
+  }
+  // at most a year
+  value = std::min(value, 365 * 24 * 60 * 60 / unit);
+  seconds = static_cast<uint32_t>(value * unit);
+  return true;
 }
@@ -0,0 +1,118 @@
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "trace.hpp"
+
+std::atomic<bool> Trace::enabled(false);
+
+// Written by its thread only. dump() reads it concurrently and drops the
+// events that might have been overwritten while copying, like a seqlock.
+struct TraceRing {
+  explicit TraceRing(uint8_t thread) : thread(thread), head(0) {}
+
+  const uint8_t thread;
+  // number of events recorded so far
+  std::atomic<uint64_t> head;
+  TraceRecord records[Trace::RING_SIZE];
+};
+
+static std::mutex ringsMutex;
+// Rings of exited threads are kept to dump their last events
+static std::vector<std::shared_ptr<TraceRing>> rings;
+
+static TraceRing &threadRing() {
+  thread_local const std::shared_ptr<TraceRing> ring = []() {
+    std::scoped_lock lock(ringsMutex);
+    rings.push_back(
+        std::make_shared<TraceRing>(static_cast<uint8_t>(rings.size())));
+    return rings.back();
+  }();
+  return *ring;
+}
+
+static int64_t toNs(std::chrono::nanoseconds time) { return time.count(); }
+
+const char *Trace::eventName(uint8_t event) {
+  switch (static_cast<Event>(event)) {
+    case ACCEPT:
+      return "accept";
+    case READ:
+      return "read";
+    case PARSE:
+      return "parse";
+    case STATE_UPDATE:
+      return "state_update";
+    case REPLY:
+      return "reply";
+    case CLOSE:
+      return "close";
+    case TELEGRAM_SEND:
+      return "telegram_send";
+    case TELEGRAM_SENT:
+      return "telegram_sent";
+  }
+  return "unknown";
+}
+
+void Trace::record(Event event, uint32_t id, uint32_t arg) {
+  TraceRing &ring = threadRing();
+  const uint64_t head = ring.head.load(std::memory_order_relaxed);
+  ring.records[head % RING_SIZE] = TraceRecord{
+      static_cast<uint64_t>(
+          toNs(std::chrono::steady_clock::now().time_since_epoch())),
+      id, arg, event, ring.thread};
+  ring.head.store(head + 1, std::memory_order_release);
+}
+
+bool Trace::dump(const std::string &path) {
+  std::vector<TraceRecord> records;
+  {
+    std::scoped_lock lock(ringsMutex);
+    for (const auto &ring : rings) {
+      const uint64_t end = ring->head.load(std::memory_order_acquire);
+      const uint64_t begin = end > RING_SIZE ? end - RING_SIZE : 0;
+      const size_t offset = records.size();
+      for (uint64_t i = begin; i < end; ++i) {
+        records.push_back(ring->records[i % RING_SIZE]);
+      }
+
+      // The event being recorded right now overwrites the oldest one
+      std::atomic_thread_fence(std::memory_order_acquire);
+      const uint64_t now = ring->head.load(std::memory_order_relaxed);
+      const uint64_t valid = now >= RING_SIZE ? now - RING_SIZE + 1 : 0;
+      if (valid > begin) {
+        records.erase(records.begin() + offset,
+                      records.begin() + offset +
+                          std::min(valid - begin, end - begin));
+      }
+    }
+  }
+
+  std::sort(records.begin(), records.end(),
+            [](const TraceRecord &a, const TraceRecord &b) {
+              return a.timeNs < b.timeNs;
+            });
+
+  const TraceFileHeader header{
+      TRACE_MAGIC, TRACE_VERSION, sizeof(TraceRecord),
+      toNs(std::chrono::system_clock::now().time_since_epoch()) -
+          toNs(std::chrono::steady_clock::now().time_since_epoch()),
+      static_cast<uint32_t>(records.size())};
+
+  std::ofstream out(path, std::ios::binary | std::ios::trunc);
+  out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+  out.write(reinterpret_cast<const char *>(records.data()),
+            records.size() * sizeof(TraceRecord));
+  if (!out) {
+    std::cerr << "Failed to write the trace to " << path << std::endl;
+    return false;
+  }
+  std::cout << "Wrote " << records.size() << " trace events to " << path
+            << std::endl;
+  return true;
+}
@@ -0,0 +1,125 @@
+#include <cstring>
+#include <gtest/gtest.h>
+
+#include "anomaly_detector.hpp"
+
+static Status plantStatus(uint16_t raw) {
+  Status status;
+  std::memset(&status, 0xFF, sizeof(status));
+  status.numPlants = 1;
+  status.numWaterSensors = 0;
+  status.beforeMoistureLevelsRaw[0] = raw;
+  return status;
+}
+
+// A plant below its target next to a full tank, the moisture did not change
+static Status dryPlantStatus(uint8_t bursts) {
+  Status status = plantStatus(500);
+  status.numWaterSensors = 1;
+  status.beforeMoistureLevels[0] = 30;
+  status.afterMoistureLevels[0] = 30;
+  status.afterWaterLevels[0] = 80;
+  status.bursts[0] = bursts;
+  return status;
+}
+
+static Settings dryPlantSettings() {
+  Settings settings;
+  std::memset(&settings, 0, sizeof(settings));
+  settings.numPlants = 1;
+  settings.targetMoisture[0] = 50;
+  settings.waterLvlThres[0].emptyThres = 10;
+  return settings;
+}
+
+static bool hasNoGain(const std::vector<Anomaly> &anomalies) {
+  for (const auto &anomaly : anomalies) {
+    if (anomaly.kind == Anomaly::NO_MOISTURE_GAIN) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static bool isStuck(const std::vector<Anomaly> &anomalies) {
+  for (const auto &anomaly : anomalies) {
+    if (anomaly.kind == Anomaly::STUCK_VALUE) {
+      return true;
+    }
+  }
+  return false;
+}
+
+TEST(AnomalyDetector, StuckWithinTheToleranceAfterTheWindow) {
+  AnomalyConfig conf;
+  AnomalyDetector detector(conf);
+
+  // the first reading starts the run
+  for (uint8_t i = 0; i < conf.stuckReadings; ++i) {
+    EXPECT_FALSE(isStuck(detector.analyze(1, plantStatus(500 + i % 2),
+                                          nullptr)));
+  }
+  EXPECT_TRUE(isStuck(detector.analyze(1, plantStatus(501), nullptr)));
+}
+
+TEST(AnomalyDetector, DryingSoilIsNotStuck) {
+  AnomalyConfig conf;
+  AnomalyDetector detector(conf);
+
+  for (uint16_t i = 0; i < 3 * conf.stuckReadings; ++i) {
+    EXPECT_FALSE(isStuck(detector.analyze(1, plantStatus(500 + i), nullptr)));
+  }
+}
+
+TEST(AnomalyDetector, DevicesAreTrackedSeparately) {
+  AnomalyConfig conf;
+  AnomalyDetector detector(conf);
+
+  // both report the same reading alternately, each only counts its own
+  for (uint8_t i = 0; i < conf.stuckReadings / 2; ++i) {
+    EXPECT_FALSE(isStuck(detector.analyze(1, plantStatus(500), nullptr)));
+    EXPECT_FALSE(isStuck(detector.analyze(2, plantStatus(500), nullptr)));
+  }
+  // another device interleaving different readings does not reset the run
+  for (uint8_t i = conf.stuckReadings / 2; i < conf.stuckReadings; ++i) {
+    EXPECT_FALSE(isStuck(detector.analyze(1, plantStatus(500), nullptr)));
+    EXPECT_FALSE(isStuck(detector.analyze(2, plantStatus(300 + 2 * i),
+                                          nullptr)));
+  }
+  EXPECT_TRUE(isStuck(detector.analyze(1, plantStatus(500), nullptr)));
+}
+
+TEST(AnomalyDetector, NoGainAfterBursts) {
+  AnomalyConfig conf;
+  AnomalyDetector detector(conf);
+  const Settings settings = dryPlantSettings();
+
+  for (uint8_t i = 1; i < conf.noGainCycles; ++i) {
+    EXPECT_FALSE(hasNoGain(detector.analyze(1, dryPlantStatus(2), &settings)));
+  }
+  EXPECT_TRUE(hasNoGain(detector.analyze(1, dryPlantStatus(2), &settings)));
+}
+
+TEST(AnomalyDetector, DryPlantWithoutBurstsHasNoGainToCheck) {
+  AnomalyConfig conf;
+  AnomalyDetector detector(conf);
+  const Settings settings = dryPlantSettings();
+
+  // e.g. the controller lowered the target on a low battery
+  for (uint8_t i = 0; i < 3 * conf.noGainCycles; ++i) {
+    EXPECT_FALSE(hasNoGain(detector.analyze(1, dryPlantStatus(0), &settings)));
+  }
+}
+
+TEST(AnomalyDetector, LegacyReportsCompareWithTheTarget) {
+  AnomalyConfig conf;
+  AnomalyDetector detector(conf);
+  const Settings settings = dryPlantSettings();
+
+  for (uint8_t i = 1; i < conf.noGainCycles; ++i) {
+    EXPECT_FALSE(hasNoGain(
+        detector.analyze(1, dryPlantStatus(UNDEFINED_LEVEL_8), &settings)));
+  }
+  EXPECT_TRUE(hasNoGain(
+      detector.analyze(1, dryPlantStatus(UNDEFINED_LEVEL_8), &settings)));
+}
@@ -0,0 +1,85 @@
+#include <cstring>
+#include <ctime>
+#include <filesystem>
+#include <gtest/gtest.h>
+#include <unistd.h>
+
+#include "history_store.hpp"
+
+namespace fs = std::filesystem;
+
+static Status plantStatus(uint8_t moisture) {
+  Status status;
+  std::memset(&status, 0xFF, sizeof(status));
+  status.numPlants = 1;
+  status.numWaterSensors = 0;
+  status.beforeMoistureLevels[0] = moisture;
+  return status;
+}
+
+class HistoryFile : public ::testing::Test {
+protected:
+  void SetUp() override {
+    path = (fs::temp_directory_path() /
+            ("drynomore_history_test_" + std::to_string(::getpid()) + ".bin"))
+               .string();
+    fs::remove(path);
+  }
+  void TearDown() override { fs::remove(path); }
+
+  std::string path;
+};
+
+TEST(HistoryStore, DropsRecordsOlderThanTheMaxAge) {
+  HistoryStore history;
+  history.setMaxAge(100);
+  history.record(plantStatus(10), 1000);
+  history.record(plantStatus(20), 1050);
+  history.record(plantStatus(30), 1120);
+
+  const auto records = history.range(HistoryStore::plantChannel(0), 0, 2000);
+  ASSERT_EQ(records.size(), 2u);
+  EXPECT_EQ(records[0].time, 1050u);
+  EXPECT_EQ(records[1].time, 1120u);
+}
+
+TEST_F(HistoryFile, CompactsTheFileOnLoad) {
+  const uint32_t now = static_cast<uint32_t>(std::time(nullptr));
+  const uint32_t day = 24 * 60 * 60;
+  {
+    HistoryStore history;
+    history.setMaxAge(0);
+    ASSERT_TRUE(history.open(path));
+    history.record(plantStatus(10), now - 10 * day);
+    history.record(plantStatus(20), now - 5 * day);
+    history.record(plantStatus(30), now);
+  }
+  {
+    HistoryStore history;
+    history.setMaxAge(7 * day);
+    ASSERT_TRUE(history.open(path));
+    EXPECT_EQ(history.range(HistoryStore::plantChannel(0), 0, now).size(), 2u);
+  }
+  // the expired record is gone from the file as well
+  HistoryStore history;
+  history.setMaxAge(0);
+  ASSERT_TRUE(history.open(path));
+  const auto records = history.range(HistoryStore::plantChannel(0), 0, now);
+  ASSERT_EQ(records.size(), 2u);
+  EXPECT_EQ(records[0].before, 20);
+  EXPECT_EQ(records[1].before, 30);
+}
+
+TEST_F(HistoryFile, CompactsTheFileWhileAppending) {
+  HistoryStore history;
+  history.setMaxAge(100);
+  ASSERT_TRUE(history.open(path));
+  for (uint32_t time = 1; time <= 5000; ++time) {
+    history.record(plantStatus(time % 100), time);
+  }
+
+  // the kept records and at most the expired ones below the compaction
+  // threshold
+  EXPECT_LT(fs::file_size(path), 2048 * sizeof(HistoryRecord));
+  EXPECT_EQ(history.range(HistoryStore::plantChannel(0), 0, 5000).size(), 101u);
+}
@@ -0,0 +1,92 @@
+#include <gtest/gtest.h>
+
+#include "message_queue.hpp"
+
+static Message info(const char *text, uint32_t deviceId = 1) {
+  return Message(text, Message::INFO_MSG, deviceId);
+}
+
+static size_t count(const std::string &text, const std::string &part) {
+  size_t n = 0;
+  for (size_t pos = text.find(part); pos != std::string::npos;
+       pos = text.find(part, pos + 1)) {
+    ++n;
+  }
+  return n;
+}
+
+TEST(MessageQueue, CoalescesRepeatsOfTheSameDevice) {
+  MessageQueue queue(60);
+  queue.push(info("dry"));
+  queue.push(info("dry"));
+  queue.push(info("dry"));
+  queue.push(info("dry", 2));
+
+  auto msg = queue.try_pop();
+  ASSERT_TRUE(msg);
+  EXPECT_EQ(msg->msg, "dry");
+  EXPECT_EQ(msg->deviceId, 1u);
+  EXPECT_EQ(msg->repeats, 2u);
+  EXPECT_EQ(count(msg->text(), "repeated 2 times"), 1u);
+
+  msg = queue.try_pop();
+  ASSERT_TRUE(msg);
+  EXPECT_EQ(msg->deviceId, 2u);
+  EXPECT_EQ(msg->repeats, 0u);
+  EXPECT_EQ(msg->text(), "dry");
+  EXPECT_FALSE(queue.try_pop());
+}
+
+TEST(MessageQueue, RequeueKeepsTheKeyAndAnnotatesOnce) {
+  MessageQueue queue(60);
+  queue.push(info("dry"));
+  queue.push(info("dry"));
+
+  for (int retry = 0; retry < 3; ++retry) {
+    auto msg = queue.try_pop();
+    ASSERT_TRUE(msg);
+    EXPECT_EQ(msg->msg, "dry");
+    queue.requeue(std::move(*msg));
+    // coalesced into the requeued copy instead of being queued again
+    queue.push(info("dry"));
+  }
+
+  auto msg = queue.try_pop();
+  ASSERT_TRUE(msg);
+  EXPECT_EQ(msg->msg, "dry");
+  EXPECT_EQ(msg->repeats, 4u);
+  EXPECT_EQ(count(msg->text(), "(repeated"), 1u);
+  EXPECT_FALSE(queue.try_pop());
+}
+
+TEST(MessageQueue, RequeueKeepsThePendingChats) {
+  MessageQueue queue(60);
+  queue.push(info("dry"));
+  auto msg = queue.try_pop();
+  ASSERT_TRUE(msg);
+  msg->pendingChats = {42};
+  queue.requeue(std::move(*msg));
+
+  msg = queue.try_pop();
+  ASSERT_TRUE(msg);
+  EXPECT_EQ(msg->pendingChats, std::vector<std::int64_t>{42});
+}
+
+TEST(MessageQueue, DropsTheLowestPriorityWhenFull) {
+  MessageQueue queue(0, 2);
+  queue.push(info("a"));
+  queue.push(Message("b", Message::FAILURE_MSG));
+  queue.push(Message("c", Message::WARN_MSG));
+
+  auto msg = queue.try_pop();
+  ASSERT_TRUE(msg);
+  EXPECT_EQ(msg->msg, "b");
+  EXPECT_EQ(msg->dropped, 1u);
+  EXPECT_EQ(count(msg->text(), "1 less important messages were dropped"), 1u);
+
+  msg = queue.try_pop();
+  ASSERT_TRUE(msg);
+  EXPECT_EQ(msg->msg, "c");
+  EXPECT_EQ(msg->dropped, 0u);
+  EXPECT_FALSE(queue.try_pop());
+}
@@ -0,0 +1,110 @@
+#include <cstring>
+#include <gtest/gtest.h>
+#include <random>
+
+#include "settings_delta.hpp"
+
+static Settings randomSettings(std::mt19937 &rng) {
+  Settings settings;
+  uint8_t *bytes = reinterpret_cast<uint8_t *>(&settings);
+  for (size_t i = 0; i < sizeof(settings); ++i) {
+    bytes[i] = static_cast<uint8_t>(rng());
+  }
+  return settings;
+}
+
+static bool equal(const Settings &a, const Settings &b) {
+  return std::memcmp(&a, &b, sizeof(Settings)) == 0;
+}
+
+TEST(SettingsHash, NeverUnknownAndSensitiveToEveryByte) {
+  std::mt19937 rng(1);
+  for (int i = 0; i < 1000; ++i) {
+    EXPECT_NE(settingsHash(randomSettings(rng)), SETTINGS_HASH_UNKNOWN);
+  }
+
+  const Settings settings = randomSettings(rng);
+  for (size_t i = 0; i < sizeof(Settings); ++i) {
+    Settings changed = settings;
+    reinterpret_cast<uint8_t *>(&changed)[i] ^= 0x01;
+    EXPECT_NE(settingsHash(changed), settingsHash(settings)) << "byte " << i;
+  }
+}
+
+TEST(SettingsDelta, RoundTrip) {
+  std::mt19937 rng(2);
+  for (int i = 0; i < 1000; ++i) {
+    const Settings from = randomSettings(rng);
+    Settings to = from;
+    uint8_t *bytes = reinterpret_cast<uint8_t *>(&to);
+    for (unsigned changes = rng() % 8; changes-- > 0;) {
+      bytes[rng() % sizeof(Settings)] = static_cast<uint8_t>(rng());
+    }
+
+    std::vector<uint8_t> delta;
+    encodeSettingsDelta(from, to, delta);
+    if (equal(from, to)) {
+      EXPECT_TRUE(delta.empty());
+    }
+
+    Settings applied = from;
+    ASSERT_TRUE(applySettingsDelta(applied, delta.data(), delta.size(),
+                                   settingsHash(to)));
+    EXPECT_TRUE(equal(applied, to));
+  }
+}
+
+TEST(SettingsDelta, CompletelyChangedSettings) {
+  std::mt19937 rng(3);
+  const Settings from = randomSettings(rng);
+  Settings to = from;
+  uint8_t *bytes = reinterpret_cast<uint8_t *>(&to);
+  for (size_t i = 0; i < sizeof(Settings); ++i) {
+    bytes[i] = ~bytes[i];
+  }
+
+  std::vector<uint8_t> delta;
+  encodeSettingsDelta(from, to, delta);
+  Settings applied = from;
+  ASSERT_TRUE(applySettingsDelta(applied, delta.data(), delta.size(),
+                                 settingsHash(to)));
+  EXPECT_TRUE(equal(applied, to));
+}
+
+TEST(SettingsDelta, RejectsTruncatedDeltasAndWrongBases) {
+  std::mt19937 rng(4);
+  const Settings from = randomSettings(rng);
+  Settings to = from;
+  reinterpret_cast<uint8_t *>(&to)[0] ^= 0xFF;
+  reinterpret_cast<uint8_t *>(&to)[sizeof(Settings) - 1] ^= 0xFF;
+
+  std::vector<uint8_t> delta;
+  encodeSettingsDelta(from, to, delta);
+  for (size_t size = 0; size < delta.size(); ++size) {
+    Settings applied = from;
+    EXPECT_FALSE(
+        applySettingsDelta(applied, delta.data(), size, settingsHash(to)));
+    EXPECT_TRUE(equal(applied, from));
+  }
+
+  Settings other = randomSettings(rng);
+  const Settings before = other;
+  EXPECT_FALSE(applySettingsDelta(other, delta.data(), delta.size(),
+                                  settingsHash(to)));
+  EXPECT_TRUE(equal(other, before));
+}
+
+TEST(SettingsHistory, KeepsTheRecentSettings) {
+  std::mt19937 rng(5);
+  SettingsHistory history;
+  std::vector<Settings> remembered;
+  for (int i = 0; i < 20; ++i) {
+    remembered.push_back(randomSettings(rng));
+    history.remember(settingsHash(remembered.back()), remembered.back());
+  }
+
+  const Settings *last = history.find(settingsHash(remembered.back()));
+  ASSERT_NE(last, nullptr);
+  EXPECT_TRUE(equal(*last, remembered.back()));
+  EXPECT_EQ(history.find(settingsHash(remembered.front())), nullptr);
+}
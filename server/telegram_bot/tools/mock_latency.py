@@ -0,0 +1,147 @@
+#!/usr/bin/env python3
+# Smoke & latency test of the bot against drynomore-mock-bot-api: starts both
+# on free ports, sends /start from a whitelisted user and measures the time
+# from queueing the update until the bot's reply reaches the mock. Fails if a
+# reply is missing or the median latency exceeds --max-ms.
+#
+# Usage: tools/mock_latency.py --bot build/drynomore-telegram-bot
+#            --mock build/drynomore-mock-bot-api [--rounds 20]
+#            [--latency-ms 20] [--max-ms 500]
+
+import argparse
+import json
+import os
+import socket
+import statistics
+import subprocess
+import sys
+import tempfile
+import time
+import urllib.request
+
+USER_ID = 42
+REPLY_TEXT = "Howdy!"
+
+
+def free_port():
+    with socket.socket() as sock:
+        sock.bind(("127.0.0.1", 0))
+        return sock.getsockname()[1]
+
+
+def mock_call(base_url, path, method="POST"):
+    request = urllib.request.Request(base_url + path, method=method)
+    with urllib.request.urlopen(request, timeout=10) as response:
+        return json.load(response)
+
+
+def recorded_calls(base_url, since=0):
+    return mock_call(base_url, "/mock/calls?since=%d" % since, "GET")["calls"]
+
+
+def wait_for_call(base_url, since, predicate, timeout_sec):
+    deadline = time.monotonic() + timeout_sec
+    while time.monotonic() < deadline:
+        for call in recorded_calls(base_url, since):
+            if predicate(call):
+                return call
+        time.sleep(0.01)
+    return None
+
+
+def wait_for_mock(base_url, process, timeout_sec):
+    deadline = time.monotonic() + timeout_sec
+    while time.monotonic() < deadline and process.poll() is None:
+        try:
+            return recorded_calls(base_url)
+        except OSError:
+            time.sleep(0.05)
+    return None
+
+
+def measure(args, work_dir, processes):
+    mock_port = free_port()
+    base_url = "http://127.0.0.1:%d" % mock_port
+    mock = subprocess.Popen(
+        [args.mock, str(mock_port), "--latency", str(args.latency_ms)],
+        stdout=subprocess.DEVNULL)
+    processes.append(mock)
+    if wait_for_mock(base_url, mock, 10) is None:
+        print("FAIL: the mock did not start")
+        return None
+
+    config = os.path.join(work_dir, "config.yaml")
+    with open(config, "w") as out:
+        out.write("token: 'mock'\n"
+                  "api_url: '%s'\n"
+                  "user_whitelist:\n  - %d\n"
+                  "user_chats:\n  - %d\n"
+                  "tcp_port: %d\n"
+                  "history_file: ''\n"
+                  % (base_url, USER_ID, USER_ID, free_port()))
+    processes.append(subprocess.Popen([args.bot, config], cwd=work_dir,
+                                      stdout=subprocess.DEVNULL))
+
+    # the commands are set once the bot is up
+    if wait_for_call(base_url, 0,
+                     lambda call: call["method"] == "setMyCommands",
+                     30) is None:
+        print("FAIL: the bot did not set its commands")
+        return None
+
+    latencies = []
+    for _ in range(args.rounds):
+        calls = recorded_calls(base_url)
+        since = calls[-1]["seq"] if calls else 0
+        queued = mock_call(
+            base_url, "/mock/message?chat_id=%d&text=/start" % USER_ID)
+        reply = wait_for_call(
+            base_url, since,
+            lambda call: call["method"] == "sendMessage" and
+            call["params"].get("chat_id") == str(USER_ID) and
+            call["params"].get("text") == REPLY_TEXT, 30)
+        if reply is None:
+            print("FAIL: no reply to /start")
+            return None
+        latencies.append((reply["time_us"] - queued["time_us"]) / 1000)
+    return latencies
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("--bot", required=True)
+    parser.add_argument("--mock", required=True)
+    parser.add_argument("--rounds", type=int, default=20)
+    parser.add_argument("--latency-ms", type=int, default=20)
+    parser.add_argument("--max-ms", type=float, default=500)
+    args = parser.parse_args()
+
+    # the bot writes its config back on exit, the processes are stopped
+    # before the work dir is removed
+    with tempfile.TemporaryDirectory() as work_dir:
+        processes = []
+        try:
+            latencies = measure(args, work_dir, processes)
+        finally:
+            for process in reversed(processes):
+                process.terminate()
+                try:
+                    process.wait(timeout=10)
+                except subprocess.TimeoutExpired:
+                    process.kill()
+    if latencies is None:
+        return 1
+
+    median = statistics.median(latencies)
+    print("reply latency over %d rounds with %d ms API latency: "
+          "min %.1f ms, median %.1f ms, max %.1f ms"
+          % (len(latencies), args.latency_ms, min(latencies), median,
+             max(latencies)))
+    if median > args.max_ms:
+        print("FAIL: median latency exceeds %.1f ms" % args.max_ms)
+        return 1
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
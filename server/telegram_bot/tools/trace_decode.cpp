@@ -0,0 +1,189 @@
+// Decoder of the trace files written by the server on SIGUSR1, see trace.hpp.
+//
+// Usage: ./drynomore-trace-decode <trace file> [--slowest <n>] [--quiet]
+//
+// Prints every event with the time passed since the previous event of the
+// same connection or notification, followed by latency percentiles and the n
+// slowest connections & notifications. --quiet only prints the summary.
+
+#include <algorithm>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "lan_protocol.hpp"
+#include "trace.hpp"
+
+#define DEFAULT_SLOWEST 10
+
+static const char *packetName(uint32_t type) {
+  switch (type) {
+    case INFO_MSG:
+      return "INFO_MSG";
+    case WARN_MSG:
+      return "WARN_MSG";
+    case ERR_MSG:
+      return "ERR_MSG";
+    case FAILURE_MSG:
+      return "FAILURE_MSG";
+    case REPORT_STATUS:
+      return "REPORT_STATUS";
+    case REQUEST_SETTINGS:
+      return "REQUEST_SETTINGS";
+    case REPORT_STATUS_V2:
+      return "REPORT_STATUS_V2";
+    case EVENT_MSG:
+      return "EVENT_MSG";
+  }
+  return "unknown";
+}
+
+static std::string formatArg(const TraceRecord &record) {
+  switch (record.event) {
+    case Trace::READ:
+    case Trace::REPLY:
+      return std::to_string(record.arg) + " bytes";
+    case Trace::PARSE:
+    case Trace::STATE_UPDATE:
+      return packetName(record.arg);
+    case Trace::TELEGRAM_SEND:
+      return record.arg == 0 ? "status" : packetName(record.arg);
+    case Trace::TELEGRAM_SENT:
+      return record.arg ? "ok" : "failed";
+  }
+  return "";
+}
+
+static std::string formatTime(int64_t unixNs) {
+  const std::time_t sec = unixNs / 1000000000;
+  std::tm tm;
+  localtime_r(&sec, &tm);
+  char buf[32];
+  std::strftime(buf, sizeof(buf), "%m-%d %H:%M:%S", &tm);
+  std::ostringstream out;
+  out << buf << '.' << std::setw(6) << std::setfill('0')
+      << (unixNs % 1000000000) / 1000;
+  return out.str();
+}
+
+static bool isNotification(uint8_t event) {
+  return event == Trace::TELEGRAM_SEND || event == Trace::TELEGRAM_SENT;
+}
+
+struct Span {
+  uint64_t startNs = 0;
+  uint64_t endNs = 0;
+  bool started = false;
+  bool finished = false;
+};
+
+// (is notification, id)
+using SpanKey = std::pair<bool, uint32_t>;
+
+static void printSummary(const char *name, const std::map<SpanKey, Span> &spans,
+                         bool notifications, size_t slowest,
+                         int64_t realtimeOffsetNs) {
+  std::vector<std::pair<uint64_t, const std::pair<const SpanKey, Span> *>>
+      durations;
+  for (const auto &span : spans) {
+    if (span.first.first == notifications && span.second.started &&
+        span.second.finished) {
+      durations.emplace_back(span.second.endNs - span.second.startNs, &span);
+    }
+  }
+  if (durations.empty()) {
+    return;
+  }
+  std::sort(durations.begin(), durations.end(),
+            [](const auto &a, const auto &b) { return a.first > b.first; });
+
+  auto percentile = [&](double p) {
+    return durations[static_cast<size_t>((1.0 - p) * (durations.size() - 1))]
+               .first /
+           1000.0;
+  };
+  std::cout << std::fixed << std::setprecision(1) << '\n'
+            << durations.size() << ' ' << name << ": p50 " << percentile(0.5)
+            << "us, p90 " << percentile(0.9) << "us, p99 " << percentile(0.99)
+            << "us, max " << durations.front().first / 1000.0 << "us\n";
+  for (size_t i = 0; i < std::min(slowest, durations.size()); ++i) {
+    const auto &[key, span] = *durations[i].second;
+    std::cout << "  #" << key.second << " at "
+              << formatTime(span.startNs + realtimeOffsetNs) << " took "
+              << durations[i].first / 1000.0 << "us\n";
+  }
+}
+
+int main(int argc, char **argv) {
+  const char *path = nullptr;
+  size_t slowest = DEFAULT_SLOWEST;
+  bool quiet = false;
+  for (int i = 1; i < argc; ++i) {
+    if (std::strcmp(argv[i], "--slowest") == 0 && i + 1 < argc) {
+      slowest = std::stoul(argv[++i]);
+    } else if (std::strcmp(argv[i], "--quiet") == 0) {
+      quiet = true;
+    } else if (!path && argv[i][0] != '-') {
+      path = argv[i];
+    } else {
+      path = nullptr;
+      break;
+    }
+  }
+  if (!path) {
+    std::cout << "Usage: " << argv[0]
+              << " <trace file> [--slowest <n>] [--quiet]" << std::endl;
+    return 1;
+  }
+
+  std::ifstream in(path, std::ios::binary);
+  TraceFileHeader header;
+  if (!in.read(reinterpret_cast<char *>(&header), sizeof(header)) ||
+      header.magic != TRACE_MAGIC || header.version != TRACE_VERSION ||
+      header.recordSize != sizeof(TraceRecord)) {
+    std::cerr << path << " is no trace file of a compatible version!"
+              << std::endl;
+    return 2;
+  }
+
+  std::map<SpanKey, Span> spans;
+  for (TraceRecord record;
+       in.read(reinterpret_cast<char *>(&record), sizeof(record));) {
+    const SpanKey key(isNotification(record.event),
+                      static_cast<uint32_t>(record.id));
+    Span &span = spans[key];
+
+    if (!quiet) {
+      std::cout << formatTime(record.timeNs + header.realtimeOffsetNs)
+                << " T" << +record.thread << ' ' << std::left << std::setw(14)
+                << Trace::eventName(record.event) << std::right
+                << (key.first ? " notification #" : " connection #")
+                << record.id << ' ' << formatArg(record);
+      if (span.endNs != 0) {
+        std::cout << std::fixed << std::setprecision(1) << " +"
+                  << (record.timeNs - span.endNs) / 1000.0 << "us";
+      }
+      std::cout << '\n';
+    }
+
+    if (record.event == Trace::ACCEPT || record.event == Trace::TELEGRAM_SEND) {
+      span.started = true;
+      span.startNs = record.timeNs;
+    }
+    // spans whose start was already overwritten in the ring are incomplete
+    span.finished |=
+        record.event == Trace::CLOSE || record.event == Trace::TELEGRAM_SENT;
+    span.endNs = record.timeNs;
+  }
+
+  printSummary("connections", spans, false, slowest, header.realtimeOffsetNs);
+  printSummary("notifications", spans, true, slowest, header.realtimeOffsetNs);
+  return 0;
+}
@@ -1,59 +1,59 @@
+#include "adc_filter.hpp"
 #include "adc_measurement.hpp"
+#include "clock_ctrl.hpp"
 #include "config.hpp"
 #include "serial.hpp"
+#include "settings_defs.hpp"
 
-static int uint16_comp(const void *i1, const void *i2) {
-  uint16_t val1 = *reinterpret_cast<const uint16_t *>(i1);
-  uint16_t val2 = *reinterpret_cast<const uint16_t *>(i2);
-  // order doesn't really matter as we are only interested in the median anyways
-  return val1 - val2;
-}
+#include <avr/eeprom.h>
 
-uint16_t adcMeasurement(uint8_t pin) {
-  uint16_t measurements[ADC_MEASUREMENTS];
+typedef AdcFilterWindow<ADC_MEASUREMENTS, ADC_EMA_SHIFT, ADC_FILTER_MIN_STEP,
+                        ADC_FILTER_NOISE_FACTOR>
+    AdcFilter;
 
-  // take the measurements
-  measurements[0] = analogRead(pin);
-  for (uint8_t i = 1; i < (ADC_MEASUREMENTS); ++i) {
-    _delay_ms(MEASURE_DELAY_MS);
-    measurements[i] = analogRead(pin);
-  }
+static AdcFilter filters[NUM_ANALOG_INPUTS];
 
-  // sort the measurements
-  // use the quicksort algorithm provided by the avr library
-  qsort(measurements, (ADC_MEASUREMENTS), sizeof(measurements[0]), uint16_comp);
+static AdcFilter &filterOf(uint8_t pin) {
+  // analogRead() accepts channels as well as pins
+  return filters[pin >= A0 ? pin - A0 : pin];
+}
 
-  // determine the median
-  uint16_t median;
+static void resetFilter(uint8_t pin, uint16_t settledSample) {
+  AdcFilter &filter = filterOf(pin);
+  filter.reset();
+  filter.push(settledSample);
+}
 
-  // the compiler should be smart enough to optimize this away.
-  // otherwise it is garbage!
-  if (((ADC_MEASUREMENTS) % 2) == 0) {
-    median = (measurements[(ADC_MEASUREMENTS) / 2 - 1] +
-              measurements[(ADC_MEASUREMENTS) / 2]) /
-             2;
-  } else {
-    median = measurements[(ADC_MEASUREMENTS) / 2];
-  }
+void adcQuantityChanged(uint8_t pin) { filterOf(pin).changed(); }
 
-  return median;
+uint16_t adcMeasurement(uint8_t pin, const AdcIdle *idle) {
+  AdcFilter &filter = filterOf(pin);
+  const bool restarted = filter.pushFresh(analogRead(pin));
+
+  // (re)fill the window
+  while (!filter.full()) {
+    delayMs(MEASURE_DELAY_MS);
+    if (idle) {
+      idle->run(idle->ctx);
+      // the sample & hold capacitor still holds the voltage of the pin read
+      // meanwhile, a high impedance sensor needs a conversion to recharge it
+      analogRead(pin);
+    }
+    filter.push(analogRead(pin));
+  }
+  return filter.value(restarted);
 }
 
 uint8_t clampedMeasurement(uint8_t pin, uint16_t min, uint16_t max,
-                           uint16_t &rawMeasurement) {
-  uint16_t value = adcMeasurement(pin);
+                           uint16_t &rawMeasurement, const AdcIdle *idle) {
+  uint16_t value = adcMeasurement(pin, idle);
   SERIALprintP(PSTR(" raw: "));
   SERIALprint(value);
   SERIALprintP(PSTR(" clamped: "));
   // save the unclamped raw measurement value
   rawMeasurement = value;
 
-  // clamp the value first
-  value = constrain(value, min, max);
-
-  // inverted mapping as an increase in moisture/water level results in a lower
-  // ADC value
-  uint8_t percentage = 100 - map(value, min, max, 0, 100);
+  uint8_t percentage = rawToPercentage(value, min, max);
 
   SERIALprint(percentage);
   SERIALprintP(PSTR(" % for pin: "));
@@ -61,3 +61,111 @@ uint8_t clampedMeasurement(uint8_t pin, uint16_t min, uint16_t max,
 
   return percentage;
 }
+
+#define SETTLE_MAX_SAMPLES ((SETTLE_MAX_MS) / (SETTLE_SAMPLE_MS))
+static_assert(SETTLE_MAX_SAMPLES < 0xFF, "Settle time exceeds its EEPROM cell!");
+#define SENSOR_COUNT ((MAX_MOISTURE_SENSOR_COUNT) + (MAX_WATER_SENSOR_COUNT))
+
+// Learned settle time of every sensor in SETTLE_SAMPLE_MS, 0xFF if unknown as
+// for an erased EEPROM
+static uint8_t learnedSettleSamples[SENSOR_COUNT] EEMEM;
+
+uint16_t waitUntilSettled(const SettlingSensor *sensors, uint8_t count) {
+  uint16_t lastReading[SENSOR_COUNT];
+  uint8_t settledAt[SENSOR_COUNT];
+
+  // Sampling starts at half the earliest learned settle time, hence a sensor
+  // that settles sooner is observed and lowers its learned time over the
+  // cycles
+  uint8_t skipSamples = SETTLE_MAX_SAMPLES;
+  for (uint8_t i = 0; i < count; ++i) {
+    uint8_t learned = eeprom_read_byte(&learnedSettleSamples[sensors[i].id]);
+    if (learned > SETTLE_MAX_SAMPLES) {
+      learned = 0;
+    }
+    skipSamples = min(skipSamples, static_cast<uint8_t>(learned / 2));
+    settledAt[i] = 0;
+  }
+
+  // delayMs() requires a compile-time constant
+  for (uint8_t i = 0; i < skipSamples; ++i) {
+    delayMs(SETTLE_SAMPLE_MS);
+  }
+  uint8_t sample = skipSamples;
+  for (uint8_t i = 0; i < count; ++i) {
+    lastReading[i] = analogRead(sensors[i].pin);
+  }
+
+  uint8_t unsettled = count;
+  while (unsettled != 0 && sample < SETTLE_MAX_SAMPLES) {
+    delayMs(SETTLE_SAMPLE_MS);
+    ++sample;
+    for (uint8_t i = 0; i < count; ++i) {
+      if (settledAt[i] != 0) {
+        continue;
+      }
+      const uint16_t reading = analogRead(sensors[i].pin);
+      const uint16_t diff = reading > lastReading[i] ? reading - lastReading[i]
+                                                     : lastReading[i] - reading;
+      lastReading[i] = reading;
+      if (diff <= (SETTLE_TOLERANCE)) {
+        settledAt[i] = sample;
+        --unsettled;
+      }
+    }
+  }
+
+  for (uint8_t i = 0; i < count; ++i) {
+    uint8_t *cell = &learnedSettleSamples[sensors[i].id];
+    const uint8_t learned = eeprom_read_byte(cell);
+    const uint8_t measured = settledAt[i] != 0 ? settledAt[i] : sample;
+    // smoothed to spare the EEPROM writes, update only writes changed cells.
+    // Rounded down, a single slow power up must not keep the learned time up.
+    eeprom_update_byte(cell, learned > SETTLE_MAX_SAMPLES
+                                 ? measured
+                                 : static_cast<uint8_t>(
+                                       (3 * static_cast<uint16_t>(learned) +
+                                        measured) /
+                                       4));
+  }
+
+  // the last reading is as good as any further sample
+  for (uint8_t i = 0; i < count; ++i) {
+    resetFilter(sensors[i].pin, lastReading[i]);
+  }
+
+  SERIALprintP(PSTR("Sensors settled after ms: "));
+  SERIALprintln(static_cast<uint16_t>(sample) * (SETTLE_SAMPLE_MS));
+  return static_cast<uint16_t>(sample) * (SETTLE_SAMPLE_MS);
+}
+
+static uint16_t singleConversion() {
+  ADCSRA |= _BV(ADSC);
+  while (ADCSRA & _BV(ADSC)) {
+  }
+  return ADC;
+}
+
+uint16_t measureSupplyMilliVolt() {
+  // AVcc as reference and the 1.1 V bandgap as input, analogRead() selects
+  // its own reference & channel again
+  ADMUX = _BV(REFS0) | _BV(MUX3) | _BV(MUX2) | _BV(MUX1);
+  delayMs(BANDGAP_SETTLE_MS);
+  // the first conversion after switching the reference is inaccurate
+  singleConversion();
+
+  uint32_t sum = 0;
+  for (uint8_t i = 0; i < (SUPPLY_MEASUREMENTS); ++i) {
+    sum += singleConversion();
+  }
+  if (sum == 0) {
+    return 0;
+  }
+  // Vcc = Vbg * 1023 / reading
+  const uint16_t milliVolt = static_cast<uint32_t>(BANDGAP_MILLIVOLT) * 1023 *
+                             (SUPPLY_MEASUREMENTS) / sum;
+
+  SERIALprintP(PSTR("Supply voltage in mV: "));
+  SERIALprintln(milliVolt);
+  return milliVolt;
+}
@@ -0,0 +1,32 @@
+#include "clock_ctrl.hpp"
+#include "serial.hpp"
+
+// The fuses of the Arduino Nano do not divide the clock after a reset
+uint8_t currentClockPrescale = CLOCK_PRESCALE_FULL;
+
+void setClockPrescale(uint8_t prescale) {
+  if (prescale == currentClockPrescale) {
+    return;
+  }
+  SERIALflush();
+
+  noInterrupts();
+  // To avoid unintentional changes of clock frequency, a special write
+  // procedure must be followed to change the CLKPS bits:
+  // 1. Write the clock prescaler change enable (CLKPCE) bit to one and all
+  // other bits in CLKPR to zero.
+  CLKPR = _BV(CLKPCE);
+  // 2. Within four cycles, write the desired value to CLKPS while writing a
+  // zero to CLKPCE.
+  CLKPR = prescale;
+  interrupts();
+
+#ifndef DISABLE_SERIAL
+  // Scale the baud rate divider to keep the baud rate of Serial.begin()
+  const uint32_t ubrr = UBRR0 + 1;
+  UBRR0 = static_cast<uint16_t>(
+      ((ubrr << currentClockPrescale) >> prescale) - 1);
+#endif
+
+  currentClockPrescale = prescale;
+}
@@ -1,4 +1,5 @@
 #include "lan.hpp"
+#include "clock_ctrl.hpp"
 #include "serial.hpp"
 #include "settings.hpp"
 
@@ -17,8 +18,18 @@ static const IPAddress fallbackDns(FALLBACK_DNS);
 
 static const IPAddress serverIP(LOCAL_SERVER_IP);
 
+#ifdef USE_UDP_TRANSPORT
+static EthernetUDP udp;
+static uint8_t udpSeq = 0;
+#else
 // initialize the library instance:
 static EthernetClient client;
+#endif
+
+// Reports of the cycle, written into the TX memory of the W5500 by
+// sendReports() in one SPI burst with a single SEND command
+static uint8_t txBuf[(MAX_STATUS_V2_SIZE) + 2 + (MAX_EVENTS) * sizeof(Event)];
+static uint16_t txSize = 0;
 
 /* PHYCFGR register:
 Bit: Symbol: Description:
@@ -112,6 +123,10 @@ bool powerUpEthernet(
     SERIALprintln(Ethernet.localIP());
   }
 
+#ifdef USE_UDP_TRANSPORT
+  // There is no connection, the server is only contacted by the first datagram
+  return udp.begin(LOCAL_SERVER_PORT) != 0;
+#else
   SERIALprintlnP(PSTR("Connecting to local server."));
   bool success = client.connect(serverIP, LOCAL_SERVER_PORT);
   SERIALprintP(PSTR("  connection"));
@@ -121,6 +136,7 @@ bool powerUpEthernet(
     SERIALprintlnP(PSTR("failed!"));
   }
   return success;
+#endif
 }
 
 void powerDownEthernet(
@@ -131,9 +147,13 @@ void powerDownEthernet(
 
   SERIALprintlnP(PSTR("Powering down Ethernet."));
 
+#ifdef USE_UDP_TRANSPORT
+  udp.stop();
+#else
   if (client.connected()) {
     client.stop();
   }
+#endif
 
   // Enter power down mode
   W5100.writePHYCFGR_W5500(W5500_RST_LOW | W5500_OPMD | W5500_OPM_POWER_DOWN);
@@ -165,90 +185,244 @@ void powerDownEthernet(const ShiftReg &shiftReg) { powerDownEthernet(); }
 void setupEthernet(const ShiftReg &shiftReg) { setupEthernet(); }
 #endif
 
-void sendStatus(const Status &status) {
-  uint8_t buf[sizeof(status) + 1];
-  buf[0] = REPORT_STATUS;
-  memcpy(buf + 1, &status, sizeof(status));
-  client.write(reinterpret_cast<const char *>(buf), sizeof(status) + 1);
-  client.flush();
-}
+#ifdef USE_UDP_TRANSPORT
+// Sends the datagram until the server acknowledges it and copies the payload of
+// the ack into reply. Returns the payload size or -1 if no ack was received.
+static int exchangeDatagram(uint8_t flags, const uint8_t *data, uint16_t size,
+                            uint8_t *reply, uint16_t replySize) {
+  ClockBoost boost;
+  UdpHeader header;
+  header.seq = ++udpSeq;
+  header.flags = flags;
+
+  for (uint8_t attempt = 0; attempt <= (UDP_RETRANSMITS); ++attempt) {
+    udp.beginPacket(serverIP, LOCAL_SERVER_PORT);
+    udp.write(reinterpret_cast<const uint8_t *>(&header), sizeof(header));
+    udp.write(data, size);
+    udp.endPacket();
 
-void sendWarning(uint8_t waterSensIdx) {
-  uint8_t buf[] = {WARN_MSG, 'r', 'u', 'n', 'n', 'i', 'n', 'g', ' ', 'l',
-                   'o',      'w', ' ', 'o', 'n', ' ', 'w', 'a', 't', 'e',
-                   'r',      ' ', 'a', 't', ' ', 'w', 'a', 't', 'e', 'r',
-                   ' ',      'l', 'e', 'v', 'e', 'l', ' ', 's', 'e', 'n',
-                   's',      'o', 'r', ' ', 'X', '!'};
-  buf[CONST_ARRAY_SIZE(buf) - 2] = '0' + waterSensIdx;
-  client.write(reinterpret_cast<const char *>(buf), CONST_ARRAY_SIZE(buf));
-  client.flush();
+    for (uint8_t polls = 0; polls < (UDP_ACK_TIMEOUT_MS) / 10; ++polls) {
+      const int received = udp.parsePacket();
+      if (received >= static_cast<int>(sizeof(header))) {
+        UdpHeader ack;
+        udp.read(reinterpret_cast<uint8_t *>(&ack), sizeof(ack));
+        // a late ack of a previous attempt is as good as any
+        if (ack.seq == header.seq) {
+          const int payload = received - static_cast<int>(sizeof(ack));
+          return payload > 0 ? udp.read(reply, replySize) : 0;
+        }
+      }
+      delayMs(10);
+    }
+    SERIALprintlnP(PSTR("No ack received, retransmitting!"));
+  }
+  return -1;
 }
+#endif
 
-void updateSettings(Settings &settings) {
-  uint8_t buf[sizeof(settings)];
-  buf[0] = REQUEST_SETTINGS;
-  client.write(reinterpret_cast<const char *>(buf), 1);
-  client.flush();
-  for (uint8_t tries = 0;
-       !client.available() && client.connected() && tries < 254; ++tries) {
+#ifndef USE_UDP_TRANSPORT
+// Reads until size bytes arrived, the server closed the connection or no data
+// arrived within 254 polls. Returns the number of bytes read.
+static uint16_t receive(uint8_t *buf, uint16_t size) {
+  uint16_t readBytes = 0;
+  for (uint8_t tries = 0; readBytes < size && tries < 254;) {
+    const int chunk = client.read(buf + readBytes, size - readBytes);
+    if (chunk > 0) {
+      readBytes += chunk;
+      tries = 0;
+      continue;
+    }
+    if (!client.connected()) {
+      break;
+    }
     // Busy wait for data with a timeout after 254 failed polls
-    _delay_ms(10);
+    delayMs(10);
+    ++tries;
     SERIALprintlnP(PSTR("Waiting for a server response!"));
   }
-  int readBytes = client.read(buf, sizeof(settings));
-  if (readBytes < 0) {
-    SERIALprintlnP(PSTR("Something went wrong reading the settings response! "
-                        "Keeping settings as is!"));
-  } else if (readBytes == 0) {
-    SERIALprintlnP(
-        PSTR("Tried to read the settings but connection was closed!"));
-  } else if (readBytes == 1) {
-    // the server has no settings stored, yet -> sending our current settings to
-    // the server
-    client.write(reinterpret_cast<const char *>(&settings), sizeof(settings));
-    client.flush();
-    SERIALprintlnP(PSTR("Received no settings from the server, readBytes="));
-    SERIALprintln(readBytes);
-  } else if (readBytes == static_cast<int>(sizeof(settings))) {
-    // the server has settings stored -> update ours!
-    memcpy(&settings, buf, sizeof(settings));
-    SERIALprintlnP(PSTR("Received settings from the server!"));
-    SERIALprintP(PSTR("Setting bytes: "));
-    SERIALprint(readBytes);
-    SERIALprintP(PSTR("/"));
-    SERIALprintln(sizeof(settings));
-    for (uint8_t i = 0; i < readBytes; ++i) {
-      SERIALprintP(PSTR("  "));
-      SERIALprintln(buf[i], HEX);
+  return readBytes;
+}
+#endif
+
+// Sends the settings request and stores the SettingsReply followed by its
+// payload in buf. Returns the size of the response, less than announced by the
+// reply if it was cut short, or 0 if the server did not answer.
+static uint16_t requestReply(uint8_t *buf, uint16_t requestSize,
+                             uint16_t bufSize) {
+#ifdef USE_UDP_TRANSPORT
+  const int readBytes = exchangeDatagram(0, buf, requestSize, buf, bufSize);
+  return readBytes < 0 ? 0 : readBytes;
+#else
+  client.write(reinterpret_cast<const char *>(buf), requestSize);
+  uint16_t readBytes = receive(buf, sizeof(SettingsReply));
+  if (readBytes == sizeof(SettingsReply)) {
+    SettingsReply reply;
+    memcpy(&reply, buf, sizeof(reply));
+    readBytes += receive(buf + readBytes,
+                         min(reply.payloadSize,
+                             static_cast<uint16_t>(bufSize - readBytes)));
+  }
+  return readBytes;
+#endif
+}
+
+static void sendPacket(const uint8_t *data, uint16_t size, uint8_t udpFlags) {
+#ifdef USE_UDP_TRANSPORT
+  exchangeDatagram(udpFlags, data, size, nullptr, 0);
+#else
+  client.write(reinterpret_cast<const char *>(data), size);
+#endif
+}
+
+static bool isBitSet(const uint8_t *bitmap, uint8_t idx) {
+  return ((bitmap[idx / 8] >> (idx & 7 /*aka mod 8*/)) & 0x01) != 0;
+}
+
+void stageStatus(const CycleStatus &status) {
+  if (txSize + (MAX_STATUS_V2_SIZE) > sizeof(txBuf)) {
+    return;
+  }
+  uint8_t *pos = txBuf + txSize;
+  *pos++ = REPORT_STATUS_V2;
+  memcpy(pos, &status.header, sizeof(status.header));
+  pos += sizeof(status.header);
+
+  const uint8_t numPlants = min(status.header.numPlants,
+                                static_cast<uint8_t>(MAX_MOISTURE_SENSOR_COUNT));
+  const uint8_t numWaterSensors =
+      min(status.header.numWaterSensors,
+          static_cast<uint8_t>(MAX_WATER_SENSOR_COUNT));
+
+  memcpy(pos, status.ticksSinceIrrigation, numPlants);
+  pos += numPlants;
+  for (uint8_t i = 0; i < numWaterSensors; ++i) {
+    if (isBitSet(status.header.measuredTanks, i)) {
+      memcpy(pos, &status.tanks[i], sizeof(status.tanks[i]));
+      pos += sizeof(status.tanks[i]);
     }
-  } else {
-    SERIALprintP(PSTR("Error received unexpected amount of data: "));
-    SERIALprint(readBytes);
-    SERIALprintlnP(PSTR(" bytes!"));
   }
+  for (uint8_t i = 0; i < numPlants; ++i) {
+    if (isBitSet(status.header.measuredPlants, i)) {
+      memcpy(pos, &status.plants[i], sizeof(status.plants[i]));
+      pos += sizeof(status.plants[i]);
+    }
+  }
+
+  txSize = pos - txBuf;
+}
+
+void stageEvents(const Event *events, uint8_t count) {
+  if (count == 0) {
+    return;
+  }
+  count = min(count, static_cast<uint8_t>(MAX_EVENTS));
+  if (txSize + 2 + count * sizeof(Event) > sizeof(txBuf)) {
+    return;
+  }
+  txBuf[txSize++] = EVENT_MSG;
+  txBuf[txSize++] = count;
+  memcpy(txBuf + txSize, events, count * sizeof(Event));
+  txSize += count * sizeof(Event);
 }
 
-void sendErrorWaterEmpty(uint8_t waterSensIdx) {
-  uint8_t buf[] = {ERR_MSG, 'w', 'a', 't', 'e', 'r', ' ', 'r', 'e', 's',
-                   'e',     'r', 'v', 'o', 'i', 'r', ' ', 'X', ' ', 'i',
-                   's',     ' ', 'e', 'm', 'p', 't', 'y', '!'};
-  buf[CONST_ARRAY_SIZE(buf) - 11] = '1' + waterSensIdx;
-  client.write(reinterpret_cast<const char *>(buf), CONST_ARRAY_SIZE(buf));
-  client.flush();
+void sendReports() {
+  if (txSize == 0) {
+    return;
+  }
+  ClockBoost boost;
+  // No flush: powerDownEthernet() closes the connection, the W5500 only sends
+  // the FIN after the data was acknowledged. Datagrams are acknowledged by the
+  // server.
+  sendPacket(txBuf, txSize, 0);
+  txSize = 0;
 }
 
-void sendErrorHardware(uint8_t moistSensIdx) {
-  uint8_t buf[] = {
-      FAILURE_MSG, 'i', 'r', 'r', 'i', 'g', 'a', 't', 'i', 'o', 'n', ' ',
-      't',         'i', 'm', 'e', 'd', ' ', 'o', 'u', 't', ',', ' ', 'a',
-      's',         's', 'u', 'm', 'i', 'n', 'g', ' ', 'a', ' ', 'h', 'a',
-      'r',         'd', 'w', 'a', 'r', 'e', ' ', 'f', 'a', 'i', 'l', 'u',
-      'r',         'e', ' ', 'a', 't', ' ', 'e', 'i', 't', 'h', 'e', 'r',
-      ' ',         't', 'h', 'e', ' ', 'm', 'o', 'i', 's', 't', 'u', 'r',
-      'e',         ' ', 's', 'e', 'n', 's', 'o', 'r', ' ', 'X', ' ', 'o',
-      'r',         ' ', 'i', 't', 's', ' ', 'p', 'u', 'm', 'p', '!'};
-  buf[CONST_ARRAY_SIZE(buf) - 14] = '1' + moistSensIdx;
-  client.write(reinterpret_cast<const char *>(buf), CONST_ARRAY_SIZE(buf));
-  client.flush();
+void updateSettings(Settings &settings, WakeSchedule &schedule) {
+  // SPI transfers and hashing the settings
+  ClockBoost boost;
+  uint8_t buf[sizeof(SettingsReply) + sizeof(settings)];
+
+  // Second attempt only if the delta could not be applied: request the full
+  // settings instead
+  for (uint8_t attempt = 0; attempt < 2; ++attempt) {
+    SettingsRequest request;
+    request.settingsHash =
+        attempt == 0 ? settingsHash(settings) : SETTINGS_HASH_UNKNOWN;
+    buf[0] = REQUEST_SETTINGS;
+    memcpy(buf + 1, &request, sizeof(request));
+    const uint16_t readBytes =
+        requestReply(buf, 1 + sizeof(request), sizeof(buf));
+
+    if (readBytes == 0) {
+      SERIALprintlnP(
+          PSTR("Tried to read the settings but connection was closed!"));
+      return;
+    }
+    SettingsReply reply;
+    memcpy(&reply, buf, min(readBytes, static_cast<uint16_t>(sizeof(reply))));
+    if (readBytes < sizeof(reply) ||
+        readBytes - sizeof(reply) != reply.payloadSize) {
+      // the wake schedule of a short reply is not trustworthy either
+      SERIALprintP(PSTR("Error received unexpected amount of data: "));
+      SERIALprint(readBytes);
+      SERIALprintlnP(PSTR(" bytes! Keeping settings as is!"));
+      return;
+    }
+    const uint8_t *payload = buf + sizeof(reply);
+    const uint16_t payloadSize = reply.payloadSize;
+
+    // every reply carries the wake schedule of the server
+    memcpy(&schedule, &reply.schedule, sizeof(schedule));
+    SERIALprintP(PSTR("Server time: "));
+    SERIALprint(schedule.serverTime);
+    SERIALprintP(PSTR(" next wake in: "));
+    SERIALprint(schedule.nextWakeSec);
+    SERIALprintP(PSTR(" period: "));
+    SERIALprintln(schedule.periodSec);
+
+    switch (static_cast<SettingsReplyType>(reply.type)) {
+      case SETTINGS_UNKNOWN: {
+        // the server has no settings stored, yet -> sending our current
+        // settings to the server
+        sendPacket(reinterpret_cast<const uint8_t *>(&settings),
+                   sizeof(settings), UDP_SETTINGS_UPLOAD);
+        SERIALprintlnP(PSTR("Received no settings from the server!"));
+        return;
+      }
+      case SETTINGS_UNCHANGED: {
+        SERIALprintlnP(PSTR("Settings are up to date!"));
+        return;
+      }
+      case SETTINGS_FULL: {
+        // Settings is packed, hence it can be checked within the buffer
+        const Settings &received = *reinterpret_cast<const Settings *>(payload);
+        if (payloadSize == sizeof(received) &&
+            settingsHash(received) == reply.settingsHash) {
+          memcpy(&settings, &received, sizeof(settings));
+          SERIALprintlnP(PSTR("Received settings from the server!"));
+          return;
+        }
+        SERIALprintlnP(PSTR("Received corrupted settings!"));
+        return;
+      }
+      case SETTINGS_DELTA: {
+        if (applySettingsDelta(settings, payload, payloadSize,
+                               reply.settingsHash)) {
+          SERIALprintP(PSTR("Applied settings delta of "));
+          SERIALprint(payloadSize);
+          SERIALprintlnP(PSTR(" bytes!"));
+          return;
+        }
+        SERIALprintlnP(PSTR("Settings delta does not apply, requesting the "
+                            "full settings!"));
+        break;
+      }
+      default: {
+        SERIALprintlnP(PSTR("Unknown settings reply!"));
+        return;
+      }
+    }
+  }
 }
+
 #endif
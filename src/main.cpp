@@ -1,169 +1,483 @@
 #include "config.hpp"
 
 #include "adc_measurement.hpp"
+#include "clock_ctrl.hpp"
 #include "lan.hpp"
-#include "macros.hpp"
 #include "power_ctrl.hpp"
 #include "serial.hpp"
 #include "settings.hpp"
 #include "sleep.hpp"
+#include "watchdog_abuse.hpp"
 
 #include <Arduino.h>
 
 // Consts
-static constexpr decltype(A0) moistSensPins[] = MOISTURE_SENSOR_PINS;
-static constexpr decltype(A0) waterSensPins[] = WATER_SENSOR_PINS;
+static constexpr auto &moistSensPins = HW::moistSensPins;
+static constexpr auto &waterSensPins = HW::waterSensPins;
 static constexpr decltype(A0) unusedDigitalPins[] = FREE_DIGITAL_PINS;
 
-static constexpr uint16_t moistSensPwrMap[] = MOIST_SENS_PWR_MAPPING;
-static constexpr uint16_t waterSensPwrMap[] = WATER_SENS_PWR_MAPPING;
-static constexpr uint16_t pumpPwrMap[] = PUMP_PWR_MAPPING;
+static constexpr auto &moistSensPwrMap = HW::moistSensPwrMap;
+static constexpr auto &waterSensPwrMap = HW::waterSensPwrMap;
+static constexpr auto &pumpPwrMap = HW::pumpPwrMap;
+
+// 2 bits per water level sensor: 1 to request a warning, 1 to send an error
+// that the water is empty! the lsb bits are used for the first sensor.
+typedef uint16_t WaterLvlReport;
+static_assert((MAX_WATER_SENSOR_COUNT) * 2 <= sizeof(WaterLvlReport) * 8,
+              "WaterLvlReport is too small for the water sensors of the board");
 
 // Global vars
 static const ShiftReg shiftReg;
 static Settings settings;
-static Status status;
+static CycleStatus status;
+static WakeSchedule schedule;
+
+// Energy budget of a cycle, derived from the supply voltage at its start
+enum EnergyLevel : uint8_t {
+  ENERGY_NORMAL = 0,
+  ENERGY_LOW = 1,
+  ENERGY_CRITICAL = 2
+};
+static EnergyLevel energyLevel = ENERGY_NORMAL;
+// cycles since the last network session of a critical battery
+static uint8_t cyclesWithoutSession = 0;
+
+static EnergyLevel energyLevelOf(uint16_t milliVolt, EnergyLevel last) {
+  // the voltage relaxes after the load of a cycle, a level is only left once
+  // the voltage rose above the hysteresis
+  if (milliVolt < (BATTERY_CRITICAL_MV) ||
+      (last == ENERGY_CRITICAL &&
+       milliVolt < (BATTERY_CRITICAL_MV) + (BATTERY_HYSTERESIS_MV))) {
+    return ENERGY_CRITICAL;
+  }
+  if (milliVolt < (BATTERY_LOW_MV) ||
+      (last != ENERGY_NORMAL &&
+       milliVolt < (BATTERY_LOW_MV) + (BATTERY_HYSTERESIS_MV))) {
+    return ENERGY_LOW;
+  }
+  return ENERGY_NORMAL;
+}
+
+// A declining battery only irrigates the plants that are well below target
+static uint8_t moistureTarget(uint8_t idx) {
+  const uint8_t slack = energyLevel * (BATTERY_MOISTURE_SLACK);
+  const uint8_t target = settings.targetMoisture[idx];
+  return target > slack ? target - slack : 0;
+}
 
 static inline bool isSoilTooDry(uint8_t pin, uint16_t min, uint16_t max,
                                 uint8_t target, uint8_t &measurement,
-                                uint16_t &rawMeasurement) {
+                                uint16_t &rawMeasurement,
+                                const AdcIdle *idle = nullptr) {
   SERIALprintP(PSTR("Measured soil moisture"));
-  measurement = clampedMeasurement(pin, min, max, rawMeasurement);
+  measurement = clampedMeasurement(pin, min, max, rawMeasurement, idle);
   return measurement < target;
 }
 
 static inline bool waterTankNotEmpty(uint8_t pin, uint16_t min, uint16_t max,
                                      uint8_t empty, uint8_t &measurement,
-                                     uint16_t &rawMeasurement) {
+                                     uint16_t &rawMeasurement,
+                                     const AdcIdle *idle = nullptr) {
   SERIALprintP(PSTR("Measured water tank level"));
-  measurement = clampedMeasurement(pin, min, max, rawMeasurement);
+  measurement = clampedMeasurement(pin, min, max, rawMeasurement, idle);
   bool isEmpty = measurement <= empty;
   return !isEmpty;
 }
 
-static uint8_t checkMoisture(uint8_t idx, Status &status,
-                             uint16_t &secondsPassed) {
-  const auto pumpMask = pumpPwrMap[idx];
-  const auto moistPin = moistSensPins[idx];
-  const auto moistSensMask = moistSensPwrMap[idx];
-
-  const auto moistMin = settings.sensConfs[idx].minValue;
-  const auto moistMax = settings.sensConfs[idx].maxValue;
-  const auto moistTarget = settings.targetMoisture[idx];
-  const auto burstDelay = settings.burstDelay[idx];
-  const auto maxBursts = settings.maxBursts[idx];
-
-  const uint8_t waterSensIdx = (settings.moistSensToWaterSensBitmap[idx / 8] >>
-                                (idx & 7 /*aka mod 8*/)) &
-                               0x01;
+// Water level of a tank within the irrigation of a cycle
+struct TankLevel {
+  // last precise measurement, UNDEFINED_LEVEL_16 if there is none yet
+  uint16_t raw;
+  uint32_t measuredAtMs;
+  // pump ticks drawing from the tank since the measurement
+  uint16_t pumpedTicks;
+  // raw increase over drainTicks pump ticks, learned from two measurements
+  uint16_t drainRaw;
+  uint16_t drainTicks;
+};
+
+static TankLevel tankLevels[MAX_WATER_SENSOR_COUNT];
+
+enum JobState : uint8_t {
+  // measure the soil & tank before the next burst
+  JOB_MEASURE,
+  // waiting for a free pump slot, see MAX_CONCURRENT_PUMPS
+  JOB_WAIT_PUMP,
+  JOB_PUMPING,
+  // waiting for the water to seep in
+  JOB_SOAKING,
+  JOB_DONE
+};
+
+// Irrigation of a single plant, advanced by irrigate()
+struct IrrigationJob {
+  uint8_t idx;
+  uint8_t waterSensIdx;
+  JobState state;
+  // bursts started so far
+  uint8_t burst;
+  // remaining watchdog ticks of the current burst or soak window
+  uint16_t ticks;
+  uint8_t emptySamples;
+  bool soilIsTooDry;
+  bool hasWaterLeft;
+  uint16_t rawWaterMeasurement;
+  uint16_t rawMoistMeasurement;
+  uint8_t waterMeasurement;
+};
+
+static void initJob(IrrigationJob &job, uint8_t idx) {
+  job.idx = idx;
+  job.waterSensIdx = getWaterSensIdx(settings, idx);
+  job.state = JOB_MEASURE;
+  job.burst = 0;
+  job.ticks = 0;
+  job.emptySamples = 0;
+  job.soilIsTooDry = false;
+  job.hasWaterLeft = false;
+  job.rawWaterMeasurement = UNDEFINED_LEVEL_16;
+  job.rawMoistMeasurement = UNDEFINED_LEVEL_16;
+  job.waterMeasurement = UNDEFINED_LEVEL_8;
+}
 
-  const auto waterPin = waterSensPins[waterSensIdx];
-  const auto waterSensMask = waterSensPwrMap[waterSensIdx];
+static void initReadings(const IrrigationJob &job, CycleStatus &status) {
+  RawReading &plantReading = status.plants[job.idx].moisture;
+  RawReading &tankReading = status.tanks[job.waterSensIdx];
+  if (tankReading.before == UNDEFINED_LEVEL_16) {
+    tankReading.before = job.rawWaterMeasurement;
+  }
+  if (plantReading.before == UNDEFINED_LEVEL_16) {
+    plantReading.before = job.rawMoistMeasurement;
+  }
+}
 
-  const uint8_t offsetIdx = (MAX_MOISTURE_SENSOR_COUNT) + waterSensIdx;
+// The tank is only measured if its level can't be estimated from a recent
+// measurement and the time pumped since, i.e. the plants sharing a tank
+// measure it once per cycle as long as it is far from running empty.
+static bool tankHasWaterLeft(IrrigationJob &job, uint32_t nowMs,
+                             const AdcIdle &idle) {
+  const uint8_t offsetIdx = (MAX_MOISTURE_SENSOR_COUNT) + job.waterSensIdx;
   const auto waterMin = settings.sensConfs[offsetIdx].minValue;
   const auto waterMax = settings.sensConfs[offsetIdx].maxValue;
-  const auto waterWarning = settings.waterLvlThres[waterSensIdx].warnThres;
-  const auto waterEmpty = settings.waterLvlThres[waterSensIdx].emptyThres;
+  const auto &waterThres = settings.waterLvlThres[job.waterSensIdx];
+  TankLevel &tank = tankLevels[job.waterSensIdx];
+
+  if (tank.raw != UNDEFINED_LEVEL_16 &&
+      nowMs - tank.measuredAtMs <=
+          static_cast<uint32_t>(TANK_LEVEL_MAX_AGE_SEC) * 1000 &&
+      (tank.pumpedTicks == 0 || tank.drainTicks != 0)) {
+    // an increasing raw value means less water
+    const uint32_t estimate =
+        tank.raw + (tank.pumpedTicks == 0
+                        ? 0
+                        : static_cast<uint32_t>(tank.pumpedTicks) *
+                              tank.drainRaw / tank.drainTicks);
+    const uint16_t raw = static_cast<uint16_t>(
+        min(estimate, static_cast<uint32_t>(UINT16_MAX)));
+    const uint8_t percentage = rawToPercentage(raw, waterMin, waterMax);
+    if (percentage > max(waterThres.warnThres, waterThres.emptyThres) +
+                         (TANK_LEVEL_MARGIN)) {
+      job.rawWaterMeasurement = raw;
+      job.waterMeasurement = percentage;
+      return true;
+    }
+  }
 
-  shiftReg.update(moistSensMask | waterSensMask);
-  _delay_ms(POWER_ON_DELAY_MS);
+  if (tank.pumpedTicks != 0) {
+    adcQuantityChanged(waterSensPins[job.waterSensIdx]);
+  }
+  const bool hasWaterLeft = waterTankNotEmpty(
+      waterSensPins[job.waterSensIdx], waterMin, waterMax,
+      waterThres.emptyThres, job.waterMeasurement, job.rawWaterMeasurement,
+      &idle);
+  if (tank.raw != UNDEFINED_LEVEL_16 && tank.pumpedTicks != 0 &&
+      job.rawWaterMeasurement > tank.raw) {
+    tank.drainRaw = job.rawWaterMeasurement - tank.raw;
+    tank.drainTicks = tank.pumpedTicks;
+  }
+  tank.raw = job.rawWaterMeasurement;
+  tank.measuredAtMs = nowMs;
+  tank.pumpedTicks = 0;
+  return hasWaterLeft;
+}
+
+// Check soil moisture once, if it is too low, then irrigate a whole burst!
+// After the wait time, check again. This avoids stopping the irrigation
+// because the sensor is covered with water and the water does not
+// immediately seep into the earth.
+static void measureJob(IrrigationJob &job, CycleStatus &status, uint32_t nowMs,
+                       const AdcIdle &idle) {
+  const uint8_t idx = job.idx;
+  uint8_t moistMeasurement;
+
+  // the medians before the burst would hide the water that seeped in
+  if (job.burst != 0) {
+    adcQuantityChanged(moistSensPins[idx]);
+  }
 
   // timeout to ensure we are not stuck here forever (and flood the plants) in
   // case of an defect sensor/pump
-  constexpr uint32_t measurementDuration =
-      (static_cast<uint32_t>(ADC_MEASUREMENTS) * (MEASURE_DELAY_MS));
-  const uint8_t burstCycles =
-      (static_cast<uint32_t>(settings.burstDuration[idx]) * 1000 +
-       measurementDuration - 1) /
-      measurementDuration;
-
-  uint16_t rawWaterMeasurement = UNDEFINED_LEVEL_16;
-  uint16_t rawMoistMeasurement = UNDEFINED_LEVEL_16;
-  uint8_t waterMeasurement = UNDEFINED_LEVEL_8;
-  uint8_t moistMeasurement = UNDEFINED_LEVEL_8;
-
-  auto initCheck = [&]() {
-    if (status.beforeWaterLevels[waterSensIdx] == UNDEFINED_LEVEL_8) {
-      status.beforeWaterLevels[waterSensIdx] = waterMeasurement;
+  if (job.burst >= settings.maxBursts[idx] ||
+      !(job.soilIsTooDry = isSoilTooDry(
+            moistSensPins[idx], settings.sensConfs[idx].minValue,
+            settings.sensConfs[idx].maxValue, moistureTarget(idx),
+            moistMeasurement, job.rawMoistMeasurement, &idle)) ||
+      !(job.hasWaterLeft = tankHasWaterLeft(job, nowMs, idle))) {
+    job.state = JOB_DONE;
+    return;
+  }
+  if (job.burst == 0) {
+    initReadings(job, status);
+  }
+  job.state = JOB_WAIT_PUMP;
+}
+
+// Takes a single sample of the tank while pumping, the pump is cut as soon as
+// the tank runs empty. Returns true if the job changed its state.
+static bool pumpTick(IrrigationJob &job) {
+  const uint8_t offsetIdx = (MAX_MOISTURE_SENSOR_COUNT) + job.waterSensIdx;
+  ++tankLevels[job.waterSensIdx].pumpedTicks;
+  job.rawWaterMeasurement = analogRead(waterSensPins[job.waterSensIdx]);
+  job.waterMeasurement = rawToPercentage(
+      job.rawWaterMeasurement, settings.sensConfs[offsetIdx].minValue,
+      settings.sensConfs[offsetIdx].maxValue);
+  job.emptySamples =
+      job.waterMeasurement <= settings.waterLvlThres[job.waterSensIdx].emptyThres
+          ? job.emptySamples + 1
+          : 0;
+
+  if (job.emptySamples == (PUMP_EMPTY_SAMPLES)) {
+    SERIALprintlnP(PSTR("Water tank ran empty while pumping"));
+    // a burst interrupted by an empty tank counts as well
+    ++job.burst;
+    job.hasWaterLeft = false;
+    job.state = JOB_DONE;
+    return true;
+  }
+  if (--job.ticks == 0) {
+    ++job.burst;
+    const uint8_t burstDelay = settings.burstDelay[job.idx];
+    job.ticks = static_cast<uint16_t>(static_cast<uint32_t>(burstDelay) *
+                                      1000 / (PUMP_TICK_MS));
+    job.state = job.ticks != 0 ? JOB_SOAKING : JOB_MEASURE;
+    return true;
+  }
+  return false;
+}
+
+static WaterLvlReport finishJob(const IrrigationJob &job, CycleStatus &status) {
+  const uint8_t idx = job.idx;
+  const uint8_t waterSensIdx = job.waterSensIdx;
+
+  if (job.soilIsTooDry && job.hasWaterLeft) {
+    // Only stop irrigating this plant, the others are not affected
+    setHardwareFailure(settings, idx, true);
+  }
+  initReadings(job, status);
+  // Only the raw readings are reported, the server derives the percentages
+  status.plants[idx].moisture.after = job.rawMoistMeasurement;
+  status.plants[idx].bursts = job.burst;
+  status.header.measuredPlants[idx / 8] |= _BV(idx & 7 /*aka mod 8*/);
+  if (job.rawWaterMeasurement != UNDEFINED_LEVEL_16) {
+    // the tank might be shared, keep the last reading of a previous plant
+    status.tanks[waterSensIdx].after = job.rawWaterMeasurement;
+    status.header.measuredTanks[waterSensIdx / 8] |=
+        _BV(waterSensIdx & 7 /*aka mod 8*/);
+  }
+
+  WaterLvlReport retCode =
+      (job.hasWaterLeft ? 0 : 0x02) |
+      (job.waterMeasurement <= settings.waterLvlThres[waterSensIdx].warnThres
+           ? 0x01
+           : 0);
+  return retCode << (waterSensIdx << 1);
+}
+
+// The bursts waiting for a tank that ran empty while pumping would pump dry as
+// well, returns the number of jobs finished
+static uint8_t finishWaitingJobs(IrrigationJob *jobs, uint8_t count,
+                                 const IrrigationJob &emptied) {
+  uint8_t finished = 0;
+  for (uint8_t i = 0; i < count; ++i) {
+    IrrigationJob &job = jobs[i];
+    if (job.state == JOB_WAIT_PUMP &&
+        job.waterSensIdx == emptied.waterSensIdx) {
+      job.rawWaterMeasurement = emptied.rawWaterMeasurement;
+      job.waterMeasurement = emptied.waterMeasurement;
+      job.hasWaterLeft = false;
+      job.state = JOB_DONE;
+      ++finished;
     }
-    if (status.beforeMoistureLevels[idx] == UNDEFINED_LEVEL_8) {
-      status.beforeMoistureLevels[idx] = moistMeasurement;
+  }
+  return finished;
+}
+
+// Sensors of unfinished jobs stay powered to avoid waiting for them to settle
+// again, pumps only while pumping
+static ShiftReg::Word powerMask(const IrrigationJob *jobs, uint8_t count) {
+  ShiftReg::Word mask = 0;
+  for (uint8_t i = 0; i < count; ++i) {
+    const IrrigationJob &job = jobs[i];
+    if (job.state != JOB_DONE) {
+      mask |= moistSensPwrMap[job.idx] | waterSensPwrMap[job.waterSensIdx];
+    }
+    if (job.state == JOB_PUMPING) {
+      mask |= pumpPwrMap[job.idx];
+    }
+  }
+  return mask;
+}
+
+// Cooperative scheduler of the irrigation: the bursts of up to
+// MAX_CONCURRENT_PUMPS plants run at the same time and the soak window of one
+// plant is used to pump another. The watchdog ticks drive the bursts and the
+// soak windows, if all plants are soaking the CPU sleeps until the first one
+// is done.
+static WaterLvlReport irrigate(IrrigationJob *jobs, uint8_t count,
+                               CycleStatus &status, uint16_t &secondsPassed) {
+  SettlingSensor sensors[(MAX_MOISTURE_SENSOR_COUNT) +
+                         (MAX_WATER_SENSOR_COUNT)];
+  uint8_t sensorCount = 0;
+  uint8_t tankBitmap = 0;
+  for (auto &tank : tankLevels) {
+    tank = {UNDEFINED_LEVEL_16, 0, 0, 0, 0};
+  }
+  for (uint8_t i = 0; i < count; ++i) {
+    const uint8_t tank = jobs[i].waterSensIdx;
+    sensors[sensorCount++] = {moistSensPins[jobs[i].idx], jobs[i].idx};
+    if (!(tankBitmap & _BV(tank))) {
+      tankBitmap |= _BV(tank);
+      sensors[sensorCount++] = {
+          waterSensPins[tank],
+          static_cast<uint8_t>((MAX_MOISTURE_SENSOR_COUNT) + tank)};
+    }
+  }
+  shiftReg.update(powerMask(jobs, count));
+  uint32_t elapsedMs = waitUntilSettled(sensors, sensorCount);
+
+  uint8_t activePumps = 0;
+  uint8_t remaining = count;
+  // Advances the running bursts and soak windows by one watchdog tick
+  auto tick = [&]() {
+    elapsedMs += (PUMP_TICK_MS);
+    bool changed = false;
+    for (uint8_t i = 0; i < count; ++i) {
+      IrrigationJob &job = jobs[i];
+      if (job.state == JOB_PUMPING) {
+        if (pumpTick(job)) {
+          --activePumps;
+          remaining -= job.state == JOB_DONE ? 1 : 0;
+          if (!job.hasWaterLeft) {
+            remaining -= finishWaitingJobs(jobs, count, job);
+          }
+          changed = true;
+        }
+      } else if (job.state == JOB_SOAKING && --job.ticks == 0) {
+        job.state = JOB_MEASURE;
+      }
     }
-    if (status.beforeWaterLevelsRaw[waterSensIdx] == UNDEFINED_LEVEL_16) {
-      status.beforeWaterLevelsRaw[waterSensIdx] = rawWaterMeasurement;
+    if (changed) {
+      shiftReg.update(powerMask(jobs, count));
     }
-    if (status.beforeMoistureLevelsRaw[idx] == UNDEFINED_LEVEL_16) {
-      status.beforeMoistureLevelsRaw[idx] = rawMoistMeasurement;
+  };
+  // Processes the ticks that passed without sleeping
+  auto catchUp = [&]() {
+    while (pendingWatchdogTicks != 0) {
+      sleepWatchdogTick();
+      tick();
     }
   };
-
-  bool soilIsTooDry = false;
-  bool hasWaterLeft = false;
-  uint8_t burst = 0;
-  uint8_t burstCycle = 0;
-  for (; burst < maxBursts; ++burst) {
-    // Check soil moisture once, if it is too low, then irrigate a whole burst!
-    // After the wait time, check again. This avoids stopping the irrigation
-    // because the sensor is covered with water and the water does not
-    // immediately seep into the earth.
-    if (!(soilIsTooDry = isSoilTooDry(moistPin, moistMin, moistMax, moistTarget,
-                                      moistMeasurement, rawMoistMeasurement))) {
-      goto stop_irrigation;
+  // A measurement blocks for up to a whole window of samples, the running
+  // bursts advance between its samples to cut the pumps of an empty tank and
+  // to end the bursts in time
+  const AdcIdle idle = {
+      [](void *ctx) { (*static_cast<decltype(catchUp) *>(ctx))(); }, &catchUp};
+
+  startWatchDogTimer(WATCHDOG_TICK_PRESCALE_MASK);
+  while (remaining != 0) {
+    bool changed = false;
+    for (uint8_t i = 0; i < count; ++i) {
+      if (jobs[i].state == JOB_MEASURE) {
+        catchUp();
+        measureJob(jobs[i], status, elapsedMs, idle);
+        if (jobs[i].state == JOB_DONE) {
+          --remaining;
+          changed = true;
+        }
+      }
+    }
+    if (changed) {
+      shiftReg.update(powerMask(jobs, count));
+    }
+    // Catch up the ticks of the last samples before any new burst starts
+    catchUp();
+    if (remaining == 0) {
+      break;
     }
 
-    for (; burstCycle < burstCycles; ++burstCycle) {
-      if (!(hasWaterLeft =
-                waterTankNotEmpty(waterPin, waterMin, waterMax, waterEmpty,
-                                  waterMeasurement, rawWaterMeasurement))) {
-        goto stop_irrigation;
+    bool busy = false;
+    changed = false;
+    uint16_t minSoakTicks = UINT16_MAX;
+    for (uint8_t i = 0; i < count; ++i) {
+      IrrigationJob &job = jobs[i];
+      if (job.state == JOB_WAIT_PUMP && activePumps < (MAX_CONCURRENT_PUMPS)) {
+        job.state = JOB_PUMPING;
+        job.ticks = static_cast<uint16_t>(
+            (static_cast<uint32_t>(settings.burstDuration[job.idx]) * 1000 +
+             (PUMP_TICK_MS)-1) /
+            (PUMP_TICK_MS));
+        job.emptySamples = 0;
+        ++activePumps;
+        changed = true;
+      }
+      if (job.state == JOB_SOAKING) {
+        minSoakTicks = min(minSoakTicks, job.ticks);
+      } else if (job.state != JOB_DONE) {
+        busy = true;
       }
+    }
+    if (changed) {
+      shiftReg.update(powerMask(jobs, count));
+    }
 
-      if (burstCycle == 0) {
-        shiftReg.update(moistSensMask | waterSensMask | pumpMask);
-        if (burst == 0) {
-          initCheck();
+    // Only soaking plants left, sleep through the whole seconds at once
+    const uint16_t soakSec = static_cast<uint16_t>(
+        static_cast<uint32_t>(minSoakTicks) * (PUMP_TICK_MS) / 1000);
+    if (!busy && soakSec != 0) {
+      stopWatchDogTimer();
+      sleepSec(soakSec);
+      elapsedMs += static_cast<uint32_t>(soakSec) * 1000;
+      const uint16_t sleptTicks = static_cast<uint16_t>(
+          static_cast<uint32_t>(soakSec) * 1000 / (PUMP_TICK_MS));
+      for (uint8_t i = 0; i < count; ++i) {
+        if (jobs[i].state == JOB_SOAKING &&
+            (jobs[i].ticks -= sleptTicks) == 0) {
+          jobs[i].state = JOB_MEASURE;
         }
       }
+      startWatchDogTimer(WATCHDOG_TICK_PRESCALE_MASK);
+      continue;
     }
-    burstCycle = 0;
 
-    if (burstDelay > 0) {
-      // Turn off the pump and wait approx. X seconds
-      shiftReg.update(moistSensMask | waterSensMask);
-      secondsPassed += burstDelay;
-      sleepSec(burstDelay);
-    }
+    sleepWatchdogTick();
+    tick();
   }
+  stopWatchDogTimer();
 
-stop_irrigation:
-  // Finally turn the power of the sensors and the pump off
+  // Finally turn the power of the sensors and the pumps off
   shiftReg.disableOutput();
   shiftReg.update(0);
   shiftReg.enableOutput();
 
-  // also add the measurement delays to the seconds passed!
-  secondsPassed += static_cast<uint16_t>(
-      (static_cast<uint32_t>(
-           burst * (burstCycles +
-                    1 /*measuring the soil only once before every burst*/) +
-           burstCycle) *
-       measurementDuration) /
-      1000);
-  // Less precise but faster measurement delay calculation
-  // secondsPassed += static_cast<uint16_t>(burst * burstCycles + burstCycle) *
-  //                  settings.burstDuration[idx];
-
-  settings.hardwareFailure = soilIsTooDry && hasWaterLeft;
-  initCheck();
-  status.afterWaterLevelsRaw[waterSensIdx] = rawWaterMeasurement;
-  status.afterWaterLevels[waterSensIdx] = waterMeasurement;
-  status.afterMoistureLevelsRaw[idx] = rawMoistMeasurement;
-  status.afterMoistureLevels[idx] = moistMeasurement;
-
-  uint8_t retCode =
-      (hasWaterLeft ? 0 : 0x02) | (waterMeasurement <= waterWarning ? 0x01 : 0);
-  return retCode << (waterSensIdx << 1);
+  // also add the measurement delays and the pump durations to the seconds
+  // passed!
+  secondsPassed += static_cast<uint16_t>(elapsedMs / 1000);
+
+  WaterLvlReport retCode = 0;
+  for (uint8_t i = 0; i < count; ++i) {
+    retCode |= finishJob(jobs[i], status);
+  }
+  return retCode;
 }
 
 static void disableDigitalOnAnalogPins() {
@@ -174,20 +488,9 @@ static void disableDigitalOnAnalogPins() {
 }
 
 static void powerSavingSettings() {
-  // reduce the clock speed for a lower power consumption
-#ifndef DEBUG_NORMAL_CPU_SPEED
-  noInterrupts();
-  // To avoid unintentional changes of clock frequency, a special write
-  // procedure must be followed to change the CLKPS bits:
-  // 1. Write the clock prescaler change enable (CLKPCE) bit to one and all
-  // other bits in CLKPR to zero.
-  CLKPR = _BV(CLKPCE);
-  // 2. Within four cycles, write the desired value to CLKPS while writing a
-  // zero to CLKPCE. division factor of 256!!! We are getting really really
-  // slow... 16 MHz / 256 = 62.5 kHz
-  CLKPR = _BV(CLKPS3);
-  interrupts();
-#endif
+  // reduce the clock speed for a lower power consumption, we only speed up
+  // for short bursts of work
+  setClockPrescale(CLOCK_PRESCALE_SLOW);
 
   // Turn off all unused modules:
   // NOTE that you can not use delay(), millis(), etc. afterwards!
@@ -209,22 +512,25 @@ static void powerSavingSettings() {
   disableDigitalOnAnalogPins();
 }
 
-static void setStatusUndef(Status &status) {
-  for (uint8_t i = 0; i < (MAX_MOISTURE_SENSOR_COUNT); ++i) {
-    status.beforeMoistureLevels[i] = UNDEFINED_LEVEL_8;
-    status.afterMoistureLevels[i] = UNDEFINED_LEVEL_8;
-    status.beforeMoistureLevelsRaw[i] = UNDEFINED_LEVEL_16;
-    status.afterMoistureLevelsRaw[i] = UNDEFINED_LEVEL_16;
+static void setStatusUndef(CycleStatus &status) {
+  for (auto &r : status.plants) {
+    r.moisture.before = UNDEFINED_LEVEL_16;
+    r.moisture.after = UNDEFINED_LEVEL_16;
+    r.bursts = 0;
+  }
+  for (auto &r : status.tanks) {
+    r.before = UNDEFINED_LEVEL_16;
+    r.after = UNDEFINED_LEVEL_16;
+  }
+  for (auto &b : status.header.measuredPlants) {
+    b = 0;
   }
-  for (uint8_t i = 0; i < 2; ++i) {
-    status.beforeWaterLevels[i] = UNDEFINED_LEVEL_8;
-    status.afterWaterLevels[i] = UNDEFINED_LEVEL_8;
-    status.beforeWaterLevelsRaw[i] = UNDEFINED_LEVEL_16;
-    status.afterWaterLevelsRaw[i] = UNDEFINED_LEVEL_16;
+  for (auto &b : status.header.measuredTanks) {
+    b = 0;
   }
 }
 
-static void defaultInitStatus(Status &status) {
+static void defaultInitStatus(CycleStatus &status) {
   for (auto &t : status.ticksSinceIrrigation) {
     t = 255;
   }
@@ -246,14 +552,13 @@ static void analogPowerSave() {
 }
 
 static void deinitUnusedAnalogPins() {
-  for (uint8_t i = settings.numPlants; i < CONST_ARRAY_SIZE(moistSensPins);
-       ++i) {
+  for (uint8_t i = settings.numPlants; i < moistSensPins.size(); ++i) {
     // pinMode(moistSensPins[i], INPUT_PULLUP);
     pinMode(moistSensPins[i], OUTPUT);
     digitalWrite(moistSensPins[i], LOW);
   }
   const uint8_t usedWaterSens = getUsedWaterSens(settings);
-  for (uint8_t i = usedWaterSens; i < CONST_ARRAY_SIZE(waterSensPins); ++i) {
+  for (uint8_t i = usedWaterSens; i < waterSensPins.size(); ++i) {
     // pinMode(waterSensPins[i], INPUT_PULLUP);
     pinMode(waterSensPins[i], OUTPUT);
     digitalWrite(waterSensPins[i], LOW);
@@ -261,24 +566,15 @@ static void deinitUnusedAnalogPins() {
 }
 
 static void initAnalogPins() {
-  for (uint8_t i = 0; i < CONST_ARRAY_SIZE(moistSensPins); ++i) {
-    pinMode(moistSensPins[i], INPUT);
+  for (auto p : moistSensPins) {
+    pinMode(p, INPUT);
   }
-  for (uint8_t i = 0; i < CONST_ARRAY_SIZE(waterSensPins); ++i) {
-    pinMode(waterSensPins[i], INPUT);
+  for (auto p : waterSensPins) {
+    pinMode(p, INPUT);
   }
 }
 
 void setup() {
-  // Sanity checks
-  static_assert(CONST_ARRAY_SIZE(moistSensPins) ==
-                CONST_ARRAY_SIZE(moistSensPwrMap));
-  static_assert(CONST_ARRAY_SIZE(moistSensPins) == (MAX_MOISTURE_SENSOR_COUNT));
-  static_assert(CONST_ARRAY_SIZE(waterSensPins) ==
-                CONST_ARRAY_SIZE(waterSensPwrMap));
-  static_assert(CONST_ARRAY_SIZE(waterSensPins) == 2);
-  static_assert((MAX_MOISTURE_SENSOR_COUNT) == CONST_ARRAY_SIZE(pumpPwrMap));
-
   powerSavingSettings();
   analogPowerSave();
 
@@ -325,7 +621,8 @@ void loop() {
 
     shiftReg.update(moistSensMask);
     shiftReg.enableOutput();
-    _delay_ms(POWER_ON_DELAY_MS);
+    const SettlingSensor sensor = {moistPin, idx};
+    waitUntilSettled(&sensor, 1);
 
     uint8_t measurement;
     uint16_t rawMeasurement;
@@ -351,7 +648,8 @@ void loop() {
 
     shiftReg.update(waterSensMask);
     shiftReg.enableOutput();
-    _delay_ms(POWER_ON_DELAY_MS);
+    const SettlingSensor sensor = {waterPin, offsetIdx};
+    waitUntilSettled(&sensor, 1);
 
     uint8_t measurement;
     uint16_t rawMeasurement;
@@ -371,85 +669,141 @@ void loop() {
   // Switch to normal input mode early to ensure enough time to discharge all
   // caps
   initAnalogPins();
-  // allow remote to reset the hardware failure flag
-  if (powerUpEthernet(shiftReg)) {
-    updateSettings(settings);
+  // forget the schedule of the last cycle, the server has to confirm it
+  schedule.serverTime = 0;
+  schedule.nextWakeSec = 0;
+  schedule.periodSec = 0;
+  // measured before any load is powered
+  const uint16_t supplyMilliVolt = measureSupplyMilliVolt();
+  energyLevel = energyLevelOf(supplyMilliVolt, energyLevel);
+  // A declining battery exchanges the settings within the report session,
+  // this saves a power up & connection of the W5500 per cycle. The settings
+  // received are applied with the next cycle.
+  const bool batchSettings = energyLevel != ENERGY_NORMAL;
+  if (!batchSettings) {
+    // allow remote to reset the hardware failure flag
+    if (powerUpEthernet(shiftReg)) {
+      updateSettings(settings, schedule);
+    }
+    powerDownEthernet(shiftReg);
   }
   deinitUnusedAnalogPins();
-  powerDownEthernet(shiftReg);
 
   uint16_t secondsPassed = 0;
-  if (!settings.hardwareFailure) {
-    bool statusChanged = false;
-    setStatusUndef(status);
-    status.numPlants = settings.numPlants;
-    status.numWaterSensors = getUsedWaterSens(settings);
-
-    // 2 bits per water level sensor: 1 to request a warning, 1 to send an error
-    // that the water is empty! the lsb bits are used for the first sensor.
-    uint8_t resCode = 0;
+  bool statusChanged = false;
+  setStatusUndef(status);
+  status.header.numPlants = settings.numPlants;
+  status.header.numWaterSensors = getUsedWaterSens(settings);
+  // unknown, i.e. 0, if the settings are exchanged after the reports
+  status.header.cycleStartTime = schedule.serverTime;
+  status.header.supplyMilliVolt = supplyMilliVolt;
+
+  WaterLvlReport resCode = 0;
+  Event events[MAX_EVENTS];
+  uint8_t eventCount = 0;
 
-    shiftReg.update(0);
-    shiftReg.enableOutput();
+  shiftReg.update(0);
+  shiftReg.enableOutput();
 
-    SERIALprintlnP(PSTR("Irrigation running!"));
-    uint8_t idx = 0;
-    for (; !settings.hardwareFailure && idx < settings.numPlants; ++idx) {
-      bool skip = status.ticksSinceIrrigation[idx] <
-                      settings.ticksBetweenIrrigation[idx] ||
-                  ((settings.skipBitmap[idx / 8] >> (idx & 7 /*aka mod 8*/)) &
-                   0x01) != 0;
-      statusChanged |= !skip;
-      if (!skip) {
-        // This ensures that the tick counter will overflow to 0 -> reset its
-        // value!
-        status.ticksSinceIrrigation[idx] = 255;
-        resCode |= checkMoisture(idx, status, secondsPassed);
-      }
+  SERIALprintlnP(PSTR("Irrigation running!"));
+  IrrigationJob jobs[MAX_MOISTURE_SENSOR_COUNT];
+  uint8_t jobCount = 0;
+  for (uint8_t idx = 0; idx < settings.numPlants; ++idx) {
+    bool skip = status.ticksSinceIrrigation[idx] <
+                    settings.ticksBetweenIrrigation[idx] ||
+                ((settings.skipBitmap[idx / 8] >> (idx & 7 /*aka mod 8*/)) &
+                 0x01) != 0 ||
+                hasHardwareFailure(settings, idx);
+    statusChanged |= !skip;
+    if (!skip) {
+      initJob(jobs[jobCount++], idx);
+    }
+  }
+  if (jobCount != 0) {
+    resCode = irrigate(jobs, jobCount, status, secondsPassed);
+  }
+  for (uint8_t i = 0; i < jobCount; ++i) {
+    if (hasHardwareFailure(settings, jobs[i].idx)) {
+      events[eventCount++] = {EVT_IRRIGATION_TIMEOUT, jobs[i].idx};
     }
+  }
 
-    shiftReg.disableOutput();
-    shiftReg.update(0);
-    analogPowerSave();
+  shiftReg.disableOutput();
+  shiftReg.update(0);
+  analogPowerSave();
+
+  // Update the tick counters!
+  for (auto &t : status.ticksSinceIrrigation) {
+    // prevent overflows, e.g. of the plants with a hardware failure!
+    t = max(t, static_cast<uint8_t>(t + 1));
+  }
+  for (uint8_t i = 0; i < jobCount; ++i) {
+    status.ticksSinceIrrigation[jobs[i].idx] = 0;
+  }
 
-    // Update the tick counters!
-    for (auto &t : status.ticksSinceIrrigation) {
-      ++t;
+  for (uint8_t i = 0; resCode != 0 && i < (MAX_WATER_SENSOR_COUNT);
+       ++i, resCode >>= 2) {
+    if (resCode & 0x02) {
+      events[eventCount++] = {EVT_WATER_EMPTY, i};
+    } else if (resCode & 0x01) {
+      events[eventCount++] = {EVT_WATER_LOW, i};
     }
+  }
 
-    // Only send messages if the status changed!
-    statusChanged |= settings.debug;
-    SERIALprintP(PSTR("Status changed: "));
-    SERIALprintln(statusChanged);
-    if (statusChanged || settings.hardwareFailure) {
-      SERIALprintlnP(PSTR("Send status updates!"));
-      if (powerUpEthernet(shiftReg)) {
-        if (statusChanged) {
-          sendStatus(status);
-          for (uint8_t i = 0; resCode != 0 && i < 2; ++i, resCode >>= 2) {
-            if (resCode & 0x02) {
-              sendErrorWaterEmpty(i);
-            } else if (resCode & 0x01) {
-              sendWarning(i);
-            }
+  // Only send messages if the status changed!
+  statusChanged |= settings.debug;
+  SERIALprintP(PSTR("Status changed: "));
+  SERIALprintln(statusChanged);
+  // A critical battery drops the status reports of most cycles, the events
+  // are still reported right away
+  bool openSession = statusChanged || eventCount != 0;
+  if (energyLevel == ENERGY_CRITICAL) {
+    openSession = eventCount != 0 ||
+                  ++cyclesWithoutSession >= (BATTERY_CRITICAL_SESSION_CYCLES);
+  } else if (batchSettings) {
+    openSession = true;
+  }
+  if (openSession) {
+    cyclesWithoutSession = 0;
+    SERIALprintlnP(PSTR("Send status updates!"));
+    if (powerUpEthernet(shiftReg)) {
+      if (statusChanged) {
+        stageStatus(status);
+      }
+      stageEvents(events, eventCount);
+      sendReports();
+      // The settings are requested after the reports, the server has mirrored
+      // the hardware failures of this cycle by then. They are kept anyway in
+      // case the events got lost, a failed pump must not run again.
+      if (batchSettings) {
+        updateSettings(settings, schedule);
+        for (uint8_t i = 0; i < eventCount; ++i) {
+          if (events[i].code == EVT_IRRIGATION_TIMEOUT) {
+            setHardwareFailure(settings, events[i].arg, true);
           }
         }
-        if (settings.hardwareFailure) {
-          // Send HW error message!
-          sendErrorHardware(idx - 1);
-        }
       }
-      powerDownEthernet(shiftReg);
-    }
-  } else {
-    analogPowerSave();
-    // Update the tick counters!
-    for (auto &t : status.ticksSinceIrrigation) {
-      // prevent overflows!
-      t = max(t, t + 1);
     }
+    powerDownEthernet(shiftReg);
+  }
+  // Prefer the wake time requested by the server, this compensates the drift
+  // of the watchdog oscillator and aligns the cycles to the server schedule.
+  // A batched settings exchange received it after the irrigation.
+  uint32_t sleepPeriod = SLEEP_PERIOD_MIN * 60;
+  uint32_t period = sleepPeriod;
+  uint16_t cycleSec = secondsPassed;
+  if (schedule.nextWakeSec != 0) {
+    sleepPeriod = schedule.nextWakeSec;
+    period = schedule.periodSec;
+    cycleSec = batchSettings ? 0 : secondsPassed;
   }
+  // A declining battery skips whole periods, so the controller still wakes up
+  // in a slot of the server schedule
+  sleepPeriod += ((UINT32_C(1) << energyLevel) - 1) * period;
   SERIALprintlnP(PSTR("Entering long sleep!"));
-  sleepSec(SLEEP_PERIOD_MIN * 60 - secondsPassed);
+  sleepSec(sleepPeriod >
+                   static_cast<uint32_t>(cycleSec) + (MIN_SLEEP_PERIOD_SEC)
+               ? sleepPeriod - cycleSec
+               : (MIN_SLEEP_PERIOD_SEC));
 #endif
 }
@@ -1,38 +1,53 @@
 #include "power_ctrl.hpp"
+#include "clock_ctrl.hpp"
 #include "config.hpp"
 
-void ShiftReg::init() const {
-  pinMode(SHIFT_REG_OUTPUT_EN_PIN, OUTPUT);
+template <class Board>
+void ShiftRegT<Board>::init() const {
+  pinMode(Board::shiftRegOutputEnPin, OUTPUT);
   disableOutput();
 
-  pinMode(SHIFT_REG_DATA_CLK_PIN, OUTPUT);
-  digitalWrite(SHIFT_REG_DATA_CLK_PIN, LOW);
+  pinMode(Board::shiftRegDataClkPin, OUTPUT);
+  digitalWrite(Board::shiftRegDataClkPin, LOW);
 
-  pinMode(SHIFT_REG_OUTPUT_UPDATE_PIN, OUTPUT);
-  digitalWrite(SHIFT_REG_OUTPUT_UPDATE_PIN, LOW);
+  pinMode(Board::shiftRegOutputUpdatePin, OUTPUT);
+  digitalWrite(Board::shiftRegOutputUpdatePin, LOW);
 
-  pinMode(SHIFT_REG_DATA_PIN, OUTPUT);
-  digitalWrite(SHIFT_REG_DATA_PIN, LOW);
+  pinMode(Board::shiftRegDataPin, OUTPUT);
+  digitalWrite(Board::shiftRegDataPin, LOW);
 }
-void ShiftReg::enableOutput() const { digitalWrite(SHIFT_REG_OUTPUT_EN_PIN, LOW); }
-void ShiftReg::disableOutput() const { digitalWrite(SHIFT_REG_OUTPUT_EN_PIN, HIGH); }
-void ShiftReg::update(uint16_t newValue) const {
+template <class Board>
+void ShiftRegT<Board>::enableOutput() const {
+  digitalWrite(Board::shiftRegOutputEnPin, LOW);
+}
+template <class Board>
+void ShiftRegT<Board>::disableOutput() const {
+  digitalWrite(Board::shiftRegOutputEnPin, HIGH);
+}
+template <class Board>
+void ShiftRegT<Board>::update(Word newValue) const {
+  // bit banging takes several digitalWrite() per output
+  ClockBoost boost;
+
   // check my assumptions
   static_assert(LOW == 0x00);
   static_assert(HIGH == 0x01);
 
-  for (uint8_t i = 0; i < 16; ++i) {
+  for (uint8_t i = 0; i < Board::shiftRegBits; ++i) {
     uint8_t targetVal = newValue & 1;
     // first write the serial data
-    digitalWrite(SHIFT_REG_DATA_PIN, targetVal);
+    digitalWrite(Board::shiftRegDataPin, targetVal);
     // then issue a rising clock edge
-    digitalWrite(SHIFT_REG_DATA_CLK_PIN, HIGH);
-    digitalWrite(SHIFT_REG_DATA_CLK_PIN, LOW);
+    digitalWrite(Board::shiftRegDataClkPin, HIGH);
+    digitalWrite(Board::shiftRegDataClkPin, LOW);
 
     newValue >>= 1;
   }
 
   // finally update the outputs, again with a rising edge!
-  digitalWrite(SHIFT_REG_OUTPUT_UPDATE_PIN, HIGH);
-  digitalWrite(SHIFT_REG_OUTPUT_UPDATE_PIN, LOW);
+  digitalWrite(Board::shiftRegOutputUpdatePin, HIGH);
+  digitalWrite(Board::shiftRegOutputUpdatePin, LOW);
 }
+
+// Instantiate the shift register of the configured board
+template struct ShiftRegT<HW>;
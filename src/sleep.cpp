@@ -1,4 +1,5 @@
 #include "sleep.hpp"
+#include "clock_ctrl.hpp"
 #include "lan.hpp"
 #include "serial.hpp"
 #include "watchdog_abuse.hpp"
@@ -42,8 +43,26 @@ namespace {
   }
 } // namespace
 
-void sleepSec(uint16_t duration_in_sec) {
-  uint16_t watchdogTicks = 0;
+void sleepWatchdogTick() {
+  // the ADC would keep drawing current while sleeping
+  ADCSRA &= ~_BV(ADEN);
+  SERIALflush();
+
+  // A tick that fires right between the check and the sleep instruction wakes
+  // us one tick late, but it is still counted and consumed by the next call
+  while (pendingWatchdogTicks == 0) {
+    enterSleepMode();
+  }
+  noInterrupts();
+  --pendingWatchdogTicks;
+  interrupts();
+
+  ADCSRA |= _BV(ADEN);
+}
+
+void sleepSec(uint32_t duration_in_sec) {
+  // a daily wake up takes more than 2^16 ticks of 1 s
+  uint32_t watchdogTicks = 0;
   decltype(watchdogTicks) neededSleepTicks =
       duration_in_sec / WATCHDOG_DURATION_SEC;
   uint8_t remainingSleepSecs = static_cast<uint8_t>(
@@ -74,7 +93,7 @@ void sleepSec(uint16_t duration_in_sec) {
   }
   // use delay for the remaining seconds:
   for (uint8_t i = 0; i < remainingSleepSecs; ++i) {
-    _delay_ms(1000);
+    delayMs(1000);
   }
 
   // Restore previous module power states
@@ -2,9 +2,13 @@
 
 #include <Arduino.h>
 
-void startWatchDogTimer() {
+volatile uint8_t pendingWatchdogTicks = 0;
+
+void startWatchDogTimer(uint8_t prescaleMask) {
   noInterrupts();
 
+  pendingWatchdogTicks = 0;
+
   // reset the watchdog timer
   __asm__ __volatile__("wdr");
   // We need to clear WDRF before we can clear WDE
@@ -13,7 +17,7 @@ void startWatchDogTimer() {
   WDTCSR = _BV(WDCE) | _BV(WDE);
   // Overwrite bits with the wanted configuration
   // Set new prescaler(time-out) and enable interrupt mode
-  WDTCSR = _BV(WDIF) | _BV(WDIE) | WATCHDOG_PRESCALE_MASK;
+  WDTCSR = _BV(WDIF) | _BV(WDIE) | prescaleMask;
 
   interrupts();
 }
@@ -35,5 +39,6 @@ void stopWatchDogTimer() {
 
 // ISR_NOBLOCK let the compiler reenable interrupts ASAP
 ISR(WDT_vect, ISR_NOBLOCK /*__attribute__((flatten))*/) {
-  // Nothing to do here
+  // Only needed to time the pump bursts, the long sleeps just count wake ups
+  ++pendingWatchdogTicks;
 }
\ No newline at end of file
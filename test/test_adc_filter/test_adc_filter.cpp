@@ -0,0 +1,101 @@
+#include <unity.h>
+
+#include "adc_filter.hpp"
+
+// ADC_MEASUREMENTS, ADC_EMA_SHIFT, ADC_FILTER_MIN_STEP, ADC_FILTER_NOISE_FACTOR
+typedef AdcFilterWindow<5, 1, 2, 3> Filter;
+
+static Filter filter;
+
+void setUp() { filter = Filter(); }
+
+void tearDown() {}
+
+// Takes a measurement as adcMeasurement() does, the window is refilled with
+// the given samples
+static uint16_t measure(uint16_t fresh, const uint16_t *refill = nullptr,
+                        bool *restarted = nullptr) {
+  const bool started = filter.pushFresh(fresh);
+  for (uint8_t i = 0; !filter.full(); ++i) {
+    filter.push(refill ? refill[i] : fresh);
+  }
+  if (restarted) {
+    *restarted = started;
+  }
+  return filter.value(started);
+}
+
+static void test_noise_keeps_the_window() {
+  const uint16_t noisy[] = {500, 501, 499, 500};
+  TEST_ASSERT_EQUAL_UINT16(500, measure(500, noisy));
+
+  bool restarted = true;
+  TEST_ASSERT_EQUAL_UINT16(500, measure(502, nullptr, &restarted));
+  TEST_ASSERT_FALSE(restarted);
+}
+
+static void test_a_step_starts_over_without_lag() {
+  measure(500);
+  measure(500);
+
+  bool restarted = false;
+  TEST_ASSERT_EQUAL_UINT16(600, measure(600, nullptr, &restarted));
+  TEST_ASSERT_TRUE(restarted);
+}
+
+static void test_the_step_grows_with_the_noise() {
+  TEST_ASSERT_EQUAL_UINT16(2, filter.maxStep());
+
+  const uint16_t noisy[] = {510, 490, 500, 500};
+  for (uint8_t i = 0; i < 8; ++i) {
+    filter.reset();
+    measure(500, noisy);
+  }
+  TEST_ASSERT_GREATER_THAN_UINT16(20, filter.maxStep());
+
+  bool restarted = true;
+  measure(520, nullptr, &restarted);
+  TEST_ASSERT_FALSE(restarted);
+}
+
+static void test_reset_drops_the_older_samples() {
+  measure(500);
+  measure(500);
+  filter.reset();
+
+  // within the noise, but the window starts over anyway
+  bool restarted = false;
+  TEST_ASSERT_EQUAL_UINT16(499, measure(499, nullptr, &restarted));
+  TEST_ASSERT_TRUE(restarted);
+}
+
+static void test_a_change_restarts_only_the_ema() {
+  // noise of about 10 keeps steps of 10 within the window
+  const uint16_t noisy[] = {510, 490, 500, 500};
+  for (uint8_t i = 0; i < 8; ++i) {
+    filter.reset();
+    measure(500, noisy);
+  }
+  TEST_ASSERT_EQUAL_UINT16(500, measure(510));
+  TEST_ASSERT_EQUAL_UINT16(500, measure(510));
+
+  // the median reached 510, the EMA would lag half way
+  const Filter lagging = filter;
+  TEST_ASSERT_EQUAL_UINT16(505, measure(510));
+
+  filter = lagging;
+  filter.changed();
+  bool restarted = true;
+  TEST_ASSERT_EQUAL_UINT16(510, measure(510, nullptr, &restarted));
+  TEST_ASSERT_FALSE(restarted);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_noise_keeps_the_window);
+  RUN_TEST(test_a_step_starts_over_without_lag);
+  RUN_TEST(test_the_step_grows_with_the_noise);
+  RUN_TEST(test_reset_drops_the_older_samples);
+  RUN_TEST(test_a_change_restarts_only_the_ema);
+  return UNITY_END();
+}